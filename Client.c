@@ -4,25 +4,120 @@
 #include <unistd.h>
 
 #include "Client.h"
+#include "blog.h"
+#include "http2.h"
+#include "placement.h"
+#include "post_import.h"
 
 int next_client_index = 1;
 
+// Clients are allocated on one thread (the accept loop) and freed on the
+// threads that served them. Each allocating thread keeps a private free
+// list; client_free() pushes onto one shared stack, which an allocator
+// takes over whole once its own list runs dry. Taking the whole stack
+// with one exchange means a node is never popped while another thread
+// might push it again, so the stack needs no lock and has no ABA problem.
+//
+// There is a list and a stack per NUMA node, and a client only ever goes
+// back to its own node's, so its memory stays near the threads using it.
+static Client *returned_clients[PLACEMENT_MAX_NODES];
+static __thread Client *free_clients[PLACEMENT_MAX_NODES];
+
+static Client *client_alloc(int node)
+{
+  if (!free_clients[node])
+    free_clients[node] = __atomic_exchange_n(&returned_clients[node], NULL,
+                                             __ATOMIC_ACQUIRE);
+
+  if (!free_clients[node]) {
+    Client *slab =
+        placement_alloc_on_node(CLIENT_SLAB_SIZE * sizeof(Client), node);
+    for (int i = 0; i < CLIENT_SLAB_SIZE; i++) {
+      slab[i].input = NULL;
+      slab[i].input_cap = 0;
+      arena_init(&slab[i].output);
+      arena_init(&slab[i].arena);
+      slab[i].node = node;
+      slab[i].next_free = i + 1 < CLIENT_SLAB_SIZE ? &slab[i + 1] : NULL;
+    }
+    free_clients[node] = slab;
+  }
+
+  Client *cl = free_clients[node];
+  free_clients[node] = cl->next_free;
+  return cl;
+}
+
+static void client_release(Client *cl)
+{
+  Client **stack = &returned_clients[cl->node];
+  cl->next_free = __atomic_load_n(stack, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(stack, &cl->next_free, cl, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
 Client *client_new( int sock_fd, struct sockaddr_in *addr)
 {
-  Client *cl = malloc(sizeof(Client));
+  return client_new_on_cpu(sock_fd, addr, -1);
+}
+
+Client *client_new_on_cpu(int sock_fd, struct sockaddr_in *addr, int cpu)
+{
+  Client *cl = client_alloc(placement_node_of_cpu(cpu));
+  cl->cpu = cpu;
   cl->socket_fd = sock_fd;
   cl->address = *addr;
-  cl->id = next_client_index++;
+  cl->id = __atomic_fetch_add(&next_client_index, 1, __ATOMIC_RELAXED);
+  cl->input_len = 0;
+  cl->queued_count = 0;
+  cl->h2 = NULL;
+  cl->upload = NULL;
+  cl->head_only = 0;
+  cl->import = NULL;
+  timer_init(&cl->timeout);
+  cl->timeout_phase = 0;
 
   return cl;
 }
 
+static void client_trim_arena(Arena *arena)
+{
+  arena_reset(arena);
+  if (arena->blocks && arena->blocks->size > ARENA_BLOCK_SIZE)
+    arena_free(arena);
+}
+
 void client_free(Client* cl)
 {
   if (cl->socket_fd != 0)
     close(cl->socket_fd);
-  
-  free(cl);
+
+  // ordinary buffers are kept for the next connection; ones grown for a
+  // big request are not
+  if (cl->input_cap > CLIENT_INITIAL_INPUT_SIZE) {
+    free(cl->input);
+    cl->input = NULL;
+    cl->input_cap = 0;
+  }
+  cl->queued_count = 0;
+  client_trim_arena(&cl->output);
+  client_trim_arena(&cl->arena);
+  if (cl->h2)
+    h2_connection_free(cl->h2);
+  if (cl->upload) {
+    // the client went away mid-body; nothing of the post is kept
+    blog_post_upload_abort(cl->upload);
+    free(cl->upload->conn.errmsg);
+    free(cl->upload);
+  }
+  if (cl->import) {
+    // batches committed before the client went away stay imported
+    post_import_abort(cl->import);
+    free(cl->import->rows.conn.errmsg);
+    free(cl->import);
+  }
+  client_release(cl);
 }
 
 int client_socket(Client* cl)
@@ -53,6 +148,121 @@ int client_write_string(Client* cl, char* buffer)
   return client_write_buffer(cl, buffer, strlen(buffer));
 }
 
+int client_queue_buffer(Client* cl, char* buffer, int buffer_len)
+{
+  if (buffer_len == 0)
+    return SUCCESS;
+
+  if (cl->queued_count == CLIENT_MAX_QUEUED_BUFFERS &&
+      client_flush(cl) == FAIL)
+    return FAIL;
+
+  char *copy = arena_alloc(&cl->output, buffer_len);
+  memcpy(copy, buffer, buffer_len);
+
+  cl->queued[cl->queued_count].iov_base = copy;
+  cl->queued[cl->queued_count].iov_len = buffer_len;
+  cl->queued_count++;
+
+  return SUCCESS;
+}
+
+int client_queue_string(Client* cl, char* buffer)
+{
+  return client_queue_buffer(cl, buffer, strlen(buffer));
+}
+
+int client_queue_unowned(Client* cl, const char* buffer, int buffer_len)
+{
+  if (buffer_len == 0)
+    return SUCCESS;
+
+  if (cl->queued_count == CLIENT_MAX_QUEUED_BUFFERS &&
+      client_flush(cl) == FAIL)
+    return FAIL;
+
+  cl->queued[cl->queued_count].iov_base = (char *)buffer;
+  cl->queued[cl->queued_count].iov_len = buffer_len;
+  cl->queued_count++;
+
+  return SUCCESS;
+}
+
+int client_flush(Client* cl)
+{
+  int result = SUCCESS;
+  int first = 0;
+
+  while (first < cl->queued_count) {
+    ssize_t written = writev(cl->socket_fd, &cl->queued[first],
+                             cl->queued_count - first);
+    if (written == -1) {
+      perror("writev failed");
+      result = FAIL;
+      break;
+    }
+
+    // skip fully written buffers, then trim a partially written one
+    while (first < cl->queued_count &&
+           (size_t)written >= cl->queued[first].iov_len) {
+      written -= cl->queued[first].iov_len;
+      first++;
+    }
+    if (written > 0) {
+      // not moved: the buffer may not be ours to write
+      struct iovec *partial = &cl->queued[first];
+      partial->iov_base = (char *)partial->iov_base + written;
+      partial->iov_len -= written;
+    }
+  }
+
+  // whatever was not written is dropped with the rest
+  cl->queued_count = 0;
+  arena_reset(&cl->output);
+
+  return result;
+}
+
+void client_end_request(Client* cl)
+{
+  arena_reset(&cl->arena);
+}
+
+int client_read_input(Client* cl, int max_input)
+{
+  if (cl->input_len == cl->input_cap) {
+    if (cl->input_cap >= max_input)
+      return -1;
+
+    int new_cap = cl->input_cap ? cl->input_cap * 2 : CLIENT_INITIAL_INPUT_SIZE;
+    if (new_cap > max_input)
+      new_cap = max_input;
+
+    // +1 keeps room for the terminating NUL
+    cl->input = realloc(cl->input, new_cap + 1);
+    cl->input_cap = new_cap;
+  }
+
+  int amount_read = read(cl->socket_fd, cl->input + cl->input_len,
+                         cl->input_cap - cl->input_len);
+  if (amount_read < 0) {
+    perror("read failed");
+    return -1;
+  }
+
+  cl->input_len += amount_read;
+  cl->input[cl->input_len] = '\0';
+
+  return amount_read;
+}
+
+void client_consume_input(Client* cl, int len)
+{
+  memmove(cl->input, cl->input + len, cl->input_len - len);
+  cl->input_len -= len;
+  cl->input[cl->input_len] = '\0';
+}
+
 int client_id(Client* cl)
 {
   return cl->id;
@@ -1,4 +1,8 @@
 #include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "timer_wheel.h"
 
 #ifndef CLIENT_H
 #define CLIENT_H
@@ -7,16 +11,70 @@
 #define NONEXISTENT_FILE 1
 #define SUCCESS 2
 
+// Responses queued by client_queue_buffer() go out in one writev() per
+// client_flush(). Queueing more than this flushes early.
+#define CLIENT_MAX_QUEUED_BUFFERS 64
+#define CLIENT_INITIAL_INPUT_SIZE (16 * 1024)
+// Clients are carved from slabs of this many and recycled, never freed.
+// A recycled client keeps an input buffer of the initial size.
+#define CLIENT_SLAB_SIZE 64
+
+struct H2Connection;
+struct BlogPostUpload;
+struct PostImport;
 
-typedef struct {
+typedef struct Client {
   int id;
   int socket_fd;
   struct sockaddr_in address;
+
+  // bytes read from the socket that have not been consumed as requests yet
+  char *input;
+  int input_len;
+  int input_cap;
+
+  // response bytes waiting for client_flush(): copies in output, or
+  // buffers queued unowned
+  struct iovec queued[CLIENT_MAX_QUEUED_BUFFERS];
+  int queued_count;
+  Arena output; // reset by every client_flush()
+
+  // scratch for the request being handled; see client_end_request()
+  Arena arena;
+  // answering a HEAD: responses go out without their bodies
+  int head_only;
+
+  // set once the connection has switched to HTTP/2 (see http2.h)
+  struct H2Connection *h2;
+
+  // set while the body of a POST /publish is being streamed in
+  struct BlogPostUpload *upload;
+  // likewise for the body of a POST /api/import (see post_import.h)
+  struct PostImport *import;
+
+  // the read deadline for the current phase (see server.h)
+  Timer timeout;
+  int timeout_phase; // __atomic: the drain reads it from another thread
+
+  // position in the server's list of live connections
+  int live_index;
+
+  // the CPU its thread is pinned to (-1: none), and the NUMA node the
+  // client's memory is on
+  int cpu;
+  int node;
+
+  // link in a free list while the client is not in use
+  struct Client *next_free;
 } Client;
 
+// Safe to call from any thread; ids are unique across threads.
 Client *client_new( int sock_fd, struct sockaddr_in *addr);
+// For a connection whose thread will run on cpu (see placement.h): the
+// client comes from that CPU's NUMA node.
+Client *client_new_on_cpu(int sock_fd, struct sockaddr_in *addr, int cpu);
 
-// closes socket also
+// closes socket also; cl goes back to the slab for client_new() to reuse
 void client_free(Client* cl);
 
 int client_socket(Client* cl);
@@ -25,7 +83,24 @@ struct sockaddr_in client_address(Client* cl);
 int client_write_buffer(Client* cl, char* buffer, int buffer_len);
 int client_write_string(Client* cl, char* buffer);
 
+// copies the buffer; nothing is sent until client_flush()
+int client_queue_buffer(Client* cl, char* buffer, int buffer_len);
+int client_queue_string(Client* cl, char* buffer);
+// Queues the buffer itself, which may be read-only, and must stay as it is
+// until client_flush() returns.
+int client_queue_unowned(Client* cl, const char* buffer, int buffer_len);
+int client_flush(Client* cl);
+// Everything the last requests allocated from cl->arena is dropped. Their
+// responses must already be queued (queueing copies them).
+void client_end_request(Client* cl);
+
+// Appends whatever the socket has (one read()) to cl->input, growing it up
+// to max_input bytes. Returns bytes read, 0 on EOF, -1 on error or when the
+// buffer is already full. cl->input stays NUL terminated.
+int client_read_input(Client* cl, int max_input);
+// drops the first len bytes of cl->input
+void client_consume_input(Client* cl, int len);
+
 int client_id(Client* cl);
 
 #endif
-
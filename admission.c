@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "admission.h"
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+// rendered once, at compile time
+static const char shed_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-type: text/html\r\n"
+    "Content-Length: 20\r\n"
+    "Retry-After: " TO_STRING(SHED_RETRY_AFTER_SECONDS) "\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Server overloaded.\r\n";
+
+// Per-address counts in an open-addressed (linear probing) table. There
+// can never be more distinct addresses than connections, so twice that
+// many rows always leaves free ones. count == 0 marks an empty row.
+#define ADMISSION_TABLE_SIZE (2 * MAX_CONNECTIONS)
+
+typedef struct {
+  in_addr_t addr;
+  int count;
+} AdmissionRow;
+
+static pthread_mutex_t admission_lock = PTHREAD_MUTEX_INITIALIZER;
+static AdmissionRow admission_table[ADMISSION_TABLE_SIZE];
+static int connection_count;
+
+void admission_init(void) {
+  pthread_mutex_lock(&admission_lock);
+  memset(admission_table, 0, sizeof(admission_table));
+  connection_count = 0;
+  pthread_mutex_unlock(&admission_lock);
+}
+
+static int home_row(in_addr_t addr) {
+  // Fibonacci hashing spreads neighbouring addresses apart
+  return (int)((addr * 2654435769u) % ADMISSION_TABLE_SIZE);
+}
+
+// the row holding addr, or the empty row where it would go
+static int find_row(in_addr_t addr) {
+  int row = home_row(addr);
+  while (admission_table[row].count && admission_table[row].addr != addr)
+    row = (row + 1) % ADMISSION_TABLE_SIZE;
+  return row;
+}
+
+int admission_acquire(struct in_addr addr) {
+  int admitted = 0;
+
+  pthread_mutex_lock(&admission_lock);
+  int row = find_row(addr.s_addr);
+  if (connection_count < MAX_CONNECTIONS &&
+      admission_table[row].count < MAX_CONNECTIONS_PER_IP) {
+    admission_table[row].addr = addr.s_addr;
+    admission_table[row].count++;
+    connection_count++;
+    admitted = 1;
+  }
+  pthread_mutex_unlock(&admission_lock);
+
+  return admitted;
+}
+
+void admission_release(struct in_addr addr) {
+  pthread_mutex_lock(&admission_lock);
+  int row = find_row(addr.s_addr);
+  if (admission_table[row].count == 0) {
+    pthread_mutex_unlock(&admission_lock);
+    return; // never admitted
+  }
+  connection_count--;
+
+  if (--admission_table[row].count == 0) {
+    // backward-shift deletion: pull later rows of the probe run into the
+    // hole so that lookups never stop short at it
+    int hole = row;
+    for (int next = (hole + 1) % ADMISSION_TABLE_SIZE;
+         admission_table[next].count;
+         next = (next + 1) % ADMISSION_TABLE_SIZE) {
+      int home = home_row(admission_table[next].addr);
+      // can the entry at next live in the hole without breaking its run?
+      int distance_to_hole =
+          (hole - home + ADMISSION_TABLE_SIZE) % ADMISSION_TABLE_SIZE;
+      int distance_to_next =
+          (next - home + ADMISSION_TABLE_SIZE) % ADMISSION_TABLE_SIZE;
+      if (distance_to_hole < distance_to_next) {
+        admission_table[hole] = admission_table[next];
+        admission_table[next].count = 0;
+        hole = next;
+      }
+    }
+  }
+  pthread_mutex_unlock(&admission_lock);
+}
+
+void admission_shed(int fd) {
+  send(fd, shed_response, sizeof(shed_response) - 1,
+       MSG_DONTWAIT | MSG_NOSIGNAL);
+  shutdown(fd, SHUT_WR);
+  close(fd);
+}
@@ -0,0 +1,28 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <netinet/in.h>
+
+// Connection admission control. Every connection costs a thread, so past
+// these limits new connections get a canned 503 straight from the accept
+// loop instead of a thread of their own.
+
+#define MAX_CONNECTIONS 1024
+#define MAX_CONNECTIONS_PER_IP 32
+
+// how long a shed client is told to wait before trying again
+#define SHED_RETRY_AFTER_SECONDS 5
+
+void admission_init(void);
+
+// Counts a connection from addr and returns 1, or returns 0 if that would
+// go over either limit.
+int admission_acquire(struct in_addr addr);
+// undoes a successful admission_acquire once the connection is gone
+void admission_release(struct in_addr addr);
+
+// Best-effort 503 with Retry-After on a connection we will not serve,
+// without blocking the accept loop; closes fd.
+void admission_shed(int fd);
+
+#endif
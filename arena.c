@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// enough for any type we put in an arena
+#define ARENA_ALIGNMENT 16
+
+static ArenaBlock *arena_block_new(size_t size, ArenaBlock *next) {
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  block->next = next;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void arena_init(Arena *arena) { arena->blocks = NULL; }
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+  ArenaBlock *block = arena->blocks;
+  if (!block || block->size - block->used < size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = arena_block_new(block_size, arena->blocks);
+    arena->blocks = block;
+  }
+
+  void *p = block->data + block->used;
+  block->used += size;
+  return p;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *s) {
+  return arena_strndup(arena, s, strlen(s));
+}
+
+void arena_reset(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  if (!block)
+    return;
+
+  if (!block->next && block->size <= ARENA_MAX_RETAINED) {
+    block->used = 0;
+    return;
+  }
+
+  // replace the chain with one block that would have held it all
+  size_t needed = 0;
+  while (block) {
+    ArenaBlock *next = block->next;
+    needed += block->used;
+    free(block);
+    block = next;
+  }
+  if (needed > ARENA_MAX_RETAINED)
+    needed = ARENA_MAX_RETAINED;
+  if (needed < ARENA_BLOCK_SIZE)
+    needed = ARENA_BLOCK_SIZE;
+  arena->blocks = arena_block_new(needed, NULL);
+}
+
+void arena_free(Arena *arena) {
+  while (arena->blocks) {
+    ArenaBlock *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump-pointer allocator for memory that lives exactly as long as one
+// request (or one batch of queued output). Nothing is freed piecemeal;
+// arena_reset() drops everything at once, so a forgotten free cannot
+// leak past the request.
+//
+// An arena that outgrew its block in one round comes back from
+// arena_reset() as a single block of the size it needed, so the next
+// round of the same shape does not call malloc at all.
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+// an arena never keeps more than this across a reset
+#define ARENA_MAX_RETAINED (1024 * 1024)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next; // older blocks
+  size_t size;
+  size_t used;
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *blocks; // newest first; NULL until the first allocation
+} Arena;
+
+void arena_init(Arena *arena);
+
+// Never fails; like the rest of the server, out of memory is fatal.
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *s);
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+
+// Invalidates everything allocated so far.
+void arena_reset(Arena *arena);
+// arena_reset() and give back the memory too.
+void arena_free(Arena *arena);
+
+#endif
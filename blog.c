@@ -1,9 +1,45 @@
 #include "blog.h"
 
 #include "sqlite3/sqlite3.h"
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+
+int blog_slugify(const char *title, int title_len, char *slug, int slug_cap) {
+    int len = 0;
+    int dash = 0;
+    for (int i = 0; i < title_len && len < slug_cap - 1; i++) {
+        char c = title[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            if (dash && len > 0 && len < slug_cap - 2)
+                slug[len++] = '-';
+            dash = 0;
+            slug[len++] = c;
+        } else {
+            dash = 1;
+        }
+    }
+    if (len == 0)
+        len = snprintf(slug, slug_cap, "post");
+    slug[len] = '\0';
+    return len;
+}
+
+// slugify(title) in SQL, so inserts and the migration derive slugs in the
+// statement itself
+static void slugify_function(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    const char *title = (const char *) sqlite3_value_text(argv[0]);
+    int title_len = sqlite3_value_bytes(argv[0]);
+    char slug[BLOG_SLUG_LENGTH + 1];
+    int len = blog_slugify(title ? title : "", title ? title_len : 0,
+                           slug, sizeof(slug));
+    sqlite3_result_text(ctx, slug, len, SQLITE_TRANSIENT);
+}
 
 int open_db_connection(DBConnection *conn, const char *db_filename) {
     int rc = sqlite3_open(db_filename, &(conn->db));
@@ -11,10 +47,34 @@ int open_db_connection(DBConnection *conn, const char *db_filename) {
         conn->errmsg = strdup(sqlite3_errmsg(conn->db));
         return 1;
     }
+    sqlite3_create_function(conn->db, "slugify", 1,
+                            SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                            slugify_function, NULL, NULL);
+    // pages (post bodies above all) are read from the mapping rather than
+    // copied into the page cache; a no-op where SQLite was built without it
+    sqlite3_exec(conn->db, "PRAGMA mmap_size = " BLOG_MMAP_SIZE ";",
+                 NULL, NULL, NULL);
     return 0;
 }
 
+// The author page query, prepared once (per connection it is used on) and
+// reused by every request; the lock also keeps two threads from stepping
+// it at once.
+static struct {
+    pthread_mutex_t lock;
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+} user_posts_query = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL};
+
 int close_db_connection(DBConnection *conn) {
+    pthread_mutex_lock(&user_posts_query.lock);
+    if (user_posts_query.db == conn->db) {
+        sqlite3_finalize(user_posts_query.stmt);
+        user_posts_query.stmt = NULL;
+        user_posts_query.db = NULL;
+    }
+    pthread_mutex_unlock(&user_posts_query.lock);
+
     int rc = sqlite3_close(conn->db);
     if (rc != SQLITE_OK) {
         conn->errmsg = strdup(sqlite3_errmsg(conn->db));
@@ -23,11 +83,18 @@ int close_db_connection(DBConnection *conn) {
     return 0;
 }
 
+// bodies live apart from the rows every listing reads, which then pack
+// a hundred or so posts to a page
+#define BLOG_POSTS_COLUMNS "(post_id INTEGER PRIMARY KEY AUTOINCREMENT," \
+                           "user TEXT NOT NULL,"                         \
+                           "title TEXT NOT NULL,"                        \
+                           "created_at INTEGER NOT NULL DEFAULT 0,"      \
+                           "slug TEXT NOT NULL DEFAULT '')"
+
 int create_blog_table(DBConnection *conn) {
-    const char *sql = "CREATE TABLE IF NOT EXISTS blog_posts ("
-                      "post_id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                      "user TEXT NOT NULL,"
-                      "title TEXT NOT NULL,"
+    const char *sql = "CREATE TABLE IF NOT EXISTS blog_posts " BLOG_POSTS_COLUMNS ";"
+                      "CREATE TABLE IF NOT EXISTS blog_post_contents ("
+                      "post_id INTEGER PRIMARY KEY,"
                       "content TEXT NOT NULL);";
     char *errmsg;
     int rc = sqlite3_exec(conn->db, sql, NULL, NULL, &errmsg);
@@ -39,30 +106,229 @@ int create_blog_table(DBConnection *conn) {
     return 0;
 }
 
-int insert_blog_post(DBConnection *conn, BlogPost *post) {
-    const char *sql = "INSERT INTO blog_posts (user, title, content) "
-                      "VALUES (?, ?, ?);";
+static const char *insert_blog_post_sql =
+    "INSERT INTO blog_posts (user, title, created_at, slug) "
+    "VALUES (?1, ?2, CAST(strftime('%s', 'now') AS INTEGER), slugify(?2));";
+// run right after it, in the same transaction, with its rowid
+static const char *insert_blog_post_content_sql =
+    "INSERT INTO blog_post_contents (post_id, content) VALUES (?1, ?2);";
+
+static int blog_exec(DBConnection *conn, const char *sql) {
+    char *errmsg;
+    if (sqlite3_exec(conn->db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        conn->errmsg = strdup(errmsg);
+        sqlite3_free(errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+static int blog_has_index(DBConnection *conn, const char *index) {
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    if (sqlite3_prepare_v2(conn->db, "SELECT 1 FROM sqlite_master "
+                           "WHERE type = 'index' AND name = ?;", -1,
+                           &stmt, NULL) != SQLITE_OK)
+        return 0;
+    sqlite3_bind_text(stmt, 1, index, -1, SQLITE_STATIC);
+    int found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+static int blog_posts_has_column(DBConnection *conn, const char *column) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(conn->db, "PRAGMA table_info(blog_posts);", -1,
+                           &stmt, NULL) != SQLITE_OK)
+        return 0;
+    int found = 0;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        found = strcmp((const char *) sqlite3_column_text(stmt, 1), column) == 0;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Runs sql, which takes the first id and the batch size as ?1 and ?2, over
+// every id range of MIGRATION_BATCH_ROWS, each in its own transaction.
+static int migrate_in_batches(DBConnection *conn, const char *sql) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    int last_id = get_next_post_id(conn) - 1;
+    for (int from = 0; from < last_id; from += MIGRATION_BATCH_ROWS) {
+        sqlite3_bind_int(stmt, 1, from);
+        sqlite3_bind_int(stmt, 2, MIGRATION_BATCH_ROWS);
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+            sqlite3_finalize(stmt);
+            return 1;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+// Offline only: the rebuild holds the write lock for as long as copying
+// every row takes, and a process from before it fails on the narrow table.
+int migrate_blog_contents(DBConnection *conn) {
+    if (!blog_posts_has_column(conn, "content"))
+        return 0;
+    // created_at and slug must be there to be copied
+    if (!blog_posts_has_column(conn, "created_at") &&
+        blog_exec(conn, "ALTER TABLE blog_posts ADD COLUMN "
+                        "created_at INTEGER NOT NULL DEFAULT 0;") != 0)
+        return 1;
+    if (!blog_posts_has_column(conn, "slug") &&
+        blog_exec(conn, "ALTER TABLE blog_posts ADD COLUMN "
+                        "slug TEXT NOT NULL DEFAULT '';") != 0)
+        return 1;
+
+    // Bodies move to blog_post_contents, copied a range at a time (rows
+    // already there are kept, so an interrupted run resumes). Then, in one
+    // transaction, any left over follow and the rest is copied to a new,
+    // narrow blog_posts: DROP COLUMN would shrink the rows in place and
+    // leave the table as many pages as before. Its indexes go with the old
+    // table; migrate_blog_table builds them again.
+    if (migrate_in_batches(conn, "INSERT OR IGNORE INTO blog_post_contents "
+                                 "(post_id, content) SELECT post_id, content "
+                                 "FROM blog_posts WHERE post_id > ?1 "
+                                 "AND post_id <= ?1 + ?2;") != 0)
+        return 1;
+    if (blog_exec(conn, "BEGIN IMMEDIATE;"
+                        "INSERT OR IGNORE INTO blog_post_contents "
+                        "(post_id, content) SELECT post_id, content "
+                        "FROM blog_posts WHERE post_id > "
+                        "(SELECT coalesce(max(post_id), 0) "
+                        "FROM blog_post_contents);"
+                        "DROP TABLE IF EXISTS blog_posts_narrow;"
+                        "CREATE TABLE blog_posts_narrow " BLOG_POSTS_COLUMNS ";"
+                        "INSERT INTO blog_posts_narrow "
+                        "(post_id, user, title, created_at, slug) "
+                        "SELECT post_id, user, title, created_at, slug "
+                        "FROM blog_posts ORDER BY post_id;"
+                        "DROP TABLE blog_posts;"
+                        "ALTER TABLE blog_posts_narrow RENAME TO blog_posts;"
+                        "COMMIT;") != 0) {
+        sqlite3_exec(conn->db, "ROLLBACK;", NULL, NULL, NULL);
+        return 1;
+    }
+    return 0;
+}
+
+int migrate_blog_table(DBConnection *conn) {
+    // Rows past this one are published while this runs, by the process
+    // still serving, which may not fill in created_at or slug. The last
+    // step covers them.
+    int start_id = get_next_post_id(conn) - 1;
+    if (start_id < 0)
+        return 1;
+
+    // adding a column with a constant default only rewrites the schema
+    if (!blog_posts_has_column(conn, "created_at") &&
+        blog_exec(conn, "ALTER TABLE blog_posts ADD COLUMN "
+                        "created_at INTEGER NOT NULL DEFAULT 0;") != 0)
+        return 1;
+    if (!blog_posts_has_column(conn, "slug") &&
+        blog_exec(conn, "ALTER TABLE blog_posts ADD COLUMN "
+                        "slug TEXT NOT NULL DEFAULT '';") != 0)
+        return 1;
+
+    // that move is offline; see migrate_blog_contents
+    if (blog_posts_has_column(conn, "content")) {
+        conn->errmsg = strdup("post bodies are still in blog_posts: stop the "
+                              "server and run main --migrate");
+        return 1;
+    }
+
+    // Once the table is narrow an index led by post_id holds what the
+    // table does, so id order listings read the table itself.
+    if (blog_exec(conn, "DROP INDEX IF EXISTS blog_posts_by_time;") != 0)
+        return 1;
+
+    // the last step below; everything before it is done
+    if (blog_has_index(conn, "blog_posts_by_user"))
+        return 0;
+
+    // Slugs for rows from before the column, a range of ids per
+    // transaction so that writers elsewhere never wait long. Rows that
+    // already have one are passed over, so an interrupted run resumes.
+    if (migrate_in_batches(conn, "UPDATE blog_posts SET slug = slugify(title) "
+                                 "WHERE post_id > ?1 AND post_id <= ?1 + ?2 "
+                                 "AND slug = '';") != 0)
+        return 1;
+
+    // The last step builds the covering index for author pages, which then
+    // never read a row, and so marks the migration done. It takes the
+    // write lock, so nothing is published between fixing up the rows that
+    // came in while this ran and the index going in. They were published moments
+    // ago, which is as near as their time can be known.
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "BEGIN IMMEDIATE;"
+             "UPDATE blog_posts SET slug = slugify(title) "
+             "WHERE post_id > %d AND slug = '';"
+             "UPDATE blog_posts SET created_at = CAST(strftime('%%s', 'now') AS INTEGER) "
+             "WHERE post_id > %d AND created_at = 0;"
+             "CREATE INDEX IF NOT EXISTS blog_posts_by_user "
+             "ON blog_posts (user, post_id, created_at, title, slug);"
+             "COMMIT;", start_id, start_id);
+    if (blog_exec(conn, sql) != 0) {
+        sqlite3_exec(conn->db, "ROLLBACK;", NULL, NULL, NULL);
+        return 1;
+    }
+    return 0;
+}
+
+static int insert_blog_post_rows(DBConnection *conn, BlogPost *post) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(conn->db, insert_blog_post_sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
         conn->errmsg = strdup(sqlite3_errmsg(conn->db));
         return 1;
     }
     sqlite3_bind_text(stmt, 1, post->user, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, post->title, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, post->content, -1, SQLITE_TRANSIENT);
     rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
     if (rc != SQLITE_DONE) {
         conn->errmsg = strdup(sqlite3_errmsg(conn->db));
-        sqlite3_finalize(stmt);
         return 1;
     }
+
+    rc = sqlite3_prepare_v2(conn->db, insert_blog_post_content_sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    sqlite3_bind_int64(stmt, 1, sqlite3_last_insert_rowid(conn->db));
+    sqlite3_bind_text(stmt, 2, post->content, -1, SQLITE_TRANSIENT);
+    rc = sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
     return 0;
 }
 
-int select_blog_post(DBConnection *conn, int post_id, BlogPost *post) {
-    const char *sql = "SELECT user, title, content FROM blog_posts WHERE post_id = ?;";
+int insert_blog_post(DBConnection *conn, BlogPost *post) {
+    // a savepoint, so that this also nests in a caller's transaction
+    if (blog_exec(conn, "SAVEPOINT insert_blog_post;") != 0)
+        return 1;
+    if (insert_blog_post_rows(conn, post) != 0) {
+        sqlite3_exec(conn->db, "ROLLBACK TO insert_blog_post; "
+                     "RELEASE insert_blog_post;", NULL, NULL, NULL);
+        return 1;
+    }
+    return blog_exec(conn, "RELEASE insert_blog_post;");
+}
+
+int select_blog_post(DBConnection *conn, int post_id, BlogPost *post, Arena *arena) {
+    const char *sql = "SELECT user, title, content, created_at, slug FROM blog_posts "
+                      "JOIN blog_post_contents USING (post_id) WHERE post_id = ?;";
     sqlite3_stmt *stmt;
     int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
@@ -72,14 +338,18 @@ int select_blog_post(DBConnection *conn, int post_id, BlogPost *post) {
     sqlite3_bind_int(stmt, 1, post_id);
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        // a missing post is not an error worth a message (nor its leak)
+        if (rc != SQLITE_DONE)
+            conn->errmsg = strdup(sqlite3_errmsg(conn->db));
         sqlite3_finalize(stmt);
         return 1;
     }
     post->post_id = post_id;
-    post->user = strdup((const char *) sqlite3_column_text(stmt, 0));
-    post->title = strdup((const char *) sqlite3_column_text(stmt, 1));
-    post->content = strdup((const char *) sqlite3_column_text(stmt, 2));
+    post->user = arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 0));
+    post->title = arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 1));
+    post->content = arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 2));
+    post->created_at = sqlite3_column_int64(stmt, 3);
+    post->slug = arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 4));
     sqlite3_finalize(stmt);
     return 0;
 }
@@ -100,6 +370,169 @@ int get_next_post_id(DBConnection *conn) {
     return max_id + 1;
 }
 
+int for_each_blog_post_title(DBConnection *conn, BlogPostTitleFunc fn, void *ctx) {
+    return for_each_blog_post_title_after(conn, 0, -1, fn, ctx);
+}
+
+int for_each_blog_post_title_after(DBConnection *conn, int after_id, int limit,
+                                   BlogPostTitleFunc fn, void *ctx) {
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT post_id, title FROM blog_posts "
+                      "WHERE post_id > ? "
+                      "ORDER BY post_id LIMIT ?;";
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    sqlite3_bind_int(stmt, 1, after_id);
+    sqlite3_bind_int(stmt, 2, limit);
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int post_id = sqlite3_column_int(stmt, 0);
+        const char *title = (const char *) sqlite3_column_text(stmt, 1);
+        if (fn(ctx, post_id, title)) {
+            sqlite3_finalize(stmt);
+            return 1;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+int for_each_blog_post(DBConnection *conn, BlogPostFunc fn, void *ctx) {
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT post_id, user, title, content, created_at, slug "
+                      "FROM blog_posts JOIN blog_post_contents USING (post_id) "
+                      "ORDER BY post_id;";
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    BlogPost post;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        // sqlite's own copies; nothing is allocated per row
+        post.post_id = sqlite3_column_int(stmt, 0);
+        post.user = (char *) sqlite3_column_text(stmt, 1);
+        post.title = (char *) sqlite3_column_text(stmt, 2);
+        post.content = (char *) sqlite3_column_text(stmt, 3);
+        post.created_at = sqlite3_column_int64(stmt, 4);
+        post.slug = (char *) sqlite3_column_text(stmt, 5);
+        if (fn(ctx, &post)) {
+            sqlite3_finalize(stmt);
+            return 1;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+int for_each_user_post_title(DBConnection *conn, const char *user, int before_id,
+                             int limit, BlogPostTitleFunc fn, void *ctx) {
+    pthread_mutex_lock(&user_posts_query.lock);
+    if (user_posts_query.db != conn->db) {
+        sqlite3_finalize(user_posts_query.stmt);
+        user_posts_query.stmt = NULL;
+        user_posts_query.db = NULL;
+        // a seek on blog_posts_by_user, then a walk down that author's
+        // entries; other authors' posts are never looked at
+        const char *sql = "SELECT post_id, title FROM blog_posts "
+                          "INDEXED BY blog_posts_by_user "
+                          "WHERE user = ?1 AND post_id < ?2 "
+                          "ORDER BY post_id DESC LIMIT ?3;";
+        if (sqlite3_prepare_v3(conn->db, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                               &user_posts_query.stmt, NULL) != SQLITE_OK) {
+            conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+            pthread_mutex_unlock(&user_posts_query.lock);
+            return 1;
+        }
+        user_posts_query.db = conn->db;
+    }
+
+    sqlite3_stmt *stmt = user_posts_query.stmt;
+    sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, before_id);
+    sqlite3_bind_int(stmt, 3, limit);
+    int rc;
+    int stopped = 0;
+    while (!stopped && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        stopped = fn(ctx, sqlite3_column_int(stmt, 0),
+                     (const char *) sqlite3_column_text(stmt, 1));
+    }
+    if (!stopped && rc != SQLITE_DONE)
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    pthread_mutex_unlock(&user_posts_query.lock);
+    return stopped || rc != SQLITE_DONE;
+}
+
+int for_each_recent_blog_post(DBConnection *conn, int limit, BlogPostFunc fn,
+                              void *ctx) {
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT post_id, user, title, created_at, slug "
+                      "FROM blog_posts "
+                      "ORDER BY post_id DESC LIMIT ?;";
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    sqlite3_bind_int(stmt, 1, limit);
+    BlogPost post = {0, NULL, NULL, NULL, 0, NULL};
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        post.post_id = sqlite3_column_int(stmt, 0);
+        post.user = (char *) sqlite3_column_text(stmt, 1);
+        post.title = (char *) sqlite3_column_text(stmt, 2);
+        post.created_at = sqlite3_column_int64(stmt, 3);
+        post.slug = (char *) sqlite3_column_text(stmt, 4);
+        if (fn(ctx, &post)) {
+            sqlite3_finalize(stmt);
+            return 1;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+int select_recent_post_ids(DBConnection *conn, int *ids, int max_ids) {
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT post_id FROM blog_posts "
+                      "ORDER BY post_id DESC LIMIT ?;";
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, max_ids);
+    int count = 0;
+    while (count < max_ids && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ids[count++] = sqlite3_column_int(stmt, 0);
+    }
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        conn->errmsg = strdup(sqlite3_errmsg(conn->db));
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
+
 void parse_blog_post(const char *query_string, char *user, char *title, char *content) {
     char *token, *pair, *saveptr;
 
@@ -138,3 +571,436 @@ void parse_blog_post(const char *query_string, char *user, char *title, char *co
     }
 }
 
+
+int use_write_ahead_log(DBConnection *conn) {
+    char *errmsg;
+    int rc = sqlite3_exec(conn->db, "PRAGMA journal_mode=WAL;", NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK) {
+        conn->errmsg = strdup(errmsg);
+        sqlite3_free(errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+enum {
+    UPLOAD_FIELD_KEY,
+    UPLOAD_FIELD_USER,
+    UPLOAD_FIELD_TITLE,
+    UPLOAD_FIELD_CONTENT,
+    UPLOAD_FIELD_IGNORED,
+};
+
+// bytes of content translated ('+' to ' ') per write to the spool, and
+// copied per sqlite3_blob_write
+#define UPLOAD_WRITE_SIZE 4096
+
+static int upload_exec(BlogPostUpload *upload, const char *sql) {
+    char *errmsg;
+    int rc = sqlite3_exec(upload->conn.db, sql, NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK) {
+        upload->conn.errmsg = strdup(errmsg);
+        sqlite3_free(errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+int blog_post_upload_begin(BlogPostUpload *upload, DBConnection *conn, long body_length) {
+    memset(upload, 0, sizeof(BlogPostUpload));
+    upload->body_remaining = body_length;
+    upload->field = UPLOAD_FIELD_KEY;
+
+    const char *db_filename = sqlite3_db_filename(conn->db, "main");
+    if (open_db_connection(&upload->conn, db_filename) != 0) {
+        upload->failed = 1;
+        return 1;
+    }
+    sqlite3_busy_timeout(upload->conn.db, UPLOAD_BUSY_TIMEOUT_MS);
+    return 0;
+}
+
+static int upload_write_content(BlogPostUpload *upload, const char *data, int len) {
+    char translated[UPLOAD_WRITE_SIZE];
+    while (len > 0) {
+        int n = len < UPLOAD_WRITE_SIZE ? len : UPLOAD_WRITE_SIZE;
+        for (int i = 0; i < n; i++)
+            translated[i] = data[i] == '+' ? ' ' : data[i];
+
+        if (fwrite(translated, 1, n, upload->spool) != (size_t) n) {
+            upload->conn.errmsg = strdup(strerror(errno));
+            return 1;
+        }
+        upload->content_len += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void upload_append_field(BlogPostUpload *upload, char c) {
+    char *value = upload->field == UPLOAD_FIELD_USER ? upload->user : upload->title;
+    int *value_len = upload->field == UPLOAD_FIELD_USER ? &upload->user_len : &upload->title_len;
+    if (*value_len < BLOG_FIELD_LENGTH - 1)
+        value[(*value_len)++] = c == '+' ? ' ' : c;
+}
+
+// the key before '=' picks where the value goes; a second content field
+// is dropped, as parse_blog_post does
+static int upload_start_value(BlogPostUpload *upload) {
+    upload->key[upload->key_len] = '\0';
+    upload->key_len = 0;
+
+    if (strcmp(upload->key, "user") == 0) {
+        upload->field = UPLOAD_FIELD_USER;
+        upload->user_len = 0;
+    } else if (strcmp(upload->key, "title") == 0) {
+        upload->field = UPLOAD_FIELD_TITLE;
+        upload->title_len = 0;
+    } else if (strcmp(upload->key, "content") == 0 && !upload->spool) {
+        upload->field = UPLOAD_FIELD_CONTENT;
+        upload->spool = tmpfile();
+        if (!upload->spool) {
+            upload->conn.errmsg = strdup(strerror(errno));
+            return 1;
+        }
+    } else {
+        upload->field = UPLOAD_FIELD_IGNORED;
+    }
+    return 0;
+}
+
+static int upload_parse(BlogPostUpload *upload, const char *data, int len) {
+    const char *end = data + len;
+    while (data < end) {
+        if (upload->field == UPLOAD_FIELD_CONTENT) {
+            const char *amp = memchr(data, '&', end - data);
+            const char *run_end = amp ? amp : end;
+            if (upload_write_content(upload, data, run_end - data) != 0)
+                return 1;
+            upload->body_remaining -= run_end - data;
+            data = run_end;
+            if (amp) {
+                upload->field = UPLOAD_FIELD_KEY;
+                upload->body_remaining--;
+                data++;
+            }
+            continue;
+        }
+
+        char c = *data++;
+        upload->body_remaining--;
+
+        if (c == '&') {
+            upload->field = UPLOAD_FIELD_KEY;
+            upload->key_len = 0;
+        } else if (upload->field == UPLOAD_FIELD_KEY) {
+            if (c == '=') {
+                if (upload_start_value(upload) != 0)
+                    return 1;
+            } else if (upload->key_len < (int) sizeof(upload->key) - 1) {
+                upload->key[upload->key_len++] = c;
+            }
+        } else if (upload->field != UPLOAD_FIELD_IGNORED) {
+            upload_append_field(upload, c);
+        }
+    }
+    return 0;
+}
+
+int blog_post_upload_feed(BlogPostUpload *upload, const char *data, int len) {
+    // a failed upload still has to swallow the rest of its body
+    long remaining = upload->body_remaining - len;
+    if (!upload->failed && upload_parse(upload, data, len) != 0)
+        upload->failed = 1;
+    upload->body_remaining = remaining;
+    return upload->failed;
+}
+
+// Inserts the row, then its content sized to the spool and copied in from
+// it; nothing here waits on the client.
+static int upload_insert_rows(BlogPostUpload *upload) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(upload->conn.db, insert_blog_post_sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        return 1;
+    }
+    sqlite3_bind_text(stmt, 1, upload->user, upload->user_len, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, upload->title, upload->title_len, SQLITE_TRANSIENT);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        return 1;
+    }
+    upload->post_id = sqlite3_last_insert_rowid(upload->conn.db);
+
+    rc = sqlite3_prepare_v2(upload->conn.db, insert_blog_post_content_sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        return 1;
+    }
+    sqlite3_bind_int64(stmt, 1, upload->post_id);
+    if (upload->content_len > 0)
+        sqlite3_bind_zeroblob64(stmt, 2, upload->content_len);
+    else
+        sqlite3_bind_text(stmt, 2, "", 0, SQLITE_STATIC);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        return 1;
+    }
+    if (upload->content_len == 0)
+        return 0;
+
+    sqlite3_blob *blob;
+    rc = sqlite3_blob_open(upload->conn.db, "main", "blog_post_contents", "content",
+                           upload->post_id, 1, &blob);
+    if (rc != SQLITE_OK) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        return 1;
+    }
+    char chunk[UPLOAD_WRITE_SIZE];
+    long copied = 0;
+    rewind(upload->spool);
+    while (rc == SQLITE_OK && copied < upload->content_len) {
+        size_t n = fread(chunk, 1, sizeof(chunk), upload->spool);
+        if (n == 0) {
+            upload->conn.errmsg = strdup("content spool ended early");
+            sqlite3_blob_close(blob);
+            return 1;
+        }
+        rc = sqlite3_blob_write(blob, chunk, n, copied);
+        copied += n;
+    }
+    if (rc != SQLITE_OK) {
+        upload->conn.errmsg = strdup(sqlite3_errmsg(upload->conn.db));
+        sqlite3_blob_close(blob);
+        return 1;
+    }
+    return sqlite3_blob_close(blob) != SQLITE_OK;
+}
+
+int blog_post_upload_finish(BlogPostUpload *upload) {
+    if (upload->failed || upload->body_remaining > 0)
+        goto fail;
+    if (upload->spool && fflush(upload->spool) != 0) {
+        upload->conn.errmsg = strdup(strerror(errno));
+        goto fail;
+    }
+
+    if (upload_exec(upload, "BEGIN IMMEDIATE;") != 0)
+        goto fail;
+    upload->in_transaction = 1;
+    if (upload_insert_rows(upload) != 0 || upload_exec(upload, "COMMIT;") != 0)
+        goto fail;
+    upload->in_transaction = 0;
+
+    if (upload->spool) {
+        fclose(upload->spool);
+        upload->spool = NULL;
+    }
+    close_db_connection(&upload->conn);
+    return 0;
+
+fail:
+    blog_post_upload_abort(upload);
+    return 1;
+}
+
+void blog_post_upload_abort(BlogPostUpload *upload) {
+    if (upload->spool) {
+        fclose(upload->spool);
+        upload->spool = NULL;
+    }
+    if (upload->in_transaction) {
+        sqlite3_exec(upload->conn.db, "ROLLBACK;", NULL, NULL, NULL);
+        upload->in_transaction = 0;
+    }
+    if (upload->conn.db) {
+        sqlite3_close(upload->conn.db);
+        upload->conn.db = NULL;
+    }
+}
+
+static int import_exec(BlogPostImport *import, const char *sql) {
+    char *errmsg;
+    if (sqlite3_exec(import->conn.db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        free(import->conn.errmsg);
+        import->conn.errmsg = strdup(errmsg);
+        sqlite3_free(errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+int blog_post_import_begin(BlogPostImport *import, DBConnection *conn) {
+    memset(import, 0, sizeof(BlogPostImport));
+
+    const char *db_filename = sqlite3_db_filename(conn->db, "main");
+    if (open_db_connection(&import->conn, db_filename) != 0)
+        return 1;
+    sqlite3_busy_timeout(import->conn.db, UPLOAD_BUSY_TIMEOUT_MS);
+
+    // blog_posts_by_user is kept up row by row rather than dropped here and
+    // built again at the end. Imports run beside a serving process (POST
+    // /api/import, or main --import on a live database) whose author pages
+    // read nothing else, batches commit as they go so those pages would go
+    // without it for the whole import, and migrate_blog_table takes the
+    // index to mean the migration is done. Its entries are short, and an
+    // author's new posts go at the end of that author's run.
+
+    // the same statements insert_blog_post runs, prepared once for every row
+    if (sqlite3_prepare_v2(import->conn.db, insert_blog_post_sql, -1,
+                           &import->insert, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(import->conn.db, insert_blog_post_content_sql, -1,
+                           &import->insert_content, NULL) != SQLITE_OK) {
+        import->conn.errmsg = strdup(sqlite3_errmsg(import->conn.db));
+        blog_post_import_abort(import);
+        return 1;
+    }
+    return 0;
+}
+
+int blog_post_import_add(BlogPostImport *import,
+                         const char *user, int user_len,
+                         const char *title, int title_len,
+                         const char *content, int content_len) {
+    if (!import->in_transaction) {
+        if (import_exec(import, "BEGIN IMMEDIATE;") != 0)
+            return 1;
+        import->in_transaction = 1;
+    }
+
+    // the strings only have to outlive the step
+    sqlite3_bind_text(import->insert, 1, user, user_len, SQLITE_STATIC);
+    sqlite3_bind_text(import->insert, 2, title, title_len, SQLITE_STATIC);
+    int rc = sqlite3_step(import->insert);
+    sqlite3_reset(import->insert);
+    if (rc == SQLITE_DONE) {
+        // a failure leaves the row behind, but the caller then aborts the
+        // batch it is in
+        sqlite3_bind_int64(import->insert_content, 1,
+                           sqlite3_last_insert_rowid(import->conn.db));
+        sqlite3_bind_text(import->insert_content, 2, content, content_len,
+                          SQLITE_STATIC);
+        rc = sqlite3_step(import->insert_content);
+        sqlite3_reset(import->insert_content);
+    }
+    if (rc != SQLITE_DONE) {
+        free(import->conn.errmsg);
+        import->conn.errmsg = strdup(sqlite3_errmsg(import->conn.db));
+        return 1;
+    }
+
+    if (++import->batch_rows == IMPORT_BATCH_ROWS)
+        return blog_post_import_commit(import);
+    return 0;
+}
+
+int blog_post_import_commit(BlogPostImport *import) {
+    if (!import->in_transaction)
+        return 0;
+    if (import_exec(import, "COMMIT;") != 0)
+        return 1;
+    import->in_transaction = 0;
+    import->committed_rows += import->batch_rows;
+    import->batch_rows = 0;
+    return 0;
+}
+
+int blog_post_import_finish(BlogPostImport *import) {
+    int result = blog_post_import_commit(import);
+    blog_post_import_abort(import);
+    return result;
+}
+
+void blog_post_import_abort(BlogPostImport *import) {
+    if (import->in_transaction) {
+        sqlite3_exec(import->conn.db, "ROLLBACK;", NULL, NULL, NULL);
+        import->in_transaction = 0;
+        import->batch_rows = 0;
+    }
+    if (import->insert) {
+        sqlite3_finalize(import->insert);
+        import->insert = NULL;
+    }
+    if (import->insert_content) {
+        sqlite3_finalize(import->insert_content);
+        import->insert_content = NULL;
+    }
+    if (import->conn.db) {
+        sqlite3_close(import->conn.db);
+        import->conn.db = NULL;
+    }
+}
+
+int backup_blog_db(DBConnection *conn, const char *dest_path, int *pages_copied) {
+    *pages_copied = 0;
+
+    DBConnection source;
+    const char *db_filename = sqlite3_db_filename(conn->db, "main");
+    if (open_db_connection(&source, db_filename) != 0) {
+        conn->errmsg = source.errmsg;
+        sqlite3_close(source.db);
+        return 1;
+    }
+    // A read transaction held across the steps: every step copies from the
+    // same snapshot, and a publish in between neither waits for the backup
+    // nor makes it start over (it would without one).
+    char *errmsg;
+    if (sqlite3_exec(source.db, "BEGIN; SELECT count(*) FROM sqlite_master;",
+                     NULL, NULL, &errmsg) != SQLITE_OK) {
+        conn->errmsg = strdup(errmsg);
+        sqlite3_free(errmsg);
+        sqlite3_close(source.db);
+        return 1;
+    }
+
+    // written next to the destination and renamed over it when complete,
+    // so an existing backup is never left half overwritten
+    int tmp_len = strlen(dest_path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", dest_path);
+    unlink(tmp_path);
+
+    sqlite3 *dest;
+    int rc = sqlite3_open(tmp_path, &dest);
+    sqlite3_backup *backup = NULL;
+    if (rc == SQLITE_OK) {
+        backup = sqlite3_backup_init(dest, "main", source.db, "main");
+        if (!backup)
+            rc = sqlite3_errcode(dest);
+    }
+    while (backup) {
+        rc = sqlite3_backup_step(backup, BACKUP_PAGES_PER_STEP);
+        if (rc == SQLITE_DONE)
+            break;
+        if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED)
+            break;
+        // let the disk serve everybody else for a moment
+        sqlite3_sleep(BACKUP_STEP_PAUSE_MS);
+    }
+    if (backup) {
+        *pages_copied = sqlite3_backup_pagecount(backup);
+        sqlite3_backup_finish(backup);
+    }
+    if (rc == SQLITE_DONE || rc == SQLITE_OK)
+        rc = sqlite3_errcode(dest);
+    if (rc != SQLITE_OK)
+        conn->errmsg = strdup(sqlite3_errmsg(dest));
+    sqlite3_close(dest);
+    sqlite3_exec(source.db, "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(source.db);
+
+    if (rc == SQLITE_OK && rename(tmp_path, dest_path) != 0) {
+        conn->errmsg = strdup(strerror(errno));
+        rc = SQLITE_ERROR;
+    }
+    if (rc != SQLITE_OK)
+        unlink(tmp_path);
+    free(tmp_path);
+    return rc == SQLITE_OK ? 0 : 1;
+}
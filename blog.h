@@ -1,6 +1,9 @@
 #ifndef BLOG_H
 #define BLOG_H
 
+#include <stdio.h>
+
+#include "arena.h"
 #include "sqlite3/sqlite3.h"
 
 typedef struct {
@@ -8,6 +11,8 @@ typedef struct {
     char *user;
     char *title;
     char *content;
+    sqlite3_int64 created_at; // unix time; 0 for posts from before it was kept
+    char *slug; // the title as a URL path segment, see blog_slugify()
 } BlogPost;
 
 typedef struct {
@@ -19,14 +24,173 @@ int open_db_connection(DBConnection *conn, const char *db_filename);
 
 int close_db_connection(DBConnection *conn);
 
+// Most of the file that is mapped for reading (see PRAGMA mmap_size)
+#define BLOG_MMAP_SIZE "1073741824"
+
+// blog_posts holds the narrow rows (id, user, title, created_at, slug)
+// that listings read; each post's content is the row of the same id in
+// blog_post_contents, written in the same transaction.
 int create_blog_table(DBConnection *conn);
 
+// slug ranges updated per transaction by migrate_blog_table
+#define MIGRATION_BATCH_ROWS 5000
+
+// Brings a table created by an older version up to date: adds created_at
+// and slug (backfilling slugs in batches) and the covering index author
+// pages read from, all while an older process may still be serving from
+// the same file. Does nothing to a current table. Call after
+// create_blog_table, before serving. Returns 0 on success, and 1 (with
+// errmsg saying so) while content is still in blog_posts.
+int migrate_blog_table(DBConnection *conn);
+
+// Moves content out of blog_posts into blog_post_contents, rebuilding
+// blog_posts without it (main --migrate). Nothing else may be using the
+// database: the rebuild holds the write lock throughout, and a process
+// from before it can no longer read or publish posts. Does nothing once
+// content has moved. Returns 0 on success.
+int migrate_blog_contents(DBConnection *conn);
+
+// longest slug kept
+#define BLOG_SLUG_LENGTH 64
+
+// "Hello, World!" becomes "hello-world": ASCII letters and digits,
+// lowercased, with each run of anything else turned into one '-'; "post"
+// when nothing is left. Returns the slug's length.
+int blog_slugify(const char *title, int title_len, char *slug, int slug_cap);
+
 int insert_blog_post(DBConnection *conn, BlogPost *post);
 
-int select_blog_post(DBConnection *conn, int post_id, BlogPost *post);
+// The post's strings are allocated from arena. Returns 0 on success, 1 on
+// error or if there is no such post (errmsg is only set for errors).
+int select_blog_post(DBConnection *conn, int post_id, BlogPost *post, Arena *arena);
 
 int get_next_post_id(DBConnection *conn);
 
+// Called for every post, in id order, while the query is still stepping.
+// Returning nonzero stops the iteration.
+typedef int (*BlogPostTitleFunc)(void *ctx, int post_id, const char *title);
+
+// Returns 0 when every row was visited, 1 on a query error or when fn
+// stopped early.
+int for_each_blog_post_title(DBConnection *conn, BlogPostTitleFunc fn, void *ctx);
+// The same for the first limit posts with ids above after_id; a negative
+// limit means all of them.
+int for_each_blog_post_title_after(DBConnection *conn, int after_id, int limit,
+                                   BlogPostTitleFunc fn, void *ctx);
+
+// Called for every whole post, in id order. The strings are only valid
+// during the call.
+typedef int (*BlogPostFunc)(void *ctx, const BlogPost *post);
+
+// Returns 0 when every post was visited, 1 on a query error or when fn
+// stopped early.
+int for_each_blog_post(DBConnection *conn, BlogPostFunc fn, void *ctx);
+
+// One page of an author's posts, newest first: up to limit of them with
+// ids below before_id. Keyset paginated, so a late page costs what the
+// first does. Calls are serialized; fn must not block.
+int for_each_user_post_title(DBConnection *conn, const char *user, int before_id,
+                             int limit, BlogPostTitleFunc fn, void *ctx);
+
+// The newest limit posts, newest first, without their content (NULL).
+int for_each_recent_blog_post(DBConnection *conn, int limit, BlogPostFunc fn,
+                              void *ctx);
+
+// Fills ids with up to max_ids post ids, newest first. Returns how many,
+// or -1 on error.
+int select_recent_post_ids(DBConnection *conn, int *ids, int max_ids);
+
 void parse_blog_post(const char *query_string, char *user, char *title, char *content);
+
+// Readers on the shared connection keep going while an upload's write
+// transaction is open.
+int use_write_ahead_log(DBConnection *conn);
+
+// longest user or title kept from an upload; the rest is dropped
+#define BLOG_FIELD_LENGTH 1024
+// how long an upload waits for another writer's lock
+#define UPLOAD_BUSY_TIMEOUT_MS 5000
+
+// Streaming counterpart of parse_blog_post + insert_blog_post for publish
+// bodies of any size. The form is parsed as it arrives and the content is
+// spooled to a temporary file, so only this struct is held in memory and
+// no lock is held while the client sends. blog_post_upload_finish then
+// writes the rows in one short transaction on a connection of its own,
+// copying the content in with incremental BLOB I/O.
+typedef struct BlogPostUpload {
+    DBConnection conn;
+    int in_transaction;
+    sqlite3_int64 post_id;
+
+    long body_remaining; // bytes not fed yet
+    int failed;
+
+    int field; // which form field the parser is in
+    char key[16];
+    int key_len;
+    char user[BLOG_FIELD_LENGTH];
+    int user_len;
+    char title[BLOG_FIELD_LENGTH];
+    int title_len;
+
+    FILE *spool; // the content so far, NULL until a content field starts
+    long content_len;
+} BlogPostUpload;
+
+// body_length is the request's Content-Length. Opens a second connection
+// to the same database as conn. Returns 0 on success; either way the
+// upload must end with blog_post_upload_finish or blog_post_upload_abort.
+int blog_post_upload_begin(BlogPostUpload *upload, DBConnection *conn, long body_length);
+// data may split fields anywhere. After a failure the rest of the body is
+// still accepted (and dropped). Returns 0 on success.
+int blog_post_upload_feed(BlogPostUpload *upload, const char *data, int len);
+// Inserts the post and closes the connection; upload->post_id is its id.
+// Returns 0 on success; otherwise the upload is aborted and
+// upload->conn.errmsg may say why.
+int blog_post_upload_finish(BlogPostUpload *upload);
+void blog_post_upload_abort(BlogPostUpload *upload);
+
+// rows per transaction during a bulk import
+#define IMPORT_BATCH_ROWS 10000
+
+// Bulk insertion for imports: prepared INSERTs reused for every post, on
+// a connection of its own, committed every IMPORT_BATCH_ROWS rows (or
+// sooner, by blog_post_import_commit) so that other writers get a turn.
+// Batches already committed stay if the import fails or is aborted later
+// on.
+typedef struct BlogPostImport {
+    DBConnection conn;
+    sqlite3_stmt *insert;
+    sqlite3_stmt *insert_content;
+    int in_transaction;
+    int batch_rows; // inserted but not committed yet
+    long committed_rows;
+} BlogPostImport;
+
+// Returns 0 on success; on failure conn.errmsg may say why and the import
+// must still be ended with blog_post_import_abort.
+int blog_post_import_begin(BlogPostImport *import, DBConnection *conn);
+// The strings need not be NUL terminated. Returns 0 on success.
+int blog_post_import_add(BlogPostImport *import,
+                         const char *user, int user_len,
+                         const char *title, int title_len,
+                         const char *content, int content_len);
+// Commits the rows added so far, for when no more are coming for a
+// while: the batch's write lock is not held across the wait. Returns 0 on
+// success.
+int blog_post_import_commit(BlogPostImport *import);
+// Commits the last batch and closes the connection. Returns 0 on success.
+int blog_post_import_finish(BlogPostImport *import);
+void blog_post_import_abort(BlogPostImport *import);
+
+// pages copied per step of an online backup, and the pause between steps
+#define BACKUP_PAGES_PER_STEP 64
+#define BACKUP_STEP_PAUSE_MS 2
+
+// Copies the live database to dest_path with the SQLite backup API, a few
+// pages at a time, from one snapshot taken on a connection of its own.
+// Nobody waits for it; dest_path appears only once the copy is complete.
+// Returns 0 on success, setting *pages_copied.
+int backup_blog_db(DBConnection *conn, const char *dest_path, int *pages_copied);
 #endif
 
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "body_cache.h"
+
+// windowBits + 16 asks zlib for a gzip wrapper instead of zlib's own
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 9
+
+void body_cache_init(BodyCache *cache, int slot_count) {
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->slots = calloc(slot_count, sizeof(CachedBody *));
+  cache->slot_count = slot_count;
+}
+
+// FNV-1a
+static unsigned int hash_key(const char *key) {
+  unsigned int hash = 2166136261u;
+  for (; *key; key++) {
+    hash ^= (unsigned char)*key;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+int gzip_compress(const char *body, int body_len, char **out) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS,
+                   GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+    return 0;
+
+  // anything at least as large as the input is useless to us
+  int out_cap = body_len;
+  *out = malloc(out_cap > 0 ? out_cap : 1);
+
+  stream.next_in = (Bytef *)body;
+  stream.avail_in = body_len;
+  stream.next_out = (Bytef *)*out;
+  stream.avail_out = out_cap;
+
+  int rc = deflate(&stream, Z_FINISH);
+  int out_len = stream.total_out;
+  deflateEnd(&stream);
+
+  if (rc != Z_STREAM_END) {
+    free(*out);
+    *out = NULL;
+    return 0;
+  }
+  return out_len;
+}
+
+CachedBody *body_cache_get(BodyCache *cache, const char *key,
+                           const char *etag) {
+  CachedBody *found = NULL;
+  int slot = hash_key(key) % cache->slot_count;
+
+  pthread_mutex_lock(&cache->lock);
+  CachedBody *entry = cache->slots[slot];
+  if (entry && !strcmp(entry->key, key) && !strcmp(entry->etag, etag)) {
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+    found = entry;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  return found;
+}
+
+CachedBody *body_cache_put(BodyCache *cache, const char *key, const char *etag,
+                           char *body, int body_len) {
+  CachedBody *entry = malloc(sizeof(CachedBody));
+  entry->refs = 2; // the cache's and the caller's
+  entry->key = strdup(key);
+  entry->etag = strdup(etag);
+  entry->body = body;
+  entry->body_len = body_len;
+  entry->gzip_len = gzip_compress(body, body_len, &entry->gzip_body);
+
+  int slot = hash_key(key) % cache->slot_count;
+
+  pthread_mutex_lock(&cache->lock);
+  CachedBody *evicted = cache->slots[slot];
+  cache->slots[slot] = entry;
+  pthread_mutex_unlock(&cache->lock);
+
+  if (evicted)
+    cached_body_release(evicted);
+
+  return entry;
+}
+
+void cached_body_release(CachedBody *entry) {
+  if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  free(entry->key);
+  free(entry->etag);
+  free(entry->body);
+  free(entry->gzip_body);
+  free(entry);
+}
+
+void body_cache_for_each_key(BodyCache *cache,
+                             void (*fn)(void *ctx, const char *key),
+                             void *ctx) {
+  pthread_mutex_lock(&cache->lock);
+  for (int slot = 0; slot < cache->slot_count; slot++) {
+    if (cache->slots[slot])
+      fn(ctx, cache->slots[slot]->key);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
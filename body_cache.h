@@ -0,0 +1,53 @@
+#ifndef BODY_CACHE_H
+#define BODY_CACHE_H
+
+#include <pthread.h>
+
+// A small, thread-safe cache of rendered response bodies. Each entry
+// keeps the identity bytes and, when it is smaller, a gzip copy made once
+// on insertion, so requests never compress anything themselves.
+//
+// The table is direct-mapped: a key hashes to one slot and a new entry
+// simply replaces whatever was there. Entries are reference counted, so
+// one can be evicted while another thread is still sending it.
+
+typedef struct {
+  int refs;
+  char *key;
+  char *etag; // the version this body belongs to
+  char *body;
+  int body_len;
+  char *gzip_body; // NULL when gzip would not be smaller
+  int gzip_len;
+} CachedBody;
+
+typedef struct {
+  pthread_mutex_t lock;
+  CachedBody **slots;
+  int slot_count;
+} BodyCache;
+
+void body_cache_init(BodyCache *cache, int slot_count);
+
+// Returns a referenced entry for key at version etag, or NULL.
+CachedBody *body_cache_get(BodyCache *cache, const char *key,
+                           const char *etag);
+
+// Takes ownership of body (malloc'd), compresses it, and stores it.
+// Returns a referenced entry.
+CachedBody *body_cache_put(BodyCache *cache, const char *key, const char *etag,
+                           char *body, int body_len);
+
+void cached_body_release(CachedBody *entry);
+
+// What the cache stores as gzip_body: a malloc'd gzip copy in *out.
+// Returns its length, or 0 (and no copy) if gzip does not make body
+// smaller.
+int gzip_compress(const char *body, int body_len, char **out);
+
+// Calls fn with the key of every entry, holding the cache's lock.
+void body_cache_for_each_key(BodyCache *cache,
+                             void (*fn)(void *ctx, const char *key),
+                             void *ctx);
+
+#endif
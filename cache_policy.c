@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cache_policy.h"
+
+// Per-file lifetimes for static files; anything else gets
+// STATIC_DEFAULT_MAX_AGE. A max_age of 0 makes caches revalidate on
+// every use.
+static const struct {
+  const char *file_path;
+  int max_age;
+} static_lifetimes[] = {
+    {"index.html", 5 * 60},
+    {"publish.html", 24 * 60 * 60},
+};
+
+static int static_max_age(const char *file_path) {
+  for (size_t i = 0; i < sizeof(static_lifetimes) / sizeof(static_lifetimes[0]);
+       i++) {
+    if (!strcmp(static_lifetimes[i].file_path, file_path))
+      return static_lifetimes[i].max_age;
+  }
+  return STATIC_DEFAULT_MAX_AGE;
+}
+
+void cache_control_header(CachePolicy policy, const char *file_path,
+                          char *header, int header_len) {
+  switch (policy) {
+  case CACHE_POLICY_POST:
+    snprintf(header, header_len,
+             "Cache-Control: public, max-age=%d, immutable\n", POST_MAX_AGE);
+    break;
+
+  case CACHE_POLICY_INDEX:
+    snprintf(header, header_len,
+             "Cache-Control: public, max-age=%d, stale-while-revalidate=%d\n",
+             INDEX_MAX_AGE, INDEX_STALE_WHILE_REVALIDATE);
+    break;
+
+  case CACHE_POLICY_STATIC: {
+    int max_age = static_max_age(file_path);
+    if (max_age > 0)
+      snprintf(header, header_len, "Cache-Control: public, max-age=%d\n",
+               max_age);
+    else
+      snprintf(header, header_len, "Cache-Control: no-cache\n");
+    break;
+  }
+
+  case CACHE_POLICY_NO_STORE:
+  default:
+    snprintf(header, header_len, "Cache-Control: no-store\n");
+    break;
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+// Cache-Control policy per route, so that a CDN or reverse proxy in front
+// of us can answer repeat reads itself.
+//
+// Lifetimes are in seconds.
+
+// a post never changes once published
+#define POST_MAX_AGE (365 * 24 * 60 * 60)
+
+// the index changes on every publish; caches may serve a slightly stale
+// copy while they revalidate it with the ETag
+#define INDEX_MAX_AGE 10
+#define INDEX_STALE_WHILE_REVALIDATE 60
+
+// static files not listed in cache_policy.c's static_lifetimes table
+#define STATIC_DEFAULT_MAX_AGE (60 * 60)
+
+typedef enum {
+  CACHE_POLICY_NO_STORE, // errors and other one-off responses
+  CACHE_POLICY_POST,
+  CACHE_POLICY_INDEX,
+  CACHE_POLICY_STATIC,
+} CachePolicy;
+
+// Writes the "Cache-Control: ...\n" line for a response on this route.
+// file_path is only consulted for CACHE_POLICY_STATIC.
+void cache_control_header(CachePolicy policy, const char *file_path,
+                          char *header, int header_len);
+
+#endif
@@ -0,0 +1,250 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Client.h"
+#include "feed.h"
+
+extern int debug;
+
+typedef struct {
+  int post_id;
+  time_t updated;
+  char *xml; // the rendered <entry>
+  int xml_len;
+} FeedEntry;
+
+// everything below is guarded by feed_lock
+static pthread_mutex_t feed_lock = PTHREAD_MUTEX_INITIALIZER;
+static FeedEntry entries[FEED_ENTRIES]; // newest first
+static int entry_count;
+static int feed_loaded;
+static time_t feed_updated;
+static char feed_etag[64];
+// one slot, "feed"; gives the feed a gzip copy and reference counting
+static BodyCache feed_cache;
+// set once by feed_load_settings, without a trailing slash
+static char base_url[FEED_MAX_BASE_URL_LENGTH];
+
+int feed_load_settings(void) {
+  const char *url = getenv("BLOG_BASE_URL");
+  if (!url)
+    url = FEED_BASE_URL;
+  int len = strlen(url);
+  while (len > 0 && url[len - 1] == '/')
+    len--;
+  // it goes into attributes as it is
+  int plain = strcspn(url, "\" <>") == strlen(url);
+  for (int i = 0; i < len; i++)
+    plain = plain && (unsigned char)url[i] > 0x20;
+  if ((strncmp(url, "http://", 7) && strncmp(url, "https://", 8)) ||
+      len < 9 || len >= FEED_MAX_BASE_URL_LENGTH || !plain) {
+    fprintf(stderr, "BLOG_BASE_URL must be the blog's public http(s) "
+            "origin, e.g. https://blog.example.com, not \"%s\"\n", url);
+    return FAIL;
+  }
+  memcpy(base_url, url, len);
+  base_url[len] = '\0';
+  return SUCCESS;
+}
+
+void feed_init(void) {
+  body_cache_init(&feed_cache, 1);
+}
+
+typedef struct {
+  char *data;
+  int len;
+  int cap;
+} XmlBuffer;
+
+static void xml_append(XmlBuffer *buf, const char *data, int len) {
+  if (buf->len + len > buf->cap) {
+    buf->cap = buf->cap ? buf->cap : 512;
+    while (buf->len + len > buf->cap)
+      buf->cap *= 2;
+    buf->data = realloc(buf->data, buf->cap);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void xml_append_string(XmlBuffer *buf, const char *s) {
+  xml_append(buf, s, strlen(s));
+}
+
+// Character data, escaped run by run; control characters XML cannot carry
+// are dropped.
+static void xml_append_text(XmlBuffer *buf, const char *s, int len) {
+  const char *run = s;
+  for (const char *p = s; p < s + len; p++) {
+    unsigned char c = *p;
+    const char *escape = c == '&'   ? "&amp;"
+                         : c == '<' ? "&lt;"
+                         : c == '>' ? "&gt;"
+                         : c < 0x20 && c != '\t' && c != '\n' && c != '\r'
+                             ? ""
+                             : NULL;
+    if (!escape)
+      continue;
+    xml_append(buf, run, p - run);
+    xml_append_string(buf, escape);
+    run = p + 1;
+  }
+  xml_append(buf, run, s + len - run);
+}
+
+static void xml_append_time(XmlBuffer *buf, time_t when) {
+  struct tm tm;
+  char stamp[32];
+  gmtime_r(&when, &tm);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  xml_append_string(buf, stamp);
+}
+
+static void render_entry(FeedEntry *entry, int post_id, const char *user,
+                         int user_len, const char *title, int title_len,
+                         time_t updated) {
+  XmlBuffer buf = {NULL, 0, 0};
+  char url[FEED_MAX_BASE_URL_LENGTH + 32];
+  snprintf(url, sizeof(url), "%s/post/%d", base_url, post_id);
+
+  xml_append_string(&buf, "<entry>\n<title>");
+  xml_append_text(&buf, title, title_len);
+  xml_append_string(&buf, "</title>\n<link href=\"");
+  xml_append_text(&buf, url, strlen(url));
+  xml_append_string(&buf, "\"/>\n<id>");
+  xml_append_text(&buf, url, strlen(url));
+  xml_append_string(&buf, "</id>\n<updated>");
+  xml_append_time(&buf, updated);
+  xml_append_string(&buf, "</updated>\n");
+  if (user_len > 0) {
+    xml_append_string(&buf, "<author><name>");
+    xml_append_text(&buf, user, user_len);
+    xml_append_string(&buf, "</name></author>\n");
+  }
+  xml_append_string(&buf, "</entry>\n");
+
+  entry->post_id = post_id;
+  entry->updated = updated;
+  entry->xml = buf.data;
+  entry->xml_len = buf.len;
+}
+
+static void clear_entries(void) {
+  for (int i = 0; i < entry_count; i++)
+    free(entries[i].xml);
+  entry_count = 0;
+}
+
+// Concatenates the head and the rendered entries into a new cached body.
+// Entries are not rendered again; this is a few KB of copying.
+static void assemble_feed(void) {
+  for (int i = 0; i < entry_count; i++) {
+    if (i == 0 || entries[i].updated > feed_updated)
+      feed_updated = entries[i].updated;
+  }
+
+  int base_len = strlen(base_url);
+  XmlBuffer buf = {NULL, 0, 0};
+  xml_append_string(&buf,
+                    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                    "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
+                    "<title>" FEED_TITLE "</title>\n"
+                    "<link href=\"");
+  xml_append_text(&buf, base_url, base_len);
+  xml_append_string(&buf, "/feed.xml\" rel=\"self\"/>\n<link href=\"");
+  xml_append_text(&buf, base_url, base_len);
+  xml_append_string(&buf, "/posts\"/>\n<id>");
+  xml_append_text(&buf, base_url, base_len);
+  xml_append_string(&buf, "/feed.xml</id>\n"
+                          "<author><name>" FEED_TITLE "</name></author>\n"
+                          "<updated>");
+  xml_append_time(&buf, feed_updated);
+  xml_append_string(&buf, "</updated>\n");
+  for (int i = 0; i < entry_count; i++)
+    xml_append(&buf, entries[i].xml, entries[i].xml_len);
+  xml_append_string(&buf, "</feed>\n");
+
+  // derived from the bytes, so a restart that renders the same feed keeps
+  // readers' copies valid
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < buf.len; i++)
+    hash = (hash ^ (unsigned char)buf.data[i]) * 16777619u;
+  snprintf(feed_etag, sizeof(feed_etag), "\"feed-%08x\"", hash);
+  cached_body_release(
+      body_cache_put(&feed_cache, "feed", feed_etag, buf.data, buf.len));
+}
+
+static int load_entry(void *ctx, const BlogPost *post) {
+  time_t *now = ctx;
+  // posts from before created_at was kept count as new
+  render_entry(&entries[entry_count++], post->post_id, post->user,
+               strlen(post->user), post->title, strlen(post->title),
+               post->created_at ? post->created_at : *now);
+  return 0;
+}
+
+// with feed_lock held
+static int load_feed(DBConnection *conn) {
+  clear_entries();
+  time_t now = time(NULL);
+  feed_updated = now; // stays when there are no posts
+  if (for_each_recent_blog_post(conn, FEED_ENTRIES, load_entry, &now) != 0) {
+    if (debug) fprintf(stderr, "Error loading feed: %s\n", conn->errmsg);
+    clear_entries();
+    feed_loaded = 0;
+    return FAIL;
+  }
+  assemble_feed();
+  feed_loaded = 1;
+  return SUCCESS;
+}
+
+int feed_reload(DBConnection *conn) {
+  pthread_mutex_lock(&feed_lock);
+  int result = load_feed(conn);
+  pthread_mutex_unlock(&feed_lock);
+  return result;
+}
+
+CachedBody *feed_get(DBConnection *conn, time_t *last_modified) {
+  pthread_mutex_lock(&feed_lock);
+  CachedBody *entry = NULL;
+  if (feed_loaded || load_feed(conn) == SUCCESS) {
+    entry = body_cache_get(&feed_cache, "feed", feed_etag);
+    *last_modified = feed_updated;
+  }
+  pthread_mutex_unlock(&feed_lock);
+  return entry;
+}
+
+void feed_add_post(int post_id, const char *user, int user_len,
+                   const char *title, int title_len) {
+  pthread_mutex_lock(&feed_lock);
+  if (!feed_loaded) {
+    // the first feed_get reads it from the table, this post included
+    pthread_mutex_unlock(&feed_lock);
+    return;
+  }
+
+  // concurrent publishes may commit out of id order
+  int at = 0;
+  while (at < entry_count && entries[at].post_id > post_id)
+    at++;
+  if (at == FEED_ENTRIES) {
+    pthread_mutex_unlock(&feed_lock);
+    return; // older than everything listed
+  }
+
+  if (entry_count == FEED_ENTRIES)
+    free(entries[--entry_count].xml);
+  memmove(&entries[at + 1], &entries[at],
+          (entry_count - at) * sizeof(FeedEntry));
+  entry_count++;
+  render_entry(&entries[at], post_id, user, user_len, title, title_len,
+               time(NULL));
+  assemble_feed();
+  pthread_mutex_unlock(&feed_lock);
+}
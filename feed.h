@@ -0,0 +1,43 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include <time.h>
+
+#include "blog.h"
+#include "body_cache.h"
+
+// The Atom feed at /feed.xml: the newest FEED_ENTRIES posts, kept rendered
+// (with its gzip copy) so that polls are answered from memory. It is read
+// from the table once; after that a publish puts its own entry on top and
+// drops the oldest, and only a bulk change (an import) reads it again.
+
+#define FEED_ENTRIES 20
+#define FEED_TITLE "Blog"
+// Feed and entry ids and links must be absolute, so they start with the
+// blog's public origin, e.g. "https://blog.example.com". The environment
+// variable BLOG_BASE_URL takes precedence; the server does not start
+// without one or the other.
+#ifndef FEED_BASE_URL
+#define FEED_BASE_URL ""
+#endif
+#define FEED_MAX_BASE_URL_LENGTH 256
+
+// Reads the base URL. Returns FAIL, having said why, unless it is an
+// http or https URL.
+int feed_load_settings(void);
+void feed_init(void);
+
+// The current feed, referenced (see cached_body_release), and when it last
+// changed. Reads the table on first use. NULL if that read failed.
+CachedBody *feed_get(DBConnection *conn, time_t *last_modified);
+
+// A post was published; no query is made. A no-op until the feed has
+// been read.
+void feed_add_post(int post_id, const char *user, int user_len,
+                   const char *title, int title_len);
+
+// Reads the newest posts again, after changes too many for feed_add_post.
+// Returns FAIL or SUCCESS.
+int feed_reload(DBConnection *conn);
+
+#endif
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handoff.h"
+#include "server.h"
+
+typedef struct {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int control_fd;
+  int listening_fd;
+  ino_t inode; // of the socket file we bound, to tell it from a successor's
+  void (*before_handoff)(void);
+  void (*on_handoff)(void);
+} HandoffListener;
+
+static HandoffListener handoff;
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    return FAIL;
+  strcpy(addr->sun_path, path);
+  return SUCCESS;
+}
+
+int handoff_receive(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) == FAIL)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd); // no predecessor, or a stale file from one that crashed
+    return -1;
+  }
+
+  char byte;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  int listening_fd = -1;
+  if (recvmsg(fd, &msg, 0) == 1) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&listening_fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  close(fd);
+  return listening_fd;
+}
+
+static int send_fd(int fd, int fd_to_send) {
+  char byte = 'L';
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd_to_send, sizeof(int));
+
+  return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1 ? SUCCESS : FAIL;
+}
+
+static void *handoff_threadfunc(void *unused) {
+  while (1) {
+    int successor = accept(handoff.control_fd, NULL, NULL);
+    if (successor < 0) {
+      perror("handoff accept");
+      return NULL;
+    }
+
+    // the successor is blocked in handoff_receive() until this is done
+    handoff.before_handoff();
+    int result = send_fd(successor, handoff.listening_fd);
+    close(successor);
+    if (result == SUCCESS) {
+      if (debug)
+        fprintf(stderr, "handed listening socket to a new process\n");
+      // the successor owns the path now
+      close(handoff.control_fd);
+      handoff.on_handoff();
+      return NULL;
+    }
+    perror("handoff sendmsg");
+  }
+}
+
+int handoff_start_listener(const char *path, int listening_fd,
+                           void (*before_handoff)(void),
+                           void (*on_handoff)(void)) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) == FAIL)
+    return FAIL;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("handoff socket");
+    return FAIL;
+  }
+
+  // whoever had the path before has handed over to us or is gone
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 1) < 0) {
+    perror("handoff bind");
+    close(fd);
+    return FAIL;
+  }
+
+  struct stat st;
+  stat(path, &st);
+
+  strcpy(handoff.path, path);
+  handoff.control_fd = fd;
+  handoff.listening_fd = listening_fd;
+  handoff.inode = st.st_ino;
+  handoff.before_handoff = before_handoff;
+  handoff.on_handoff = on_handoff;
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, handoff_threadfunc, NULL) != 0) {
+    perror("pthread_create");
+    close(fd);
+    unlink(path);
+    return FAIL;
+  }
+  pthread_detach(thread);
+  return SUCCESS;
+}
+
+void handoff_stop_listener(void) {
+  struct stat st;
+  if (handoff.path[0] && stat(handoff.path, &st) == 0 &&
+      st.st_ino == handoff.inode)
+    unlink(handoff.path);
+}
@@ -0,0 +1,24 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// Zero-downtime restarts. A running server keeps a Unix socket at a known
+// path; a new server that starts while it is up connects there and is
+// passed the listening socket itself (SCM_RIGHTS). Both processes accept
+// from the same socket for a moment, then the old one drains and exits,
+// so no connection is ever refused.
+
+// Connects to a predecessor at path and receives its listening socket.
+// Returns the fd, or -1 if nobody is serving there.
+int handoff_receive(const char *path);
+
+// Serves path from a background thread; when the first successor
+// connects, before_handoff() is called, the successor is sent
+// listening_fd, and on_handoff() is called. Returns FAIL or SUCCESS.
+int handoff_start_listener(const char *path, int listening_fd,
+                           void (*before_handoff)(void),
+                           void (*on_handoff)(void));
+
+// Removes path if it is still ours (a successor rebinds it).
+void handoff_stop_listener(void);
+
+#endif
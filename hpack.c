@@ -0,0 +1,493 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+#define HPACK_STATIC_TABLE_LENGTH 61
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_EOS 256
+
+static const struct {
+  const char *name;
+  const char *value;
+} hpack_static_table[HPACK_STATIC_TABLE_LENGTH] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 Appendix B, indexed by symbol; the last entry is EOS
+static const struct {
+  unsigned int code;
+  int bits;
+} hpack_huffman_codes[HPACK_EOS + 1] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+//// Huffman decode tree, built once from the code table
+
+// children of internal nodes; leaves are stored as -(symbol + 1)
+static short huffman_tree[HPACK_EOS * 2][2];
+static int huffman_tree_nodes = 1;
+static pthread_once_t huffman_tree_once = PTHREAD_ONCE_INIT;
+
+static void build_huffman_tree(void) {
+  for (int symbol = 0; symbol <= HPACK_EOS; symbol++) {
+    int node = 0;
+    int bits = hpack_huffman_codes[symbol].bits;
+    unsigned int code = hpack_huffman_codes[symbol].code;
+
+    for (int i = bits - 1; i > 0; i--) {
+      int bit = (code >> i) & 1;
+      if (huffman_tree[node][bit] == 0)
+        huffman_tree[node][bit] = huffman_tree_nodes++;
+      node = huffman_tree[node][bit];
+    }
+    huffman_tree[node][code & 1] = -(symbol + 1);
+  }
+}
+
+// out must hold at least len * 8 / 5 bytes (the shortest code is 5 bits)
+static int huffman_decode(const unsigned char *in, size_t len, char *out,
+                          size_t *out_len) {
+  pthread_once(&huffman_tree_once, build_huffman_tree);
+
+  int node = 0;
+  int pending_bits = 0; // bits walked since the last emitted symbol
+  int pending_all_ones = 1;
+  size_t written = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    for (int shift = 7; shift >= 0; shift--) {
+      int bit = (in[i] >> shift) & 1;
+      int next = huffman_tree[node][bit];
+
+      pending_bits++;
+      pending_all_ones &= bit;
+
+      if (next < 0) {
+        int symbol = -next - 1;
+        if (symbol == HPACK_EOS)
+          return -1;
+        out[written++] = (char)symbol;
+        node = 0;
+        pending_bits = 0;
+        pending_all_ones = 1;
+      } else if (next == 0) {
+        return -1;
+      } else {
+        node = next;
+      }
+    }
+  }
+
+  // padding must be a prefix of EOS: at most 7 bits, all ones
+  if (pending_bits > 7 || !pending_all_ones)
+    return -1;
+
+  *out_len = written;
+  return 0;
+}
+
+//// primitive types
+
+static int decode_integer(const unsigned char **pos, const unsigned char *end,
+                          int prefix_bits, size_t *value) {
+  if (*pos >= end)
+    return -1;
+
+  size_t max_prefix = (1u << prefix_bits) - 1;
+  *value = **pos & max_prefix;
+  (*pos)++;
+  if (*value < max_prefix)
+    return 0;
+
+  for (int shift = 0; shift <= 28; shift += 7) {
+    if (*pos >= end)
+      return -1;
+    unsigned char byte = **pos;
+    (*pos)++;
+    *value += (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return 0;
+  }
+  return -1;
+}
+
+// Decodes a string literal into a new NUL terminated buffer.
+static int decode_string(const unsigned char **pos, const unsigned char *end,
+                         char **str, size_t *str_len) {
+  if (*pos >= end)
+    return -1;
+
+  int huffman = **pos & 0x80;
+  size_t len;
+  if (decode_integer(pos, end, 7, &len) != 0 || len > (size_t)(end - *pos))
+    return -1;
+
+  if (huffman) {
+    *str = malloc(len * 8 / 5 + 1);
+    if (huffman_decode(*pos, len, *str, str_len) != 0) {
+      free(*str);
+      return -1;
+    }
+  } else {
+    *str = malloc(len + 1);
+    memcpy(*str, *pos, len);
+    *str_len = len;
+  }
+  (*str)[*str_len] = '\0';
+  *pos += len;
+
+  return 0;
+}
+
+static int encode_integer(unsigned char *out, size_t out_cap, int prefix_bits,
+                          unsigned char first_byte_flags, size_t value) {
+  size_t max_prefix = (1u << prefix_bits) - 1;
+  size_t written = 0;
+
+  if (out_cap < 1)
+    return -1;
+  if (value < max_prefix) {
+    out[written++] = first_byte_flags | value;
+    return written;
+  }
+
+  out[written++] = first_byte_flags | max_prefix;
+  value -= max_prefix;
+  while (value >= 0x80) {
+    if (written == out_cap)
+      return -1;
+    out[written++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  if (written == out_cap)
+    return -1;
+  out[written++] = value;
+
+  return written;
+}
+
+static int encode_string(unsigned char *out, size_t out_cap, const char *str,
+                         size_t len) {
+  int written = encode_integer(out, out_cap, 7, 0, len);
+  if (written < 0 || len > out_cap - written)
+    return -1;
+
+  memcpy(out + written, str, len);
+  return written + len;
+}
+
+//// dynamic table
+
+void hpack_table_init(HpackTable *table, size_t max_size) {
+  table->entries = NULL;
+  table->count = 0;
+  table->capacity = 0;
+  table->size = 0;
+  table->max_size = max_size;
+  table->settings_max_size = max_size;
+}
+
+void hpack_table_free(HpackTable *table) {
+  for (int i = 0; i < table->count; i++) {
+    free(table->entries[i].name);
+    free(table->entries[i].value);
+  }
+  free(table->entries);
+  table->entries = NULL;
+  table->count = 0;
+  table->size = 0;
+}
+
+static void evict_to(HpackTable *table, size_t max_size) {
+  while (table->count > 0 && table->size > max_size) {
+    HpackEntry *oldest = &table->entries[table->count - 1];
+    table->size -= oldest->name_len + oldest->value_len + HPACK_ENTRY_OVERHEAD;
+    free(oldest->name);
+    free(oldest->value);
+    table->count--;
+  }
+}
+
+// takes ownership of name and value
+static void table_insert(HpackTable *table, char *name, size_t name_len,
+                         char *value, size_t value_len) {
+  size_t entry_size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+
+  if (entry_size > table->max_size) {
+    // an entry larger than the table just empties it
+    evict_to(table, 0);
+    free(name);
+    free(value);
+    return;
+  }
+  evict_to(table, table->max_size - entry_size);
+
+  if (table->count == table->capacity) {
+    table->capacity = table->capacity ? table->capacity * 2 : 16;
+    table->entries =
+        realloc(table->entries, table->capacity * sizeof(HpackEntry));
+  }
+  memmove(&table->entries[1], &table->entries[0],
+          table->count * sizeof(HpackEntry));
+  table->entries[0] = (HpackEntry){name, value, name_len, value_len};
+  table->count++;
+  table->size += entry_size;
+}
+
+// index is 1-based across the static then the dynamic table
+static int table_lookup(HpackTable *table, size_t index, const char **name,
+                        size_t *name_len, const char **value,
+                        size_t *value_len) {
+  if (index == 0)
+    return -1;
+
+  if (index <= HPACK_STATIC_TABLE_LENGTH) {
+    *name = hpack_static_table[index - 1].name;
+    *name_len = strlen(*name);
+    *value = hpack_static_table[index - 1].value;
+    *value_len = strlen(*value);
+    return 0;
+  }
+
+  index -= HPACK_STATIC_TABLE_LENGTH + 1;
+  if (index >= (size_t)table->count)
+    return -1;
+  *name = table->entries[index].name;
+  *name_len = table->entries[index].name_len;
+  *value = table->entries[index].value;
+  *value_len = table->entries[index].value_len;
+  return 0;
+}
+
+//// header blocks
+
+int hpack_decode(HpackTable *table, const unsigned char *block,
+                 size_t block_len, HpackHeaderFunc on_header, void *ctx) {
+  const unsigned char *pos = block;
+  const unsigned char *end = block + block_len;
+
+  while (pos < end) {
+    unsigned char first = *pos;
+    size_t index;
+
+    if (first & 0x80) {
+      // indexed header field
+      const char *name, *value;
+      size_t name_len, value_len;
+      if (decode_integer(&pos, end, 7, &index) != 0 ||
+          table_lookup(table, index, &name, &name_len, &value, &value_len) != 0)
+        return -1;
+      on_header(ctx, name, name_len, value, value_len);
+      continue;
+    }
+
+    if ((first & 0xe0) == 0x20) {
+      // dynamic table size update
+      if (decode_integer(&pos, end, 5, &index) != 0 ||
+          index > table->settings_max_size)
+        return -1;
+      table->max_size = index;
+      evict_to(table, index);
+      continue;
+    }
+
+    // literal: with incremental indexing (01), without (0000) or never
+    // indexed (0001)
+    int incremental = (first & 0xc0) == 0x40;
+    if (decode_integer(&pos, end, incremental ? 6 : 4, &index) != 0)
+      return -1;
+
+    char *name, *value;
+    size_t name_len, value_len;
+    if (index == 0) {
+      if (decode_string(&pos, end, &name, &name_len) != 0)
+        return -1;
+    } else {
+      const char *indexed_name, *unused_value;
+      size_t unused_len;
+      if (table_lookup(table, index, &indexed_name, &name_len, &unused_value,
+                       &unused_len) != 0)
+        return -1;
+      name = malloc(name_len + 1);
+      memcpy(name, indexed_name, name_len + 1);
+    }
+    if (decode_string(&pos, end, &value, &value_len) != 0) {
+      free(name);
+      return -1;
+    }
+
+    on_header(ctx, name, name_len, value, value_len);
+
+    if (incremental) {
+      table_insert(table, name, name_len, value, value_len);
+    } else {
+      free(name);
+      free(value);
+    }
+  }
+
+  return 0;
+}
+
+int hpack_encode_header(unsigned char *out, size_t out_cap, const char *name,
+                        size_t name_len, const char *value, size_t value_len) {
+  int name_index = 0;
+
+  for (int i = 0; i < HPACK_STATIC_TABLE_LENGTH; i++) {
+    if (strlen(hpack_static_table[i].name) != name_len ||
+        memcmp(hpack_static_table[i].name, name, name_len))
+      continue;
+
+    if (strlen(hpack_static_table[i].value) == value_len &&
+        !memcmp(hpack_static_table[i].value, value, value_len))
+      return encode_integer(out, out_cap, 7, 0x80, i + 1);
+
+    if (!name_index)
+      name_index = i + 1;
+  }
+
+  // literal header field without indexing
+  int written = encode_integer(out, out_cap, 4, 0x00, name_index);
+  if (written < 0)
+    return -1;
+
+  int len;
+  if (!name_index) {
+    len = encode_string(out + written, out_cap - written, name, name_len);
+    if (len < 0)
+      return -1;
+    written += len;
+  }
+
+  len = encode_string(out + written, out_cap - written, value, value_len);
+  if (len < 0)
+    return -1;
+
+  return written + len;
+}
@@ -0,0 +1,47 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+
+// HPACK (RFC 7541) header compression for the HTTP/2 path.
+//
+// Decoding supports the full format: static and dynamic tables, Huffman
+// strings and table size updates. Encoding only emits static-table indexes
+// and literals without indexing, so the peer's decoder state never depends
+// on ours.
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+typedef struct {
+  char *name;
+  char *value;
+  size_t name_len;
+  size_t value_len;
+} HpackEntry;
+
+typedef struct {
+  HpackEntry *entries; // newest first
+  int count;
+  int capacity;
+  size_t size;     // RFC 7541 size: sum of name + value + 32 per entry
+  size_t max_size; // current limit, changed by size updates
+  size_t settings_max_size; // the most a size update may ask for
+} HpackTable;
+
+typedef void (*HpackHeaderFunc)(void *ctx, const char *name, size_t name_len,
+                                const char *value, size_t value_len);
+
+void hpack_table_init(HpackTable *table, size_t max_size);
+void hpack_table_free(HpackTable *table);
+
+// Calls on_header for each header in the block. Returns 0 on success,
+// -1 on a malformed block (a connection error; the table is then unusable).
+int hpack_decode(HpackTable *table, const unsigned char *block,
+                 size_t block_len, HpackHeaderFunc on_header, void *ctx);
+
+// Appends one header to out and returns the bytes written, or -1 if it
+// does not fit in out_cap. The name must already be lowercase.
+int hpack_encode_header(unsigned char *out, size_t out_cap, const char *name,
+                        size_t name_len, const char *value, size_t value_len);
+
+#endif
@@ -0,0 +1,861 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http2.h"
+#include "server.h"
+
+// frame types
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+// frame flags
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+// error codes
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+
+// settings
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_MAX_PEER_FRAME_SIZE 16777215
+
+static uint32_t read_u32(const unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write_u32(unsigned char *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+//// outgoing frames
+
+static int queue_frame(Client *cl, int type, int flags, int stream_id,
+                       const void *payload, int payload_len) {
+  unsigned char frame[H2_FRAME_HEADER_LENGTH + H2_MAX_FRAME_SIZE];
+
+  frame[0] = payload_len >> 16;
+  frame[1] = payload_len >> 8;
+  frame[2] = payload_len;
+  frame[3] = type;
+  frame[4] = flags;
+  write_u32(frame + 5, stream_id);
+  if (payload_len)
+    memcpy(frame + H2_FRAME_HEADER_LENGTH, payload, payload_len);
+
+  return client_queue_buffer(cl, (char *)frame,
+                             H2_FRAME_HEADER_LENGTH + payload_len);
+}
+
+static int queue_goaway(Client *cl, int error_code) {
+  unsigned char payload[8];
+  write_u32(payload, cl->h2->last_stream_id);
+  write_u32(payload + 4, error_code);
+
+  if (debug)
+    fprintf(stderr, "client %d: h2 GOAWAY error %d\n", client_id(cl),
+            error_code);
+
+  queue_frame(cl, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+  return FAIL;
+}
+
+static int queue_rst_stream(Client *cl, int stream_id, int error_code) {
+  unsigned char payload[4];
+  write_u32(payload, error_code);
+  return queue_frame(cl, H2_RST_STREAM, 0, stream_id, payload,
+                     sizeof(payload));
+}
+
+static int queue_window_update(Client *cl, int stream_id, int increment) {
+  unsigned char payload[4];
+  write_u32(payload, increment);
+  return queue_frame(cl, H2_WINDOW_UPDATE, 0, stream_id, payload,
+                     sizeof(payload));
+}
+
+//// streams
+
+static H2Stream *find_stream(H2Connection *conn, int stream_id) {
+  for (int i = 0; i < conn->stream_count; i++) {
+    if (conn->streams[i]->id == stream_id)
+      return conn->streams[i];
+  }
+  return NULL;
+}
+
+// NULL when the peer already has the maximum number of streams open
+static H2Stream *open_stream(H2Connection *conn, int stream_id) {
+  if (conn->stream_count == H2_MAX_CONCURRENT_STREAMS)
+    return NULL;
+
+  H2Stream *stream = calloc(1, sizeof(H2Stream));
+  stream->id = stream_id;
+  stream->send_window = conn->peer_initial_window;
+  conn->streams[conn->stream_count++] = stream;
+
+  return stream;
+}
+
+static void stream_free(H2Stream *stream) {
+  free(stream->method);
+  free(stream->path);
+  free(stream->headers);
+  free(stream->body);
+  free(stream->out);
+  free(stream);
+}
+
+// Frees a request body that has been used or will not be, and hands its
+// bytes back to the connection window.
+static void release_body(Client *cl, H2Stream *stream) {
+  if (stream->body_len > 0) {
+    cl->h2->buffered_body -= stream->body_len;
+    queue_window_update(cl, 0, stream->body_len);
+  }
+  free(stream->body);
+  stream->body = NULL;
+  stream->body_len = 0;
+}
+
+static void close_stream(Client *cl, H2Stream *stream) {
+  H2Connection *conn = cl->h2;
+  release_body(cl, stream);
+  for (int i = 0; i < conn->stream_count; i++) {
+    if (conn->streams[i] == stream) {
+      conn->streams[i] = conn->streams[--conn->stream_count];
+      break;
+    }
+  }
+  stream_free(stream);
+}
+
+// Sends as much pending DATA as the flow control windows allow.
+// Returns 1 once the whole response has been sent.
+static int send_stream_data(Client *cl, H2Stream *stream) {
+  H2Connection *conn = cl->h2;
+
+  while (stream->out_sent < stream->out_len && conn->send_window > 0 &&
+         stream->send_window > 0) {
+    int chunk = stream->out_len - stream->out_sent;
+    if (chunk > H2_MAX_FRAME_SIZE)
+      chunk = H2_MAX_FRAME_SIZE;
+    if (chunk > conn->send_window)
+      chunk = conn->send_window;
+    if (chunk > stream->send_window)
+      chunk = stream->send_window;
+
+    int last = stream->out_sent + chunk == stream->out_len;
+    queue_frame(cl, H2_DATA, last ? H2_FLAG_END_STREAM : 0, stream->id,
+                stream->out + stream->out_sent, chunk);
+
+    stream->out_sent += chunk;
+    conn->send_window -= chunk;
+    stream->send_window -= chunk;
+  }
+
+  return stream->out_sent == stream->out_len;
+}
+
+static void send_pending_data(Client *cl) {
+  H2Connection *conn = cl->h2;
+
+  for (int i = 0; i < conn->stream_count;) {
+    H2Stream *stream = conn->streams[i];
+    if (stream->responded && send_stream_data(cl, stream)) {
+      // swaps the last stream into slot i
+      close_stream(cl, stream);
+    } else {
+      i++;
+    }
+  }
+}
+
+// Runs one request through the HTTP/1.1 handlers with its response
+// redirected to the stream.
+static int run_stream(Client *cl, H2Stream *stream, char *request,
+                      char *requestBody) {
+  H2Connection *conn = cl->h2;
+
+  stream->dispatched = 1;
+  conn->current_stream = stream->id;
+  int result = respond_to_http_request(cl, request, requestBody);
+  conn->current_stream = 0;
+  // the request text is a copy; the body is done with
+  release_body(cl, stream);
+
+  if (result == FAIL || !stream->responded) {
+    // the handler gave up; that only ends this stream, not the connection
+    queue_rst_stream(cl, stream->id, H2_INTERNAL_ERROR);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  if (send_stream_data(cl, stream))
+    close_stream(cl, stream);
+
+  return SUCCESS;
+}
+
+static int dispatch_stream(Client *cl, H2Stream *stream) {
+  if (!stream->method || !stream->path) {
+    queue_rst_stream(cl, stream->id, H2_PROTOCOL_ERROR);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  int head_len = strlen(stream->method) + strlen(stream->path) +
+                 strlen("  HTTP/1.1\r\n") + stream->headers_len +
+                 strlen("\r\n");
+  char *request = arena_alloc(&cl->arena, head_len + stream->body_len + 1);
+
+  int len = sprintf(request, "%s %s HTTP/1.1\r\n", stream->method,
+                    stream->path);
+  if (stream->headers_len) {
+    memcpy(request + len, stream->headers, stream->headers_len);
+    len += stream->headers_len;
+  }
+  len += sprintf(request + len, "\r\n");
+  if (stream->body_len) {
+    memcpy(request + len, stream->body, stream->body_len);
+  }
+  request[len + stream->body_len] = '\0';
+
+  if (debug)
+    fprintf(stderr, "client %d: h2 stream %d: %s %s\n", client_id(cl),
+            stream->id, stream->method, stream->path);
+
+  return run_stream(cl, stream, request, request + len);
+}
+
+//// incoming header blocks
+
+// RFC 9113 8.2.1: nothing that could end a line of the request text we
+// rebuild, and names in lowercase
+static int header_field_valid(const char *name, size_t name_len,
+                              const char *value, size_t value_len) {
+  if (name_len == 0)
+    return 0;
+  for (size_t i = 0; i < name_len; i++) {
+    unsigned char c = name[i];
+    if (c <= ' ' || c == 0x7f || isupper(c) || (c == ':' && i > 0))
+      return 0;
+  }
+  for (size_t i = 0; i < value_len; i++) {
+    if (value[i] == '\r' || value[i] == '\n' || value[i] == '\0')
+      return 0;
+  }
+  return 1;
+}
+
+static void collect_header(void *ctx, const char *name, size_t name_len,
+                           const char *value, size_t value_len) {
+  H2Stream *stream = ctx;
+
+  if (stream->malformed)
+    return;
+  // :method and :path become the request line, so no spaces either
+  if (!header_field_valid(name, name_len, value, value_len) ||
+      ((!strcmp(name, ":method") || !strcmp(name, ":path")) &&
+       memchr(value, ' ', value_len))) {
+    stream->malformed = 1;
+    return;
+  }
+
+  if (name[0] == ':') {
+    if (!strcmp(name, ":method")) {
+      free(stream->method);
+      stream->method = strndup(value, value_len);
+    } else if (!strcmp(name, ":path")) {
+      free(stream->path);
+      stream->path = strndup(value, value_len);
+    } else if (!strcmp(name, ":authority")) {
+      collect_header(ctx, "host", strlen("host"), value, value_len);
+    }
+    return;
+  }
+
+  int line_len = name_len + strlen(": ") + value_len + strlen("\r\n");
+  stream->headers = realloc(stream->headers, stream->headers_len + line_len + 1);
+  sprintf(stream->headers + stream->headers_len, "%.*s: %.*s\r\n",
+          (int)name_len, name, (int)value_len, value);
+  stream->headers_len += line_len;
+}
+
+static void ignore_header(void *ctx, const char *name, size_t name_len,
+                          const char *value, size_t value_len) {}
+
+static int finish_header_block(Client *cl) {
+  H2Connection *conn = cl->h2;
+  int stream_id = conn->header_block_stream;
+  int end_stream = conn->header_block_end_stream;
+
+  H2Stream *stream = find_stream(conn, stream_id);
+  HpackHeaderFunc on_header = ignore_header;
+  int error_code = H2_NO_ERROR;
+
+  if (!stream) {
+    if (stream_id <= conn->last_stream_id) {
+      error_code = H2_STREAM_CLOSED;
+    } else if (conn->goaway_received) {
+      error_code = H2_REFUSED_STREAM;
+    } else {
+      conn->last_stream_id = stream_id;
+      stream = open_stream(conn, stream_id);
+      if (stream)
+        on_header = collect_header;
+      else
+        error_code = H2_REFUSED_STREAM;
+    }
+  }
+  // an existing stream is getting trailers, which the handlers don't use
+
+  // every block must be decoded, even for refused streams, to keep the
+  // HPACK table in step with the peer
+  int decoded = hpack_decode(&conn->decoder, conn->header_block,
+                             conn->header_block_len, on_header, stream);
+  free(conn->header_block);
+  conn->header_block = NULL;
+  conn->header_block_len = 0;
+  conn->header_block_stream = 0;
+
+  if (decoded != 0)
+    return queue_goaway(cl, H2_COMPRESSION_ERROR);
+
+  if (error_code != H2_NO_ERROR)
+    return queue_rst_stream(cl, stream_id, error_code);
+
+  if (on_header == collect_header && stream->malformed) {
+    queue_rst_stream(cl, stream_id, H2_PROTOCOL_ERROR);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  if (end_stream && !stream->dispatched)
+    return dispatch_stream(cl, stream);
+
+  return SUCCESS;
+}
+
+static int append_header_fragment(Client *cl, const unsigned char *fragment,
+                                  int fragment_len, int flags) {
+  H2Connection *conn = cl->h2;
+
+  if (conn->header_block_len + fragment_len > H2_MAX_HEADER_BLOCK)
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  conn->header_block =
+      realloc(conn->header_block, conn->header_block_len + fragment_len + 1);
+  memcpy(conn->header_block + conn->header_block_len, fragment, fragment_len);
+  conn->header_block_len += fragment_len;
+
+  if (flags & H2_FLAG_END_HEADERS)
+    return finish_header_block(cl);
+
+  return SUCCESS;
+}
+
+// Strips the PADDED flag's pad length byte and trailing padding.
+static int strip_padding(const unsigned char **payload, int *payload_len,
+                         int flags) {
+  if (!(flags & H2_FLAG_PADDED))
+    return 0;
+  if (*payload_len < 1)
+    return -1;
+
+  int pad_len = (*payload)[0];
+  (*payload)++;
+  (*payload_len)--;
+  if (pad_len > *payload_len)
+    return -1;
+
+  *payload_len -= pad_len;
+  return 0;
+}
+
+//// frame handlers
+
+static int handle_headers_frame(Client *cl, int flags, int stream_id,
+                                const unsigned char *payload, int payload_len) {
+  H2Connection *conn = cl->h2;
+
+  if (stream_id == 0 || stream_id % 2 == 0 ||
+      strip_padding(&payload, &payload_len, flags) != 0)
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  if (flags & H2_FLAG_PRIORITY) {
+    if (payload_len < 5)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+    payload += 5;
+    payload_len -= 5;
+  }
+
+  conn->header_block_stream = stream_id;
+  conn->header_block_end_stream = flags & H2_FLAG_END_STREAM;
+
+  return append_header_fragment(cl, payload, payload_len, flags);
+}
+
+static int handle_data_frame(Client *cl, int flags, int stream_id,
+                             const unsigned char *payload, int payload_len) {
+  H2Connection *conn = cl->h2;
+  int flow_controlled_len = payload_len;
+
+  if (stream_id == 0)
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  // the connection window is what H2_MAX_BUFFERED_BODY leaves
+  if (conn->buffered_body + flow_controlled_len > H2_MAX_BUFFERED_BODY)
+    return queue_goaway(cl, H2_FLOW_CONTROL_ERROR);
+
+  if (strip_padding(&payload, &payload_len, flags) != 0)
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  H2Stream *stream = find_stream(conn, stream_id);
+  if (!stream || stream->dispatched) {
+    if (flow_controlled_len > 0)
+      queue_window_update(cl, 0, flow_controlled_len);
+    return queue_rst_stream(cl, stream_id, H2_STREAM_CLOSED);
+  }
+
+  // padding is not kept, so its share comes straight back
+  if (flow_controlled_len > payload_len)
+    queue_window_update(cl, 0, flow_controlled_len - payload_len);
+
+  if (stream->body_len + payload_len > MAX_MESSAGE_LENGTH) {
+    if (payload_len > 0)
+      queue_window_update(cl, 0, payload_len);
+    queue_rst_stream(cl, stream_id, H2_REFUSED_STREAM);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  stream->body = realloc(stream->body, stream->body_len + payload_len + 1);
+  memcpy(stream->body + stream->body_len, payload, payload_len);
+  stream->body_len += payload_len;
+  conn->buffered_body += payload_len;
+
+  if (flags & H2_FLAG_END_STREAM)
+    return dispatch_stream(cl, stream);
+
+  // The connection window is used up by bodies that are all still
+  // arriving, so none of them can finish; give this one up.
+  if (conn->buffered_body == H2_MAX_BUFFERED_BODY) {
+    queue_rst_stream(cl, stream_id, H2_REFUSED_STREAM);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  if (flow_controlled_len > 0)
+    queue_window_update(cl, stream_id, flow_controlled_len);
+
+  return SUCCESS;
+}
+
+static int apply_settings(Client *cl, const unsigned char *payload,
+                          int payload_len) {
+  H2Connection *conn = cl->h2;
+
+  if (payload_len % 6 != 0)
+    return queue_goaway(cl, H2_FRAME_SIZE_ERROR);
+
+  for (int i = 0; i < payload_len; i += 6) {
+    int id = (payload[i] << 8) | payload[i + 1];
+    uint32_t value = read_u32(payload + i + 2);
+
+    if (id == H2_SETTINGS_ENABLE_PUSH && value > 1)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+    if (id == H2_SETTINGS_MAX_FRAME_SIZE &&
+        (value < H2_MAX_FRAME_SIZE || value > H2_MAX_PEER_FRAME_SIZE))
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+    if (id == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+      if (value > H2_MAX_WINDOW_SIZE)
+        return queue_goaway(cl, H2_FLOW_CONTROL_ERROR);
+
+      // applies retroactively to every open stream
+      int delta = (int)value - conn->peer_initial_window;
+      for (int s = 0; s < conn->stream_count; s++)
+        conn->streams[s]->send_window += delta;
+      conn->peer_initial_window = value;
+    }
+    // we never push and always send frames of at most 16384 bytes, so
+    // the other settings need nothing from us
+  }
+
+  return SUCCESS;
+}
+
+static int handle_window_update(Client *cl, int stream_id,
+                                const unsigned char *payload,
+                                int payload_len) {
+  H2Connection *conn = cl->h2;
+
+  if (payload_len != 4)
+    return queue_goaway(cl, H2_FRAME_SIZE_ERROR);
+
+  int increment = read_u32(payload) & 0x7fffffff;
+
+  if (stream_id == 0) {
+    if (increment == 0 ||
+        (long)conn->send_window + increment > H2_MAX_WINDOW_SIZE)
+      return queue_goaway(cl, increment ? H2_FLOW_CONTROL_ERROR
+                                        : H2_PROTOCOL_ERROR);
+    conn->send_window += increment;
+    return SUCCESS;
+  }
+
+  H2Stream *stream = find_stream(conn, stream_id);
+  if (!stream)
+    return SUCCESS;
+
+  if (increment == 0 ||
+      (long)stream->send_window + increment > H2_MAX_WINDOW_SIZE) {
+    queue_rst_stream(cl, stream_id,
+                     increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+    close_stream(cl, stream);
+    return SUCCESS;
+  }
+  stream->send_window += increment;
+
+  return SUCCESS;
+}
+
+static int handle_frame(Client *cl, int type, int flags, int stream_id,
+                        const unsigned char *payload, int payload_len) {
+  H2Connection *conn = cl->h2;
+
+  if (debug)
+    fprintf(stderr, "client %d: h2 frame type %d flags 0x%x stream %d len %d\n",
+            client_id(cl), type, flags, stream_id, payload_len);
+
+  // a header block must arrive in one piece, CONTINUATIONs only
+  if (conn->header_block_stream &&
+      (type != H2_CONTINUATION || stream_id != conn->header_block_stream))
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  switch (type) {
+  case H2_DATA:
+    return handle_data_frame(cl, flags, stream_id, payload, payload_len);
+
+  case H2_HEADERS:
+    return handle_headers_frame(cl, flags, stream_id, payload, payload_len);
+
+  case H2_CONTINUATION:
+    if (!conn->header_block_stream)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+    return append_header_fragment(cl, payload, payload_len, flags);
+
+  case H2_PRIORITY:
+    // we answer streams in arrival order; priorities don't apply
+    return SUCCESS;
+
+  case H2_RST_STREAM: {
+    H2Stream *stream = find_stream(conn, stream_id);
+    if (stream)
+      close_stream(cl, stream);
+    return SUCCESS;
+  }
+
+  case H2_SETTINGS:
+    if (stream_id != 0)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_ACK)
+      return SUCCESS;
+    if (apply_settings(cl, payload, payload_len) == FAIL)
+      return FAIL;
+    return queue_frame(cl, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+
+  case H2_PING:
+    if (payload_len != 8)
+      return queue_goaway(cl, H2_FRAME_SIZE_ERROR);
+    if (flags & H2_FLAG_ACK)
+      return SUCCESS;
+    return queue_frame(cl, H2_PING, H2_FLAG_ACK, 0, payload, payload_len);
+
+  case H2_GOAWAY:
+    if (stream_id != 0)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+    if (payload_len < 8)
+      return queue_goaway(cl, H2_FRAME_SIZE_ERROR);
+    // answers still waiting on flow control go out before we close; see
+    // h2_handle_input
+    conn->goaway_received = 1;
+    return SUCCESS;
+
+  case H2_WINDOW_UPDATE:
+    return handle_window_update(cl, stream_id, payload, payload_len);
+
+  case H2_PUSH_PROMISE:
+    // clients may not push
+    return queue_goaway(cl, H2_PROTOCOL_ERROR);
+
+  default:
+    // unknown frame types must be ignored
+    return SUCCESS;
+  }
+}
+
+//// public interface
+
+int h2_preface_match(const char *buffer, int buffer_len) {
+  if (buffer_len == 0)
+    return 0;
+
+  int compare_len =
+      buffer_len < H2_PREFACE_LENGTH ? buffer_len : H2_PREFACE_LENGTH;
+  if (memcmp(buffer, H2_PREFACE, compare_len))
+    return 0;
+
+  return compare_len == H2_PREFACE_LENGTH ? 1 : -1;
+}
+
+void h2_start(Client *cl) {
+  H2Connection *conn = calloc(1, sizeof(H2Connection));
+  conn->awaiting_preface = 1;
+  hpack_table_init(&conn->decoder, HPACK_DEFAULT_TABLE_SIZE);
+  conn->send_window = H2_DEFAULT_WINDOW_SIZE;
+  conn->peer_initial_window = H2_DEFAULT_WINDOW_SIZE;
+  cl->h2 = conn;
+
+  if (debug)
+    fprintf(stderr, "client %d switched to h2c\n", client_id(cl));
+
+  unsigned char settings[6];
+  settings[0] = 0;
+  settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  write_u32(settings + 2, H2_MAX_CONCURRENT_STREAMS);
+  queue_frame(cl, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+  // room for one request body of the largest size; see handle_data_frame
+  queue_window_update(cl, 0, H2_MAX_BUFFERED_BODY - H2_DEFAULT_WINDOW_SIZE);
+}
+
+int h2_is_upgrade_request(const char *request) {
+  char upgrade[MAX_GENERATED_LENGTH];
+
+  if (!http_request_header(request, "Upgrade", upgrade, sizeof(upgrade)) ||
+      !http_request_header(request, "HTTP2-Settings", NULL, 0))
+    return 0;
+
+  // Upgrade is a token list, e.g. "h2c" or "websocket, h2c"
+  char *saveptr;
+  for (char *token = strtok_r(upgrade, ", ", &saveptr); token;
+       token = strtok_r(NULL, ", ", &saveptr)) {
+    if (!strcasecmp(token, "h2c"))
+      return 1;
+  }
+  return 0;
+}
+
+// HTTP2-Settings is base64url without padding
+static int decode_base64url(const char *in, unsigned char *out, int out_cap) {
+  int bits = 0, bit_count = 0, written = 0;
+
+  for (; *in && *in != '='; in++) {
+    int value;
+    if (*in >= 'A' && *in <= 'Z')
+      value = *in - 'A';
+    else if (*in >= 'a' && *in <= 'z')
+      value = *in - 'a' + 26;
+    else if (*in >= '0' && *in <= '9')
+      value = *in - '0' + 52;
+    else if (*in == '-' || *in == '+')
+      value = 62;
+    else if (*in == '_' || *in == '/')
+      value = 63;
+    else
+      return -1;
+
+    bits = (bits << 6) | value;
+    bit_count += 6;
+    if (bit_count >= 8) {
+      if (written == out_cap)
+        return -1;
+      bit_count -= 8;
+      out[written++] = (bits >> bit_count) & 0xff;
+    }
+  }
+  return written;
+}
+
+int h2_upgrade(Client *cl, char *request, char *requestBody) {
+  char encoded_settings[MAX_GENERATED_LENGTH];
+  unsigned char settings[MAX_GENERATED_LENGTH];
+
+  http_request_header(request, "HTTP2-Settings", encoded_settings,
+                      sizeof(encoded_settings));
+  int settings_len =
+      decode_base64url(encoded_settings, settings, sizeof(settings));
+  if (settings_len < 0 || settings_len % 6 != 0) {
+    // not a usable upgrade; answer it as plain HTTP/1.1
+    return respond_to_http_request(cl, request, requestBody);
+  }
+
+  client_queue_string(cl, "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Upgrade: h2c\r\n"
+                          "\r\n");
+  h2_start(cl);
+
+  // the 101 acknowledges these, so no SETTINGS ACK is sent
+  if (apply_settings(cl, settings, settings_len) == FAIL)
+    return FAIL;
+
+  // the upgraded request becomes stream 1, already half-closed
+  cl->h2->last_stream_id = 1;
+  H2Stream *stream = open_stream(cl->h2, 1);
+  return run_stream(cl, stream, request, requestBody);
+}
+
+int h2_handle_input(Client *cl) {
+  H2Connection *conn = cl->h2;
+  int consumed = 0;
+  int result = SUCCESS;
+
+  if (conn->awaiting_preface) {
+    int preface = h2_preface_match(cl->input, cl->input_len);
+    if (preface == 0 && cl->input_len > 0)
+      return queue_goaway(cl, H2_PROTOCOL_ERROR);
+    if (preface != 1)
+      return SUCCESS;
+
+    consumed = H2_PREFACE_LENGTH;
+    conn->awaiting_preface = 0;
+  }
+
+  while (cl->input_len - consumed >= H2_FRAME_HEADER_LENGTH) {
+    const unsigned char *frame = (unsigned char *)cl->input + consumed;
+    int payload_len = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+
+    if (payload_len > H2_MAX_FRAME_SIZE) {
+      result = queue_goaway(cl, H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if (cl->input_len - consumed < H2_FRAME_HEADER_LENGTH + payload_len)
+      break;
+
+    result = handle_frame(cl, frame[3], frame[4],
+                          read_u32(frame + 5) & 0x7fffffff,
+                          frame + H2_FRAME_HEADER_LENGTH, payload_len);
+    consumed += H2_FRAME_HEADER_LENGTH + payload_len;
+    if (result == FAIL)
+      break;
+  }
+  client_consume_input(cl, consumed);
+
+  if (result != FAIL)
+    send_pending_data(cl);
+
+  if (result != FAIL && conn->goaway_received && conn->stream_count == 0)
+    return FAIL;
+  return result;
+}
+
+// connection-specific headers are not allowed in HTTP/2
+static int is_hop_by_hop_header(const char *name) {
+  return !strcmp(name, "connection") || !strcmp(name, "keep-alive") ||
+         !strcmp(name, "transfer-encoding") || !strcmp(name, "upgrade") ||
+         !strcmp(name, "proxy-connection");
+}
+
+int h2_send_response(Client *cl, const char *head, char *body, int body_len) {
+  H2Connection *conn = cl->h2;
+  H2Stream *stream = find_stream(conn, conn->current_stream);
+  if (!stream || stream->responded)
+    return FAIL;
+
+  unsigned char block[H2_MAX_FRAME_SIZE];
+  int block_len = 0;
+
+  // status line: "HTTP/1.1 200 ..."
+  char status[4] = "200";
+  sscanf(head, "HTTP/%*s %3s", status);
+  int len = hpack_encode_header(block, sizeof(block), ":status",
+                                strlen(":status"), status, strlen(status));
+  if (len < 0)
+    return FAIL;
+  block_len += len;
+
+  const char *line = strchr(head, '\n');
+  while (line && line[1] && line[1] != '\n' && line[1] != '\r') {
+    line++;
+    const char *line_end = strchr(line, '\n');
+    const char *colon = memchr(line, ':', line_end ? line_end - line : strlen(line));
+    if (!line_end)
+      line_end = line + strlen(line);
+
+    if (colon && colon - line < MAX_GENERATED_LENGTH) {
+      char name[MAX_GENERATED_LENGTH];
+      int name_len = colon - line;
+      for (int i = 0; i < name_len; i++)
+        name[i] = tolower((unsigned char)line[i]);
+      name[name_len] = '\0';
+
+      const char *value = colon + 1;
+      while (*value == ' ')
+        value++;
+      const char *value_end = line_end;
+      while (value_end > value &&
+             (value_end[-1] == '\r' || value_end[-1] == ' '))
+        value_end--;
+
+      if (!is_hop_by_hop_header(name)) {
+        len = hpack_encode_header(block + block_len, sizeof(block) - block_len,
+                                  name, name_len, value, value_end - value);
+        if (len < 0)
+          return FAIL;
+        block_len += len;
+      }
+    }
+    line = *line_end ? line_end : NULL;
+  }
+
+  stream->responded = 1;
+  if (body_len > 0) {
+    stream->out = malloc(body_len);
+    memcpy(stream->out, body, body_len);
+    stream->out_len = body_len;
+  }
+
+  return queue_frame(cl, H2_HEADERS,
+                     H2_FLAG_END_HEADERS | (body_len ? 0 : H2_FLAG_END_STREAM),
+                     stream->id, block, block_len);
+}
+
+void h2_connection_free(H2Connection *conn) {
+  for (int i = 0; i < conn->stream_count; i++)
+    stream_free(conn->streams[i]);
+  hpack_table_free(&conn->decoder);
+  free(conn->header_block);
+  free(conn);
+}
@@ -0,0 +1,103 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "Client.h"
+#include "hpack.h"
+
+// HTTP/2 over cleartext TCP (h2c), entered either with the connection
+// preface ("prior knowledge") or with an HTTP/1.1 "Upgrade: h2c" request.
+//
+// Each stream is turned back into an HTTP/1.1 style request string and run
+// through respond_to_http_request, so the existing handlers serve both
+// protocols. While a handler runs, send_http_response_binary hands its
+// response to h2_send_response instead of writing HTTP/1.1 bytes.
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LENGTH 24
+#define H2_FRAME_HEADER_LENGTH 9
+#define H2_MAX_FRAME_SIZE 16384
+#define H2_DEFAULT_WINDOW_SIZE 65535
+#define H2_MAX_WINDOW_SIZE 0x7fffffff
+#define H2_MAX_CONCURRENT_STREAMS 100
+#define H2_MAX_HEADER_BLOCK (64 * 1024)
+// Request bodies a connection may hold at once, across its streams. The
+// connection window is what is left of it, and a body's bytes come back
+// to the window only once its handler has run, so a peer cannot make us
+// buffer more than this however many streams it opens.
+#define H2_MAX_BUFFERED_BODY MAX_MESSAGE_LENGTH
+
+typedef struct {
+  int id;
+  int send_window;
+  int dispatched; // the request has gone to the handlers
+  int responded;  // HEADERS sent; out holds the body
+  int malformed;  // a header field we may not pass on (RFC 9113 8.2.1)
+
+  // request, assembled as HTTP/1.1 text: "<method> <path> HTTP/1.1\r\n"
+  // then regular headers, the blank line and the body
+  char *method;
+  char *path;
+  char *headers;
+  int headers_len;
+  char *body;
+  int body_len;
+
+  // response DATA still waiting on flow control
+  char *out;
+  int out_len;
+  int out_sent;
+} H2Stream;
+
+typedef struct H2Connection {
+  int awaiting_preface;
+  HpackTable decoder;
+
+  H2Stream *streams[H2_MAX_CONCURRENT_STREAMS];
+  int stream_count;
+  int last_stream_id;
+
+  int send_window;
+  int peer_initial_window;
+  int buffered_body; // bytes in the streams' request bodies
+
+  // header block being reassembled from HEADERS + CONTINUATION frames
+  unsigned char *header_block;
+  int header_block_len;
+  int header_block_stream;
+  int header_block_end_stream;
+
+  // stream whose handler is running, 0 outside of dispatch
+  int current_stream;
+
+  // the peer sent GOAWAY: no new streams, and the connection closes once
+  // the open ones have been answered
+  int goaway_received;
+} H2Connection;
+
+// Does buffer start with (a prefix of) the connection preface?
+// Returns 1 for the whole preface, -1 for a prefix that needs more bytes,
+// 0 otherwise.
+int h2_preface_match(const char *buffer, int buffer_len);
+
+// Switches the client to HTTP/2 and queues the server SETTINGS. The
+// preface is still expected at the start of the client's input.
+void h2_start(Client *cl);
+
+// Is this HTTP/1.1 request asking to upgrade to h2c?
+int h2_is_upgrade_request(const char *request);
+// Sends 101, switches the client to HTTP/2 and answers the request as
+// stream 1.
+int h2_upgrade(Client *cl, char *request, char *requestBody);
+
+// Consumes every complete frame in cl->input. Returns FAIL when the
+// connection must be closed: after any GOAWAY has been queued, or once the
+// peer's GOAWAY has no more streams to wait for.
+int h2_handle_input(Client *cl);
+
+// head is the HTTP/1.1 status line and headers send_http_response_binary
+// built; it is re-encoded as a HEADERS frame for the current stream.
+int h2_send_response(Client *cl, const char *head, char *body, int body_len);
+
+void h2_connection_free(H2Connection *conn);
+
+#endif
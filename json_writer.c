@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Client.h"
+#include "json_writer.h"
+
+void json_writer_init(JsonWriter *w, JsonSink sink, void *ctx) {
+  w->sink = sink;
+  w->ctx = ctx;
+  w->depth = 0;
+  w->after_key = 0;
+  w->failed = 0;
+}
+
+static void emit(JsonWriter *w, const char *data, int len) {
+  if (!w->failed && len > 0 && w->sink(w->ctx, data, len) == FAIL)
+    w->failed = 1;
+}
+
+// the separator a new member or element needs
+static void begin_value(JsonWriter *w) {
+  if (w->after_key) {
+    w->after_key = 0;
+    return;
+  }
+  if (w->depth > 0) {
+    if (w->has_items[w->depth - 1])
+      emit(w, ",", 1);
+    w->has_items[w->depth - 1] = 1;
+  }
+}
+
+static void open_container(JsonWriter *w, const char *bracket) {
+  begin_value(w);
+  if (w->depth == JSON_MAX_DEPTH) {
+    w->failed = 1;
+    return;
+  }
+  w->has_items[w->depth++] = 0;
+  emit(w, bracket, 1);
+}
+
+static void close_container(JsonWriter *w, const char *bracket) {
+  if (w->depth == 0 || w->after_key) {
+    w->failed = 1;
+    return;
+  }
+  w->depth--;
+  emit(w, bracket, 1);
+}
+
+void json_begin_object(JsonWriter *w) { open_container(w, "{"); }
+void json_end_object(JsonWriter *w) { close_container(w, "}"); }
+void json_begin_array(JsonWriter *w) { open_container(w, "["); }
+void json_end_array(JsonWriter *w) { close_container(w, "]"); }
+
+static void emit_escaped(JsonWriter *w, const char *s, int len) {
+  emit(w, "\"", 1);
+  int run = 0; // start of the bytes that need no escaping
+  for (int i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    emit(w, s + run, i - run);
+    run = i + 1;
+
+    char escape[8];
+    switch (c) {
+    case '"': emit(w, "\\\"", 2); break;
+    case '\\': emit(w, "\\\\", 2); break;
+    case '\n': emit(w, "\\n", 2); break;
+    case '\r': emit(w, "\\r", 2); break;
+    case '\t': emit(w, "\\t", 2); break;
+    default:
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      emit(w, escape, 6);
+    }
+  }
+  emit(w, s + run, len - run);
+  emit(w, "\"", 1);
+}
+
+void json_key(JsonWriter *w, const char *key) {
+  if (w->depth == 0 || w->after_key) {
+    w->failed = 1;
+    return;
+  }
+  begin_value(w);
+  emit_escaped(w, key, strlen(key));
+  emit(w, ":", 1);
+  w->after_key = 1;
+}
+
+void json_string_len(JsonWriter *w, const char *s, int len) {
+  begin_value(w);
+  emit_escaped(w, s, len);
+}
+
+void json_string(JsonWriter *w, const char *s) {
+  json_string_len(w, s, strlen(s));
+}
+
+void json_int(JsonWriter *w, long value) {
+  char digits[24];
+  int len = snprintf(digits, sizeof(digits), "%ld", value);
+  begin_value(w);
+  emit(w, digits, len);
+}
+
+void json_null(JsonWriter *w) {
+  begin_value(w);
+  emit(w, "null", 4);
+}
+
+int json_writer_result(JsonWriter *w) {
+  return w->failed || w->depth != 0 || w->after_key ? FAIL : SUCCESS;
+}
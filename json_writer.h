@@ -0,0 +1,39 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+// A streaming JSON serializer. Every token goes straight to a sink as it
+// is produced (strings are escaped run by run), so a document of any size
+// is written without building it anywhere first. Commas and nesting are
+// tracked here; callers just emit keys and values in order.
+
+#define JSON_MAX_DEPTH 16
+
+// Returns FAIL or SUCCESS (Client.h).
+typedef int (*JsonSink)(void *ctx, const char *data, int len);
+
+typedef struct {
+  JsonSink sink;
+  void *ctx;
+  int depth;
+  unsigned char has_items[JSON_MAX_DEPTH]; // per open container
+  int after_key; // the next value belongs to a key; no comma
+  int failed; // sticky; later calls do nothing
+} JsonWriter;
+
+void json_writer_init(JsonWriter *w, JsonSink sink, void *ctx);
+
+void json_begin_object(JsonWriter *w);
+void json_end_object(JsonWriter *w);
+void json_begin_array(JsonWriter *w);
+void json_end_array(JsonWriter *w);
+void json_key(JsonWriter *w, const char *key);
+
+void json_string(JsonWriter *w, const char *s);
+void json_string_len(JsonWriter *w, const char *s, int len);
+void json_int(JsonWriter *w, long value);
+void json_null(JsonWriter *w);
+
+// FAIL if the sink failed or the nesting went wrong at any point.
+int json_writer_result(JsonWriter *w);
+
+#endif
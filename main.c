@@ -1,500 +1,278 @@
-#include <arpa/inet.h>
-#include <pthread.h>
-#include <stdbool.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
-#include "Client.h"
-#include "blog.h"
-
-int debug = 1;
-DBConnection db;
-
-#define LISTEN_PORT 8888
-#define PENDING_CONNECTIONS_QUEUE_LENGTH 3
-#define MAX_MESSAGE_LENGTH (10 * 1024 * 1024)
-#define MAX_GENERATED_LENGTH 1024
-#define MAX_FILESIZE 30 * 1024 * 1024
-#define DB_NAME "starter.db"
-
-// Thread payload
-typedef struct {
-  Client *client;
-} Thread_data;
-
-// Takes a Thread_data*.
-void *single_client_handler_threadfunc(void *);
-
-// forward decls
-//! All return FAIL (0). Anything else is successey
-int establish_listening_socket(int port_to_listen);
-int handle_new_client_wrapper(Client *cl);
-int handle_new_client_guts(Client *cl);
-int accept_a_client(int listen_socket, Client **new_client_ptr);
-int close_down_listening(int listening_socket);
-int read_http_request(int socket_fd, char **request_ptr);
-int respond_to_http_request(Client *cl, char *request, char *requestBody);
-int send_http_response(Client *cl, char *body);
-int handle_static_request(Client *cl, char *request);
-int handle_publish_request(Client *cl, char *request);
-int handle_post_request(Client *cl, char *request);
-int handle_post_index_request(Client *cl, char *request);
-void generate_blog_index(DBConnection *db);
-// this returns FAIL (system error - close connection), SUCCESS,
-// or NONEXISTENT_FILE
-int read_file_contents(const char *file_path, char **buf, int *file_sz);
 
-int main(int argc, char *argv[]) {
-
-  if (open_db_connection(&db, DB_NAME) != 0) {
-    fprintf(stderr, "Error opening database!\n");
-    exit(EXIT_FAILURE);
-  }
-
-  if (create_blog_table(&db) != 0) {
-    fprintf(stderr, "Error creating table!\n");
-    close_db_connection(&db);
-    exit(EXIT_FAILURE);
-  }
-
-  int port = LISTEN_PORT;
-  if (argc > 1)
-    port = atoi(argv[1]);
-
-  int our_socket_fd = establish_listening_socket(port);
-  if (our_socket_fd == FAIL) {
-    puts("exiting.");
-    exit(1);
-  }
-
-  if (debug)
-    puts("Ready for incoming connections...");
-
-  int keep_going = SUCCESS;
-  while (keep_going != FAIL) {
-    Client *new_client;
-    keep_going = accept_a_client(our_socket_fd, &new_client);
-
-    if (keep_going != FAIL) {
-      keep_going = handle_new_client_wrapper(new_client);
-    }
-  }
-
-  close_down_listening(our_socket_fd);
-
-  return 0;
+#include "admission.h"
+#include "handoff.h"
+#include "placement.h"
+#include "post_export.h"
+#include "post_import.h"
+#include "post_snapshot.h"
+#include "rate_limit.h"
+#include "server.h"
+#include "warmup.h"
+
+static int handed_off;
+
+// the successor warms its caches from what is hot here right now
+static void prepare_handoff(void) {
+  handed_off = 1;
+  if (save_hot_keys() == FAIL)
+    fprintf(stderr, "Error saving hot keys!\n");
 }
 
-// returns FAIL for failure, otherwise the fd to accept on
-int establish_listening_socket(int port_to_listen) {
-  int new_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (new_socket_fd == -1) {
-    perror("Could not create socket");
-    return FAIL;
-  }
-  if (debug)
-    fprintf(stderr, "accept socket fd is %d\n", new_socket_fd);
-
-  // We are going to listen on any address, the specified port
-  struct sockaddr_in our_address;
-  our_address.sin_family = AF_INET;
-  our_address.sin_addr.s_addr = INADDR_ANY;
-  our_address.sin_port = htons(port_to_listen);
-
-  // Bind our socket to the given address
-  if (bind(new_socket_fd, (struct sockaddr *)&our_address,
-           sizeof(our_address)) < 0) {
-    perror("bind failed");
-    close(new_socket_fd);
+// main --import <file>: loads posts exported from elsewhere (see
+// post_import.h) without starting the server. "-" reads stdin.
+static int import_posts(const char *path) {
+  FILE *fp = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+  if (!fp) {
+    perror(path);
     return FAIL;
   }
-  if (debug)
-    fprintf(stderr, "bind done on port %d\n", port_to_listen);
 
-  // establish that we are expecting incoming connections
-  int result = listen(new_socket_fd, PENDING_CONNECTIONS_QUEUE_LENGTH);
-  if (result == -1) {
-    perror("listen failed");
+  PostImport import;
+  if (post_import_begin(&import, &db) == FAIL) {
+    fprintf(stderr, "Error starting import: %s\n",
+            import.rows.conn.errmsg ? import.rows.conn.errmsg : "unknown");
+    free(import.rows.conn.errmsg);
+    if (fp != stdin)
+      fclose(fp);
     return FAIL;
   }
 
-  return new_socket_fd;
-}
-
-int accept_a_client(int listen_socket, Client **new_client_ptr) {
-  struct sockaddr_in client_addr;
-  // we must use a variable because accept() writes to it
-  socklen_t sock_len = sizeof(client_addr);
-
-  if (debug)
-    fprintf(stderr, "accepting a connection on fd %d\n", listen_socket);
+  static char chunk[64 * 1024];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    if (post_import_feed(&import, chunk, n) == FAIL)
+      break;
+  }
+  int read_failed = ferror(fp);
+  if (fp != stdin)
+    fclose(fp);
 
-  int new_socket_fd =
-      accept(listen_socket, (struct sockaddr *)&client_addr, &sock_len);
-  if (new_socket_fd < 0) {
-    perror("accept failed");
+  int result = post_import_finish(&import);
+  double seconds = post_import_seconds(&import);
+  if (result == FAIL) {
+    fprintf(stderr, "Error importing posts: %s (%ld imported before it)\n",
+            import.rows.conn.errmsg ? import.rows.conn.errmsg : "unknown",
+            import.rows.committed_rows);
+    free(import.rows.conn.errmsg);
     return FAIL;
   }
-  if (debug)
-    fprintf(stderr, "Connection accepted. client fd is %d\n", new_socket_fd);
+  if (read_failed)
+    fprintf(stderr, "Error reading %s; imported what came before\n", path);
 
-  Client *cl = client_new(new_socket_fd, &client_addr);
-  *new_client_ptr = cl;
-  return SUCCESS;
+  printf("imported %ld posts (%ld skipped) in %.3fs, %.0f rows/s\n",
+         import.imported, import.skipped, seconds,
+         seconds > 0 ? import.imported / seconds : 0);
+  return read_failed ? FAIL : SUCCESS;
 }
 
-int close_down_listening(int listening_socket) {
-  if (debug)
-    fprintf(stderr, "closing socket fd %d\n", listening_socket);
-
-  close(listening_socket);
-
-  return SUCCESS;
+static int write_to_file(void *ctx, const char *data, int len) {
+  return fwrite(data, 1, len, ctx) == (size_t)len ? SUCCESS : FAIL;
 }
 
-// returns FAIL for error, 1 for success
-//! Currently no "time to quit" handling
-int handle_new_client_wrapper(Client *cl) {
-  pthread_t client_handler_thread;
-
-  // we must allocate this because we (probably) return before thread executes
-  Thread_data *client_info = malloc(sizeof(Thread_data));
-
-  client_info->client = cl;
-
-  int result =
-      pthread_create(&client_handler_thread,
-                     NULL, // Use default thread attributes
-                     single_client_handler_threadfunc, (void *)client_info);
-  if (result < 0) {
-    perror("pthread_create");
+// main --export <file>: every post as NDJSON ("-" writes stdout). Safe
+// while a server is running on the same database.
+static int export_to_file(const char *path) {
+  FILE *fp = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+  if (!fp) {
+    perror(path);
     return FAIL;
   }
 
-  if (debug)
-    fprintf(stderr, "Client handling thread is %lu\n", client_handler_thread);
-
-  return SUCCESS;
-}
-
-// Payload ptr will be freed in this handler
-void *single_client_handler_threadfunc(void *payload_ptr) {
-  Client *client = ((Thread_data *)payload_ptr)->client;
-  free(payload_ptr);
-
-  int client_index = client_id(client);
-  int result = handle_new_client_guts(client);
-
-  if (debug)
-    fprintf(stderr, "handle_new_client_guts (id %d) returned %d\n",
-            client_index, result);
-
-  return NULL;
-}
-
-int handle_new_client_guts(Client *client) {
-  while (1) {
-    char *request;
-    int result = read_http_request(client_socket(client), &request);
-
-    if (result == FAIL) {
-      fprintf(stderr, "client %d read failed - closing, returning",
-              client_id(client));
-      client_free(client);
-      return FAIL;
-    }
-
-    if (strlen(request) == 0) {
-      fprintf(stderr, "client %d closed socket - closing, returning\n",
-              client_id(client));
-      client_free(client);
-      free(request);
-      return SUCCESS;
-    }
-
-    if (debug)
-      fprintf(stderr,
-              "client sent request (%d bytes): \n"
-              "---\n"
-              "%s\n"
-              "---\n",
-              result, request);
-
-    char *requestBody = request;
-    while (requestBody[0] && strncmp(requestBody, "\r\n\r\n", 4)) {
-      requestBody++;
-    }
-    if (requestBody[0])
-      requestBody += strlen("\r\n\r\n");
-
-    if (debug)
-      fprintf(stderr, "Request body is: '%s'\n", requestBody);
-
-    result = respond_to_http_request(client, request, requestBody);
-    free(request);
-    if (result == FAIL) {
-      fprintf(stderr, "client %d response failed - closing, returning",
-              client_id(client));
-      client_free(client);
-      return FAIL;
-    }
+  char *errmsg;
+  long posts = export_posts(&db, write_to_file, fp, &errmsg);
+  int closed = fp == stdout ? fflush(fp) : fclose(fp);
+  if (posts < 0 || closed != 0) {
+    fprintf(stderr, "Error exporting posts: %s\n",
+            errmsg ? errmsg : "could not write");
+    free(errmsg);
+    return FAIL;
   }
+  fprintf(stderr, "exported %ld posts\n", posts);
+  return SUCCESS;
 }
 
-// technically, we're just reading whatever they send us.
-//! Note, this fails for > MAX bytes
-// This is quasi-intentional because using blocking reads
-// and reading in chunks is more complicated than you
-// might think.
-int read_http_request(int socket_fd, char **request_ptr) {
-  *request_ptr = malloc(MAX_MESSAGE_LENGTH + 1);
-
-  int amount_read = read(socket_fd, *request_ptr, MAX_MESSAGE_LENGTH);
-
-  if (amount_read < 0) {
-    perror("read_http_request");
-    free(*request_ptr);
-    *request_ptr = NULL;
+// main --backup <file>: an online copy of the database, as POST
+// /admin/backup makes
+static int backup_to_file(const char *path) {
+  int pages;
+  if (backup_blog_db(&db, path, &pages) != 0) {
+    fprintf(stderr, "Error backing up database: %s\n", db.errmsg);
     return FAIL;
   }
-
-  (*request_ptr)[amount_read] = '\0';
-  *request_ptr = realloc(*request_ptr, amount_read + 1);
-
-  if (amount_read == 0) {
-    // client side closed connection
-    if (debug)
-      fputs("Client closed connection\n", stderr);
-
-    return SUCCESS;
-  }
-
-  if (debug)
-    fprintf(stderr, "Read %d bytes...\n", amount_read);
-
+  fprintf(stderr, "backed up %d pages to %s\n", pages, path);
   return SUCCESS;
 }
 
-int send_http_response_binary(Client *cl, char *body, int body_len) {
-  const char *canned_msg___fmt = "HTTP/1.1 200\n"
-                                 "Content-type: text/html\n"
-                                 "Content-Length: %d\n"
-                                 "Connection: Keep-Alive\n"
-                                 "\n";
-
-  // 10 = space for formatted %d
-  int response_buffer_size = strlen(canned_msg___fmt) + 10;
-  char *response = malloc(response_buffer_size);
-
-  snprintf(response, response_buffer_size, canned_msg___fmt, body_len);
-
-  int result = client_write_string(cl, response);
-  free(response);
-  if (result == FAIL) {
+// main --snapshot <file>: every post's page, archived for the server to
+// map (see post_snapshot.h); it reads SNAPSHOT_PATH. Safe while a server
+// is running, which picks the new file up when it restarts.
+static int snapshot_to_file(const char *path) {
+  char *errmsg;
+  long posts = post_snapshot_write(&db, path, render_post_page, &errmsg);
+  if (posts < 0) {
+    fprintf(stderr, "Error writing snapshot: %s\n",
+            errmsg ? errmsg : "unknown");
+    free(errmsg);
     return FAIL;
   }
-
-  client_write_buffer(cl, body, body_len);
-
-  return result;
+  fprintf(stderr, "archived %ld posts in %s\n", posts, path);
+  return SUCCESS;
 }
 
-int send_http_response(Client *cl, char *body) {
-  return send_http_response_binary(cl, body, strlen(body));
+static int takes_file(const char *flag) {
+  return !strcmp(flag, "--import") || !strcmp(flag, "--export") ||
+         !strcmp(flag, "--backup") || !strcmp(flag, "--snapshot");
 }
 
-int send_error_response(Client *cl) {
-  return send_http_response(cl, "Invalid request.\n"
-                                "\n"
-                                "Not found.\n");
+// main [port], main --migrate, or main --import|--export|--backup|
+// --snapshot <file>; anything else is a mistake, not a port
+static int arguments_valid(int argc, char *argv[]) {
+  if (argc < 2 || argv[1][0] != '-')
+    return argc <= 2;
+  if (!strcmp(argv[1], "--migrate"))
+    return argc == 2;
+  return takes_file(argv[1]) && argc == 3;
 }
 
-int respond_to_http_request(Client *cl, char *request, char *requestBody) {
+int main(int argc, char *argv[]) {
 
-  if (!strncmp(request, "GET /post/", strlen("GET /post/"))) {
-    return handle_post_request(cl, request);
+  if (!arguments_valid(argc, argv)) {
+    fprintf(stderr, "usage: %s [port]\n"
+                    "       %s --migrate\n"
+                    "       %s --import|--export|--backup|--snapshot <file>\n",
+            argv[0], argv[0], argv[0]);
+    exit(EXIT_FAILURE);
   }
 
-  if (!strncmp(request, "GET /posts", strlen("GET /posts"))) {
-    return handle_post_index_request(cl, request);
+  if (open_db_connection(&db, DB_NAME) != 0) {
+    fprintf(stderr, "Error opening database!\n");
+    exit(EXIT_FAILURE);
   }
 
-  if (!strncmp(request, "GET /", strlen("GET /"))) {
-    return handle_static_request(cl, request);
+  if (create_blog_table(&db) != 0) {
+    fprintf(stderr, "Error creating table!\n");
+    close_db_connection(&db);
+    exit(EXIT_FAILURE);
   }
 
-  if (!strncmp(request, "POST /publish", strlen("POST /publish"))) {
-    return handle_publish_request(cl, request);
+  // publishes write on their own connection; keep readers unblocked
+  if (use_write_ahead_log(&db) != 0) {
+    fprintf(stderr, "Error enabling WAL: %s\n", db.errmsg);
   }
 
-  send_error_response(cl);
-  return SUCCESS;
-}
-
-int handle_static_request(Client *cl, char *request) {
-  char file_path[MAX_GENERATED_LENGTH];
-  int result = sscanf(request, "GET /%s ", file_path);
-
-  if (result < 1 || result == EOF) {
-    send_error_response(cl);
-    return SUCCESS;
+  // The one step a predecessor could not serve through, moving content out
+  // of blog_posts, is asked for by name, with the server stopped.
+  if (argc > 1 && !strcmp(argv[1], "--migrate")) {
+    int failed =
+        migrate_blog_contents(&db) != 0 || migrate_blog_table(&db) != 0;
+    if (failed)
+      fprintf(stderr, "Error migrating table: %s\n", db.errmsg);
+    close_db_connection(&db);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
   }
 
-  if (strcmp(file_path, "HTTP/1.1") == 0) {
-    strcpy(file_path, "index");
+  // A predecessor keeps serving (see handoff.h) while this runs.
+  if (migrate_blog_table(&db) != 0) {
+    fprintf(stderr, "Error migrating table: %s\n", db.errmsg);
+    close_db_connection(&db);
+    exit(EXIT_FAILURE);
   }
 
-  char *file_contents = NULL;
-  int file_sz;
-  strcat(file_path, ".html");
-
-
-  result = read_file_contents(file_path, &file_contents, &file_sz);
-
-  if (result == FAIL)
-    return FAIL;
-  if (result == NONEXISTENT_FILE) {
-    return send_http_response(cl, "Nonexistent resource\n");
+  if (argc > 2 && takes_file(argv[1])) {
+    int done = !strcmp(argv[1], "--import")   ? import_posts(argv[2])
+               : !strcmp(argv[1], "--export") ? export_to_file(argv[2])
+               : !strcmp(argv[1], "--backup") ? backup_to_file(argv[2])
+                                              : snapshot_to_file(argv[2]);
+    close_db_connection(&db);
+    exit(done == FAIL ? EXIT_FAILURE : EXIT_SUCCESS);
   }
-  return send_http_response_binary(cl, file_contents, file_sz);
-}
-
-int handle_publish_request(Client *cl, char *request) {
-  char file_path[MAX_GENERATED_LENGTH];
-
-  // parse the request and extract name, title, post
 
-  char *requestBody = request;
-  while (requestBody[0] && strncmp(requestBody, "\r\n\r\n", 4)) {
-    requestBody++;
+  // before any thread starts, and before the caches are sized per node
+  if (placement_init() == FAIL) {
+    fprintf(stderr, "Error setting up CPU placement!\n");
+    exit(EXIT_FAILURE);
   }
-  if (requestBody[0])
-    requestBody += strlen("\r\n\r\n");
-
 
-  char user[MAX_GENERATED_LENGTH];
-  char title[MAX_GENERATED_LENGTH];
-  char content[MAX_GENERATED_LENGTH];
+  if (load_server_settings() == FAIL)
+    exit(EXIT_FAILURE);
 
-  parse_blog_post(requestBody, user, title, content);
+  // posts are append-only, so the next id identifies the current index
+  index_generation = get_next_post_id(&db);
+  init_response_caches();
 
-  BlogPost post;
-  post.user = user;
-  post.title = title;
-  post.content = content;
-  post.post_id = get_next_post_id(&db);
+  // a peer that hangs up mid-response must not kill the server
+  signal(SIGPIPE, SIG_IGN);
 
+  admission_init();
+  rate_limit_init();
 
-  if (insert_blog_post(&db, &post) != 0) {
-    fprintf(stderr, "Error insterting post!\n");
-    close_db_connection(&db);
+  if (start_connection_timers() == FAIL) {
+    fprintf(stderr, "Error starting connection timers!\n");
     exit(EXIT_FAILURE);
   }
 
+  int port = LISTEN_PORT;
+  if (argc > 1)
+    port = atoi(argv[1]);
 
-  // BlogPost select_post;
-  // if (select_blog_post(&db, post->post_id, &select_post) != 0) {
-  //   fprintf(stderr, "Error selecting post");
-  //   close_db_connection(&db);
-  //   exit(EXIT_FAILURE);
-  // }
-
-  return send_http_response(cl, "<html><h1>Blog Posted!</h1>\n\n<a href=\"index\">Click to go back</a></html>\n");
-}
- 
-
+  // a server already running here hands us its socket, so there is never
+  // a moment with nobody listening
+  int our_socket_fd = handoff_receive(HANDOFF_SOCKET_PATH);
+  if (our_socket_fd >= 0) {
+    if (debug)
+      fprintf(stderr, "took over listening socket (fd %d)\n", our_socket_fd);
+  } else {
+    our_socket_fd = establish_listening_socket(port);
+  }
+  if (our_socket_fd == FAIL) {
+    puts("exiting.");
+    exit(1);
+  }
 
-int handle_post_request(Client *cl, char *request) {
-  char post_id_str[MAX_GENERATED_LENGTH];
-  int result = sscanf(request, "GET /post/%s ", post_id_str);
+  if (install_drain_handler() == FAIL ||
+      handoff_start_listener(HANDOFF_SOCKET_PATH, our_socket_fd,
+                             prepare_handoff, request_drain) == FAIL) {
+    fprintf(stderr, "Error setting up shutdown handling!\n");
+    exit(EXIT_FAILURE);
+  }
 
-  if (result < 1 || result == EOF) {
-        send_error_response(cl);
-        return SUCCESS;
-    }
+  // serving does not wait for this
+  if (start_cache_warmup() == FAIL) {
+    fprintf(stderr, "Error starting cache warm-up!\n");
+  }
 
-    int post_id = atoi(post_id_str);
+  if (debug)
+    puts("Ready for incoming connections...");
 
-    BlogPost post;
-    result = select_blog_post(&db, post_id, &post);
+  int keep_going = SUCCESS;
+  while (keep_going != FAIL) {
+    Client *new_client;
+    keep_going = accept_a_client(our_socket_fd, &new_client);
 
-    if (result == 1) {
-        send_http_response(cl, "Could not select post\n");
-        return SUCCESS;
+    // no client when the connection was shed or accept() should be retried
+    if (keep_going != FAIL && new_client) {
+      keep_going = handle_new_client_wrapper(new_client);
     }
-
-    char html[MAX_GENERATED_LENGTH];
-    sprintf(html, "<html><head><title>%s</title></head><body><h1>%s</h1><h3>%s</h3><p>%s</p><a href=\"/index\">back</a></body></html>", post.title, post.title, post.user, post.content);
-
-    return send_http_response_binary(cl, html, strlen(html));
-
-}
-
-int handle_post_index_request(Client *cl, char *request) {
-  generate_blog_index(&db);
-  return handle_static_request(cl, request);
-}
-
-
-int file_size(FILE *fp) {
-  // https://stackoverflow.com/questions/238603/how-can-i-get-a-files-size-in-c
-
-  int current_position = ftell(fp);
-
-  fseek(fp, 0L, SEEK_END);
-
-  int file_sz = ftell(fp);
-
-  fseek(fp, current_position, SEEK_SET);
-
-  return file_sz;
-}
-
-int read_file_contents(const char *file_path, char **buf, int *file_sz) {
-  FILE *fp = fopen(file_path, "r");
-
-  if (!fp) {
-    return NONEXISTENT_FILE;
   }
 
-  *file_sz = file_size(fp);
-  *buf = malloc(*file_sz);
-  fread(*buf, sizeof(char), *file_sz, fp);
-
-  fclose(fp);
-
-  return SUCCESS;
-}
-
-void generate_blog_index(DBConnection *db) {
-    FILE *fp = fopen("posts.html", "w");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening output file for writing\n");
-        return;
-    }
-    fprintf(fp, "<html>\n<head>\n<title>Blog Index</title>\n</head>\n<body>\n");
-    fprintf(fp, "<h1>Blog Index</h1>\n");
-
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT post_id, title FROM blog_posts";
-    int rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Error preparing SQL statement: %s\n", sqlite3_errmsg(db->db));
-        fclose(fp);
-        return;
-    }
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        int post_id = sqlite3_column_int(stmt, 0);
-        const char *title = (const char *) sqlite3_column_text(stmt, 1);
-        fprintf(fp, "<p><a href=\"/post/%d\">%s</a></p>\n", post_id, title);
-    }
-    sqlite3_finalize(stmt);
+  // a successor may be accepting on this socket too; closing our copy
+  // does not affect it
+  close_down_listening(our_socket_fd);
+  handoff_stop_listener();
+
+  int drained = drain_connections(DRAIN_TIMEOUT_MS);
+  stop_cache_warmup();
+  // after a handoff the list is the successor's to write
+  if (!handed_off && save_hot_keys() == FAIL)
+    fprintf(stderr, "Error saving hot keys!\n");
+  // connections that outlived the drain are still using db; exiting
+  // reclaims it for them
+  if (drained == SUCCESS)
+    close_db_connection(&db);
 
-    fprintf(fp, "</body>\n</html>\n");
-    fclose(fp);
+  return 0;
 }
-
-
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE // CPU_SET, pthread_setaffinity_np
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Client.h"
+#include "placement.h"
+
+extern int debug;
+
+// set once by placement_init, before any thread that reads them
+static int network_cpus[CPU_SETSIZE];
+static int network_cpu_count;
+static int next_network_cpu; // accept loop only
+static cpu_set_t allowed_cpus; // what the process started with
+static cpu_set_t writer_cpus;
+static int writer_cpu_count;
+static int node_count = 1;
+
+static __thread int thread_cpu = -1;
+static __thread int thread_node;
+
+// "0-3,8" into set; returns the number of CPUs in it, or -1 if the list
+// does not parse or names a CPU outside allowed_cpus
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p)
+      return -1;
+    long last = first;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p)
+        return -1;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return -1;
+    for (long cpu = first; cpu <= last; cpu++) {
+      if (!CPU_ISSET(cpu, &allowed_cpus))
+        return -1;
+      CPU_SET(cpu, set);
+    }
+    p = end;
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return -1;
+  }
+  return CPU_COUNT(set);
+}
+
+static const char *setting(const char *variable, const char *fallback) {
+  const char *value = getenv(variable);
+  return value ? value : fallback;
+}
+
+int placement_init(void) {
+  if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
+    perror("sched_getaffinity");
+    return FAIL;
+  }
+
+  const char *network_list = setting("BLOG_NETWORK_CPUS", NETWORK_CPUS);
+  const char *writer_list = setting("BLOG_WRITER_CPUS", WRITER_CPUS);
+  cpu_set_t network_set;
+  if (parse_cpu_list(network_list, &network_set) < 0) {
+    fprintf(stderr, "bad network CPU list \"%s\"\n", network_list);
+    return FAIL;
+  }
+  writer_cpu_count = parse_cpu_list(writer_list, &writer_cpus);
+  if (writer_cpu_count < 0) {
+    fprintf(stderr, "bad writer CPU list \"%s\"\n", writer_list);
+    return FAIL;
+  }
+
+  network_cpu_count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &network_set))
+      network_cpus[network_cpu_count++] = cpu;
+  }
+  if (network_cpu_count &&
+      sched_setaffinity(0, sizeof(network_set), &network_set) != 0) {
+    perror("sched_setaffinity");
+    return FAIL;
+  }
+
+#ifdef HAVE_LIBNUMA
+  // per-node memory only pays when connections are pinned to nodes
+  if (network_cpu_count && numa_available() >= 0) {
+    node_count = numa_max_node() + 1;
+    if (node_count > PLACEMENT_MAX_NODES)
+      node_count = PLACEMENT_MAX_NODES;
+  }
+#endif
+  if (debug && (network_cpu_count || writer_cpu_count))
+    fprintf(stderr, "network threads on %d CPUs, writes on %d, %d node(s)\n",
+            network_cpu_count, writer_cpu_count, node_count);
+  return SUCCESS;
+}
+
+int placement_node_count(void) { return node_count; }
+
+int placement_next_network_cpu(void) {
+  if (!network_cpu_count)
+    return -1;
+  int cpu = network_cpus[next_network_cpu];
+  next_network_cpu = (next_network_cpu + 1) % network_cpu_count;
+  return cpu;
+}
+
+int placement_node_of_cpu(int cpu) {
+#ifdef HAVE_LIBNUMA
+  if (cpu < 0 || node_count == 1)
+    return 0;
+  int node = numa_node_of_cpu(cpu);
+  if (node < 0)
+    return 0;
+  return node < node_count ? node : node_count - 1;
+#else
+  return 0;
+#endif
+}
+
+int placement_network_cpu_on_node(int node) {
+  for (int i = 0; i < network_cpu_count; i++) {
+    if (placement_node_of_cpu(network_cpus[i]) == node)
+      return network_cpus[i];
+  }
+  return network_cpu_count ? network_cpus[0] : -1;
+}
+
+void placement_thread_attr(pthread_attr_t *attributes, int cpu) {
+  if (cpu < 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_attr_setaffinity_np(attributes, sizeof(set), &set);
+}
+
+void placement_thread_start(int cpu) {
+  thread_cpu = cpu;
+  thread_node = placement_node_of_cpu(cpu);
+}
+
+int placement_current_node(void) { return thread_node; }
+
+void placement_enter_writer(void) {
+  if (writer_cpu_count)
+    pthread_setaffinity_np(pthread_self(), sizeof(writer_cpus), &writer_cpus);
+}
+
+void placement_leave_writer(void) {
+  if (!writer_cpu_count)
+    return;
+  cpu_set_t set = allowed_cpus;
+  if (thread_cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(thread_cpu, &set);
+  } else if (network_cpu_count) {
+    CPU_ZERO(&set);
+    for (int i = 0; i < network_cpu_count; i++)
+      CPU_SET(network_cpus[i], &set);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void *placement_alloc_on_node(size_t size, int node) {
+#ifdef HAVE_LIBNUMA
+  if (node_count > 1) {
+    void *memory = numa_alloc_onnode(size, node);
+    if (!memory) {
+      perror("numa_alloc_onnode");
+      abort(); // as for malloc, out of memory is fatal
+    }
+    return memory;
+  }
+#endif
+  return malloc(size);
+}
@@ -0,0 +1,65 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// CPU and NUMA placement. Each connection has a thread of its own; those
+// threads are the network threads, pinned round-robin, one CPU each, to
+// NETWORK_CPUS. While one of them writes to SQLite (a publish's
+// transaction, a piece of an import body) it moves to WRITER_CPUS, so that
+// the writer's pages stay in one set of caches, and back afterwards; never
+// while it waits on its client. A connection's Client (with its input
+// buffer and arenas) and the post cache its thread reads come from the
+// NUMA node of its CPU.
+//
+// The lists are CPU numbers and ranges, "0-7,16-23"; empty leaves threads
+// wherever the kernel puts them. The environment variables
+// BLOG_NETWORK_CPUS and BLOG_WRITER_CPUS take precedence. Pinning needs
+// nothing more; per-node memory needs a build with libnuma (make NUMA=1,
+// which defines HAVE_LIBNUMA), and without it everything is node 0.
+
+#ifndef NETWORK_CPUS
+#define NETWORK_CPUS ""
+#endif
+#ifndef WRITER_CPUS
+#define WRITER_CPUS ""
+#endif
+
+// nodes past this many share the last one's memory
+#define PLACEMENT_MAX_NODES 8
+
+// Reads the lists and confines the calling thread (the accept loop) and
+// those it starts later to NETWORK_CPUS. Returns FAIL if a list does not
+// parse or names a CPU this process may not run on.
+int placement_init(void);
+
+// How many per-node copies of something are worth keeping; 1 without NUMA.
+int placement_node_count(void);
+
+// The CPU for the next connection's thread, or -1 when not pinning.
+// Accept loop only.
+int placement_next_network_cpu(void);
+
+// 0 for -1 (not pinned), and without NUMA
+int placement_node_of_cpu(int cpu);
+// A network CPU on node, for work done on behalf of that node's threads;
+// -1 when not pinning.
+int placement_network_cpu_on_node(int node);
+
+// Threads created with attributes will run on cpu alone (-1: anywhere).
+void placement_thread_attr(pthread_attr_t *attributes, int cpu);
+// First thing on such a thread, so that it knows its node.
+void placement_thread_start(int cpu);
+// The calling thread's node; 0 for threads that are not pinned.
+int placement_current_node(void);
+
+// Moves the calling thread onto WRITER_CPUS, and back again.
+void placement_enter_writer(void);
+void placement_leave_writer(void);
+
+// size bytes of node's memory (where there is NUMA), for good: there is
+// no way to free them.
+void *placement_alloc_on_node(size_t size, int node);
+
+#endif
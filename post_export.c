@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+#include "Client.h"
+#include "post_export.h"
+
+typedef struct {
+  JsonSink sink;
+  void *ctx;
+  long posts;
+  int failed; // the sink refused a row
+} PostExport;
+
+static int export_row(void *ctx, const BlogPost *post) {
+  PostExport *export = ctx;
+  JsonWriter w;
+  json_writer_init(&w, export->sink, export->ctx);
+  json_begin_object(&w);
+  json_key(&w, "id");
+  json_int(&w, post->post_id);
+  json_key(&w, "user");
+  json_string(&w, post->user);
+  json_key(&w, "title");
+  json_string(&w, post->title);
+  json_key(&w, "content");
+  json_string(&w, post->content);
+  json_end_object(&w);
+  if (json_writer_result(&w) == FAIL ||
+      export->sink(export->ctx, "\n", 1) == FAIL) {
+    export->failed = 1;
+    return 1;
+  }
+  export->posts++;
+  return 0;
+}
+
+long export_posts(DBConnection *conn, JsonSink sink, void *ctx,
+                  char **errmsg) {
+  if (errmsg)
+    *errmsg = NULL;
+
+  DBConnection snapshot = {NULL, NULL};
+  const char *db_filename = sqlite3_db_filename(conn->db, "main");
+  if (open_db_connection(&snapshot, db_filename) != 0) {
+    if (errmsg)
+      *errmsg = snapshot.errmsg;
+    else
+      free(snapshot.errmsg);
+    sqlite3_close(snapshot.db);
+    return -1;
+  }
+
+  PostExport export = {sink, ctx, 0, 0};
+  int result = for_each_blog_post(&snapshot, export_row, &export);
+  if (result != 0 && !export.failed) {
+    if (errmsg)
+      *errmsg = snapshot.errmsg;
+    else
+      free(snapshot.errmsg);
+  }
+  sqlite3_close(snapshot.db);
+  return result == 0 ? export.posts : -1;
+}
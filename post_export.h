@@ -0,0 +1,20 @@
+#ifndef POST_EXPORT_H
+#define POST_EXPORT_H
+
+#include "blog.h"
+#include "json_writer.h"
+
+// Every post as newline-delimited JSON, one object per line in id order:
+//   {"id": 1, "user": "...", "title": "...", "content": "..."}
+// which post_import.h reads back (ignoring the id). Rows are written to
+// the sink as they are stepped, so memory use does not grow with the
+// table. The query runs on a connection of its own: one consistent
+// snapshot, and the shared connection's readers never see it.
+//
+// Returns the number of posts written, or -1 if the database failed or
+// the sink did (a client that went away). errmsg, when not NULL, gets a
+// malloc'd description of a database failure.
+long export_posts(DBConnection *conn, JsonSink sink, void *ctx,
+                  char **errmsg);
+
+#endif
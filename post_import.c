@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "Client.h"
+#include "post_import.h"
+
+extern int debug;
+
+int post_import_begin(PostImport *import, DBConnection *conn) {
+  memset(import, 0, sizeof(PostImport));
+  clock_gettime(CLOCK_MONOTONIC, &import->started);
+  if (blog_post_import_begin(&import->rows, conn) != 0) {
+    import->failed = 1;
+    blog_post_import_abort(&import->rows);
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+double post_import_seconds(const PostImport *import) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - import->started.tv_sec) +
+         (now.tv_nsec - import->started.tv_nsec) / 1e9;
+}
+
+static void release_buffers(PostImport *import) {
+  free(import->record);
+  import->record = NULL;
+  free(import->scratch);
+  import->scratch = NULL;
+}
+
+void post_import_abort(PostImport *import) {
+  blog_post_import_abort(&import->rows);
+  release_buffers(import);
+}
+
+static const char *skip_space(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    p++;
+  return p;
+}
+
+static int hex4(const char *p, const char *end) {
+  if (end - p < 4)
+    return -1;
+  int value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9')
+      value |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      value |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      value |= c - 'A' + 10;
+    else
+      return -1;
+  }
+  return value;
+}
+
+static int put_utf8(char *out, unsigned code) {
+  if (code < 0x80) {
+    out[0] = code;
+    return 1;
+  }
+  if (code < 0x800) {
+    out[0] = 0xC0 | (code >> 6);
+    out[1] = 0x80 | (code & 0x3F);
+    return 2;
+  }
+  if (code < 0x10000) {
+    out[0] = 0xE0 | (code >> 12);
+    out[1] = 0x80 | ((code >> 6) & 0x3F);
+    out[2] = 0x80 | (code & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | (code >> 18);
+  out[1] = 0x80 | ((code >> 12) & 0x3F);
+  out[2] = 0x80 | ((code >> 6) & 0x3F);
+  out[3] = 0x80 | (code & 0x3F);
+  return 4;
+}
+
+// Decodes the JSON string starting at p (its opening quote) into out,
+// which never needs more room than the encoded form. Returns the position
+// after the closing quote, or NULL if the string is malformed.
+static const char *json_string(const char *p, const char *end, char *out,
+                               int *out_len) {
+  int len = 0;
+  p++;
+  while (p < end) {
+    // copy the run up to the next quote or escape in one go
+    const char *run = p;
+    while (p < end && *p != '"' && *p != '\\')
+      p++;
+    memcpy(out + len, run, p - run);
+    len += p - run;
+    if (p == end)
+      return NULL;
+    if (*p == '"') {
+      *out_len = len;
+      return p + 1;
+    }
+
+    if (++p == end)
+      return NULL;
+    char c = *p++;
+    switch (c) {
+    case '"': case '\\': case '/': out[len++] = c; break;
+    case 'b': out[len++] = '\b'; break;
+    case 'f': out[len++] = '\f'; break;
+    case 'n': out[len++] = '\n'; break;
+    case 'r': out[len++] = '\r'; break;
+    case 't': out[len++] = '\t'; break;
+    case 'u': {
+      int code = hex4(p, end);
+      if (code < 0)
+        return NULL;
+      p += 4;
+      if (code >= 0xD800 && code <= 0xDBFF) {
+        // a surrogate pair is one character
+        int low = end - p >= 6 && p[0] == '\\' && p[1] == 'u'
+                      ? hex4(p + 2, end) : -1;
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        } else {
+          code = 0xFFFD;
+        }
+      } else if (code >= 0xDC00 && code <= 0xDFFF) {
+        code = 0xFFFD;
+      }
+      len += put_utf8(out + len, code);
+      break;
+    }
+    default:
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+// Steps over any JSON value. Returns NULL if there is none at p.
+static const char *json_skip_value(const char *p, const char *end) {
+  if (p == end)
+    return NULL;
+  if (*p == '"') {
+    for (p++; p < end; p++) {
+      if (*p == '\\')
+        p++;
+      else if (*p == '"')
+        return p + 1;
+    }
+    return NULL;
+  }
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = json_skip_value(p, end);
+        if (!p)
+          return NULL;
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if ((*p == '}' || *p == ']') && --depth == 0)
+        return p + 1;
+      p++;
+    }
+    return NULL;
+  }
+  const char *start = p;
+  while (p < end && !strchr(",}] \t\r\n", *p))
+    p++;
+  return p == start ? NULL : p;
+}
+
+static const char *field_names[IMPORT_FIELD_COUNT] = {"user", "title",
+                                                      "content"};
+
+static int field_named(const char *name, int len) {
+  for (int i = 0; i < IMPORT_FIELD_COUNT; i++) {
+    if ((int)strlen(field_names[i]) == len &&
+        !strncasecmp(name, field_names[i], len))
+      return i;
+  }
+  return -1;
+}
+
+// Fills fields[] (NULL when absent) from one JSON object, decoding into
+// import->scratch. Returns FAIL if the line is not an object.
+static int parse_json_record(PostImport *import, const char *p,
+                             const char *end, const char **fields,
+                             int *field_lens) {
+  char *out = import->scratch;
+  p = skip_space(p, end);
+  if (p == end || *p != '{')
+    return FAIL;
+  p = skip_space(p + 1, end);
+  if (p < end && *p == '}')
+    return skip_space(p + 1, end) == end ? SUCCESS : FAIL;
+
+  while (p < end) {
+    int key_len;
+    if (*p != '"' || !(p = json_string(p, end, out, &key_len)))
+      return FAIL;
+    int field = field_named(out, key_len);
+
+    p = skip_space(p, end);
+    if (p == end || *p != ':')
+      return FAIL;
+    p = skip_space(p + 1, end);
+
+    if (field >= 0 && p < end && *p == '"') {
+      if (!(p = json_string(p, end, out, &field_lens[field])))
+        return FAIL;
+      fields[field] = out;
+      out += field_lens[field];
+    } else if (!(p = json_skip_value(p, end))) {
+      // other members, and a null or number for ours, are passed over
+      return FAIL;
+    }
+
+    p = skip_space(p, end);
+    if (p < end && *p == ',') {
+      p = skip_space(p + 1, end);
+      continue;
+    }
+    if (p < end && *p == '}')
+      return skip_space(p + 1, end) == end ? SUCCESS : FAIL;
+    return FAIL;
+  }
+  return FAIL;
+}
+
+// Decodes the CSV field at p into out. Returns the position of the comma
+// that ends it, or end.
+static const char *csv_field(const char *p, const char *end, char *out,
+                             int *out_len) {
+  int len = 0;
+  if (p < end && *p == '"') {
+    for (p++; p < end; p++) {
+      if (*p == '"') {
+        if (p + 1 < end && p[1] == '"')
+          p++; // "" is a literal quote
+        else {
+          p++;
+          break;
+        }
+      }
+      out[len++] = *p;
+    }
+  }
+  // unquoted, or anything straggling after the closing quote
+  const char *run = p;
+  while (p < end && *p != ',')
+    p++;
+  memcpy(out + len, run, p - run);
+  *out_len = len + (p - run);
+  return p;
+}
+
+// A first row naming both title and content is a header; it decides which
+// column holds what. Returns 1 if the row was one.
+static int read_csv_header(PostImport *import, const char *p,
+                           const char *end) {
+  int columns[IMPORT_FIELD_COUNT] = {-1, -1, -1};
+  for (int column = 0;; column++) {
+    int len;
+    p = csv_field(p, end, import->scratch, &len);
+    int field = field_named(import->scratch, len);
+    if (field >= 0 && columns[field] < 0)
+      columns[field] = column;
+    if (p == end)
+      break;
+    p++;
+  }
+
+  import->columns_known = 1;
+  if (columns[IMPORT_FIELD_TITLE] < 0 || columns[IMPORT_FIELD_CONTENT] < 0) {
+    for (int i = 0; i < IMPORT_FIELD_COUNT; i++)
+      import->columns[i] = i;
+    return 0;
+  }
+  memcpy(import->columns, columns, sizeof(columns));
+  return 1;
+}
+
+static void parse_csv_record(PostImport *import, const char *p,
+                             const char *end, const char **fields,
+                             int *field_lens) {
+  char *out = import->scratch;
+  for (int column = 0;; column++) {
+    int len;
+    p = csv_field(p, end, out, &len);
+    for (int i = 0; i < IMPORT_FIELD_COUNT; i++) {
+      if (import->columns[i] == column) {
+        fields[i] = out;
+        field_lens[i] = len;
+        out += len;
+        break;
+      }
+    }
+    if (p == end)
+      break;
+    p++;
+  }
+}
+
+// One complete record, without its newline.
+static void import_record(PostImport *import, const char *record, int len) {
+  if (len > 0 && record[len - 1] == '\r')
+    len--;
+  const char *end = record + len;
+  if (skip_space(record, end) == end)
+    return; // blank lines are not records
+
+  // decoded fields are never longer than the record
+  if (len + 1 > import->scratch_cap) {
+    int cap = import->scratch_cap ? import->scratch_cap : 4096;
+    while (cap < len + 1)
+      cap *= 2;
+    char *scratch = realloc(import->scratch, cap);
+    if (!scratch) {
+      import->skipped++;
+      return;
+    }
+    import->scratch = scratch;
+    import->scratch_cap = cap;
+  }
+
+  const char *fields[IMPORT_FIELD_COUNT] = {NULL, NULL, NULL};
+  int field_lens[IMPORT_FIELD_COUNT] = {0, 0, 0};
+  if (import->format == IMPORT_FORMAT_NDJSON) {
+    if (parse_json_record(import, record, end, fields, field_lens) == FAIL) {
+      import->skipped++;
+      return;
+    }
+  } else {
+    if (!import->columns_known && read_csv_header(import, record, end))
+      return;
+    parse_csv_record(import, record, end, fields, field_lens);
+  }
+
+  if (!fields[IMPORT_FIELD_TITLE] || !fields[IMPORT_FIELD_CONTENT]) {
+    import->skipped++;
+    return;
+  }
+  if (!fields[IMPORT_FIELD_USER])
+    fields[IMPORT_FIELD_USER] = "";
+
+  if (blog_post_import_add(&import->rows,
+                           fields[IMPORT_FIELD_USER],
+                           field_lens[IMPORT_FIELD_USER],
+                           fields[IMPORT_FIELD_TITLE],
+                           field_lens[IMPORT_FIELD_TITLE],
+                           fields[IMPORT_FIELD_CONTENT],
+                           field_lens[IMPORT_FIELD_CONTENT]) != 0) {
+    import->failed = 1;
+    return;
+  }
+  import->imported++;
+}
+
+// Where the record starting at p ends (its newline), or NULL if it goes on
+// past this piece. A CSV newline inside quotes does not end a record.
+static const char *record_end(PostImport *import, const char *p,
+                              const char *end) {
+  if (import->format == IMPORT_FORMAT_NDJSON)
+    return memchr(p, '\n', end - p);
+  for (; p < end; p++) {
+    if (*p == '"')
+      import->in_quotes = !import->in_quotes;
+    else if (*p == '\n' && !import->in_quotes)
+      return p;
+  }
+  return NULL;
+}
+
+static void keep_partial_record(PostImport *import, const char *data,
+                                int len) {
+  if (import->oversized)
+    return;
+  if (import->record_len + len > IMPORT_MAX_RECORD_LENGTH) {
+    import->oversized = 1;
+    return;
+  }
+  if (import->record_len + len > import->record_cap) {
+    int cap = import->record_cap ? import->record_cap : 4096;
+    while (cap < import->record_len + len)
+      cap *= 2;
+    char *record = realloc(import->record, cap);
+    if (!record) {
+      import->oversized = 1;
+      return;
+    }
+    import->record = record;
+    import->record_cap = cap;
+  }
+  memcpy(import->record + import->record_len, data, len);
+  import->record_len += len;
+}
+
+static void end_partial_record(PostImport *import) {
+  if (import->oversized)
+    import->skipped++;
+  else
+    import_record(import, import->record, import->record_len);
+  import->record_len = 0;
+  import->oversized = 0;
+}
+
+int post_import_feed(PostImport *import, const char *data, int len) {
+  const char *end = data + len;
+  while (data < end && !import->failed) {
+    if (import->format == IMPORT_FORMAT_UNKNOWN) {
+      data = skip_space(data, end);
+      if (data == end)
+        break;
+      import->format = *data == '{' ? IMPORT_FORMAT_NDJSON : IMPORT_FORMAT_CSV;
+      if (debug)
+        fprintf(stderr, "import: reading %s\n",
+                import->format == IMPORT_FORMAT_NDJSON ? "NDJSON" : "CSV");
+    }
+
+    const char *eol = record_end(import, data, end);
+    if (!eol) {
+      keep_partial_record(import, data, end - data);
+      break;
+    }
+    if (import->record_len == 0 && !import->oversized) {
+      // the common case: the whole record is in this piece; no copy
+      import_record(import, data, eol - data);
+    } else {
+      keep_partial_record(import, data, eol - data);
+      end_partial_record(import);
+    }
+    data = eol + 1;
+  }
+  return import->failed ? FAIL : SUCCESS;
+}
+
+int post_import_commit(PostImport *import) {
+  if (!import->failed && blog_post_import_commit(&import->rows) != 0)
+    import->failed = 1;
+  return import->failed ? FAIL : SUCCESS;
+}
+
+int post_import_finish(PostImport *import) {
+  if (!import->failed && (import->record_len > 0 || import->oversized))
+    end_partial_record(import);
+
+  int result = SUCCESS;
+  if (import->failed) {
+    blog_post_import_abort(&import->rows);
+    result = FAIL;
+  } else if (blog_post_import_finish(&import->rows) != 0) {
+    result = FAIL;
+  }
+  release_buffers(import);
+
+  if (debug)
+    fprintf(stderr, "import: %ld posts imported, %ld skipped in %.3fs\n",
+            import->imported, import->skipped, post_import_seconds(import));
+  return result;
+}
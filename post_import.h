@@ -0,0 +1,68 @@
+#ifndef POST_IMPORT_H
+#define POST_IMPORT_H
+
+#include <time.h>
+
+#include "blog.h"
+
+// Bulk import of posts from another system, fed in arbitrary pieces (read()
+// sized chunks of a file or of a request body) and never held whole. The
+// format is picked from the first byte:
+//
+//   newline-delimited JSON, one object per line:
+//     {"user": "...", "title": "...", "content": "..."}
+//   CSV (RFC 4180), optionally with a header row naming the columns;
+//   without one the columns are user,title,content.
+//
+// Other JSON members and CSV columns are ignored. Records without a title
+// or content, or that do not parse, are counted as skipped. Rows go in
+// through BlogPostImport, so they land in large transactions.
+
+// longer records are skipped rather than buffered
+#define IMPORT_MAX_RECORD_LENGTH (16 * 1024 * 1024)
+
+#define IMPORT_FORMAT_UNKNOWN 0
+#define IMPORT_FORMAT_NDJSON 1
+#define IMPORT_FORMAT_CSV 2
+
+#define IMPORT_FIELD_USER 0
+#define IMPORT_FIELD_TITLE 1
+#define IMPORT_FIELD_CONTENT 2
+#define IMPORT_FIELD_COUNT 3
+
+typedef struct PostImport {
+  BlogPostImport rows;
+  int format;
+  int failed; // sticky; the database refused a row
+  // a record split across feeds, kept until its end arrives
+  char *record;
+  int record_len, record_cap;
+  int oversized; // discarding the rest of a record that grew too long
+  int in_quotes; // CSV: the newline just seen is inside a field
+  // decoded field values for the current record
+  char *scratch;
+  int scratch_cap;
+  int columns_known; // CSV: header row seen (or ruled out)
+  int columns[IMPORT_FIELD_COUNT]; // CSV column of each field, or -1
+  long imported, skipped;
+  struct timespec started;
+  long body_remaining; // bytes of a streamed request body still to come
+} PostImport;
+
+// Returns FAIL or SUCCESS; on FAIL the import is already cleaned up.
+int post_import_begin(PostImport *import, DBConnection *conn);
+// Returns FAIL once a row could not be stored; later feeds do nothing.
+int post_import_feed(PostImport *import, const char *data, int len);
+// Commits the rows fed so far (see blog_post_import_commit), before a
+// wait for the next feed. Returns FAIL as post_import_feed does.
+int post_import_commit(PostImport *import);
+// Takes a last record without a trailing newline and commits. Returns FAIL
+// or SUCCESS; either way the import is cleaned up. rows.conn.errmsg may
+// say what went wrong and is the caller's to free.
+int post_import_finish(PostImport *import);
+// Drops the uncommitted batch (earlier batches stay) and cleans up.
+void post_import_abort(PostImport *import);
+// since post_import_begin
+double post_import_seconds(const PostImport *import);
+
+#endif
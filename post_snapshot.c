@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Client.h"
+#include "body_cache.h"
+#include "post_snapshot.h"
+
+typedef struct {
+  FILE *fp;
+  PostRenderFunc render;
+  uint64_t offset; // where the next page goes
+  int first_id;
+  PostSnapshotEntry *index; // by post_id - first_id
+  int index_len;
+  int index_cap;
+  long posts;
+  int write_failed;
+} SnapshotWriter;
+
+static int write_page(void *ctx, const BlogPost *post) {
+  SnapshotWriter *writer = ctx;
+  if (!writer->index_len)
+    writer->first_id = post->post_id;
+
+  int slot = post->post_id - writer->first_id;
+  if (slot >= writer->index_cap) {
+    int cap = writer->index_cap ? writer->index_cap : 1024;
+    while (slot >= cap)
+      cap *= 2;
+    writer->index = realloc(writer->index, cap * sizeof(PostSnapshotEntry));
+    writer->index_cap = cap;
+  }
+  // ids that were never used, between this post and the last
+  memset(&writer->index[writer->index_len], 0,
+         (slot - writer->index_len) * sizeof(PostSnapshotEntry));
+  writer->index_len = slot + 1;
+
+  int body_len;
+  char *body = writer->render(post, &body_len);
+  char *gzip_body = NULL;
+  int gzip_len = gzip_compress(body, body_len, &gzip_body);
+
+  if (fwrite(body, 1, body_len, writer->fp) != (size_t)body_len ||
+      fwrite(gzip_body, 1, gzip_len, writer->fp) != (size_t)gzip_len)
+    writer->write_failed = 1;
+
+  PostSnapshotEntry *entry = &writer->index[slot];
+  entry->offset = writer->offset;
+  entry->body_len = body_len;
+  entry->gzip_len = gzip_len;
+  writer->offset += body_len + gzip_len;
+  writer->posts++;
+
+  free(body);
+  free(gzip_body);
+  return writer->write_failed;
+}
+
+static long snapshot_failed(FILE *fp, const char *tmp_path, char **errmsg,
+                            char *message) {
+  if (errmsg)
+    *errmsg = message;
+  else
+    free(message);
+  if (fp)
+    fclose(fp);
+  unlink(tmp_path);
+  return -1;
+}
+
+long post_snapshot_write(DBConnection *conn, const char *path,
+                         PostRenderFunc render, char **errmsg) {
+  if (errmsg)
+    *errmsg = NULL;
+
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *fp = fopen(tmp_path, "wb");
+  if (!fp)
+    return snapshot_failed(NULL, tmp_path, errmsg, strdup(strerror(errno)));
+
+  // the header goes in last, once the index's place is known
+  PostSnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  SnapshotWriter writer = {fp, render, sizeof(header), 1, NULL, 0, 0, 0, 0};
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    writer.write_failed = 1;
+
+  // one query, so one consistent snapshot of the table
+  if (!writer.write_failed &&
+      for_each_blog_post(conn, write_page, &writer) != 0 &&
+      !writer.write_failed) {
+    free(writer.index);
+    char *message = conn->errmsg;
+    conn->errmsg = NULL;
+    return snapshot_failed(fp, tmp_path, errmsg, message);
+  }
+
+  static const char padding[8];
+  int pad = -writer.offset & 7;
+  if (fwrite(padding, 1, pad, fp) != (size_t)pad ||
+      fwrite(writer.index, sizeof(PostSnapshotEntry), writer.index_len, fp) !=
+          (size_t)writer.index_len)
+    writer.write_failed = 1;
+  free(writer.index);
+
+  memcpy(header.magic, POST_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = POST_SNAPSHOT_VERSION;
+  header.first_id = writer.first_id;
+  header.last_id = writer.first_id + writer.index_len - 1;
+  header.index_offset = writer.offset + pad;
+  header.file_size =
+      header.index_offset + writer.index_len * sizeof(PostSnapshotEntry);
+  if (writer.write_failed || fseek(fp, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0 ||
+      fsync(fileno(fp)) != 0)
+    return snapshot_failed(fp, tmp_path, errmsg, strdup(strerror(errno)));
+
+  if (fclose(fp) != 0 || rename(tmp_path, path) != 0)
+    return snapshot_failed(NULL, tmp_path, errmsg, strdup(strerror(errno)));
+  return writer.posts;
+}
+
+int post_snapshot_open(PostSnapshot *snapshot, const char *path) {
+  memset(snapshot, 0, sizeof(PostSnapshot));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return FAIL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PostSnapshotHeader)) {
+    close(fd);
+    return FAIL;
+  }
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file
+  if (map == MAP_FAILED)
+    return FAIL;
+
+  const PostSnapshotHeader *header = (const PostSnapshotHeader *)map;
+  uint64_t entries = (int64_t)header->last_id - header->first_id + 1;
+  if (memcmp(header->magic, POST_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+      header->version != POST_SNAPSHOT_VERSION ||
+      header->file_size != (uint64_t)st.st_size ||
+      header->last_id < header->first_id - 1 || header->index_offset % 8 ||
+      header->index_offset > header->file_size ||
+      (header->file_size - header->index_offset) / sizeof(PostSnapshotEntry) !=
+          entries) {
+    munmap(map, st.st_size);
+    return FAIL;
+  }
+
+  // archive reads land anywhere in the file
+  madvise(map, st.st_size, MADV_RANDOM);
+  snapshot->map = map;
+  snapshot->map_len = st.st_size;
+  snapshot->header = header;
+  snapshot->index = (const PostSnapshotEntry *)(map + header->index_offset);
+  return SUCCESS;
+}
+
+void post_snapshot_close(PostSnapshot *snapshot) {
+  if (snapshot->map)
+    munmap((void *)snapshot->map, snapshot->map_len);
+  memset(snapshot, 0, sizeof(PostSnapshot));
+}
+
+int post_snapshot_find(const PostSnapshot *snapshot, int post_id,
+                       const char **body, int *body_len,
+                       const char **gzip_body, int *gzip_len) {
+  if (!snapshot->map || post_id < snapshot->header->first_id ||
+      post_id > snapshot->header->last_id)
+    return 0;
+
+  const PostSnapshotEntry *entry =
+      &snapshot->index[post_id - snapshot->header->first_id];
+  // a damaged entry must not point outside the pages
+  if (!entry->body_len ||
+      entry->offset + entry->body_len + entry->gzip_len >
+          snapshot->header->index_offset)
+    return 0;
+
+  *body = snapshot->map + entry->offset;
+  *body_len = entry->body_len;
+  *gzip_body = entry->gzip_len ? *body + entry->body_len : NULL;
+  *gzip_len = entry->gzip_len;
+  return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef POST_SNAPSHOT_H
+#define POST_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "blog.h"
+
+// A read-only archive of post pages, written offline (main --snapshot)
+// and mapped by the server, which answers /post/<id> for every post in it
+// straight from the mapping: no query, no render, no copy. Posts are never
+// edited, so a snapshot stays valid; newer posts come from the database.
+//
+// Layout, in the byte order of the host that wrote it:
+//   PostSnapshotHeader, at offset 0
+//   the pages back to back: each post's HTML, then its gzip copy if any
+//   PostSnapshotEntry index[last_id - first_id + 1], 8-byte aligned
+// The header comes first in the file but is written last: the writer
+// leaves it zeroed until the index's offset is known, then seeks back.
+// This is the one description of the format; README.md refers here.
+
+#define POST_SNAPSHOT_MAGIC "BLOGSNAP"
+#define POST_SNAPSHOT_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  int32_t first_id;
+  int32_t last_id; // first_id - 1 when the snapshot is empty
+  uint32_t reserved;
+  uint64_t index_offset;
+  uint64_t file_size;
+} PostSnapshotHeader;
+
+typedef struct {
+  uint64_t offset;
+  uint32_t body_len; // 0: no post has this id
+  uint32_t gzip_len; // 0: gzip was not smaller
+} PostSnapshotEntry;
+
+typedef struct {
+  const char *map; // NULL when no snapshot is loaded
+  uint64_t map_len;
+  const PostSnapshotHeader *header;
+  const PostSnapshotEntry *index;
+} PostSnapshot;
+
+// A post's page as the server renders it, malloc'd.
+typedef char *(*PostRenderFunc)(const BlogPost *post, int *len);
+
+// Writes every post in conn to path (through path.tmp, renamed into place
+// when complete). Returns the number of posts written, or -1; errmsg,
+// when not NULL, then gets a malloc'd description.
+long post_snapshot_write(DBConnection *conn, const char *path,
+                         PostRenderFunc render, char **errmsg);
+
+// Maps path and checks its header. Returns FAIL (with snapshot->map NULL)
+// if it is missing or not a snapshot this version reads, else SUCCESS.
+int post_snapshot_open(PostSnapshot *snapshot, const char *path);
+void post_snapshot_close(PostSnapshot *snapshot);
+
+// Points body (and gzip_body, NULL if there is none) into the mapping.
+// Returns 0 when the post is not in the snapshot.
+int post_snapshot_find(const PostSnapshot *snapshot, int post_id,
+                       const char **body, int *body_len,
+                       const char **gzip_body, int *gzip_len);
+
+#endif
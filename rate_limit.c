@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rate_limit.h"
+
+// Tokens are counted in millionths so slow refill rates stay exact.
+#define TOKEN 1000000u
+
+#define RACE_SLACK_MS 60000
+
+// Each bucket is one 64-bit word, updated with compare-and-swap: the high
+// half is when it was last refilled (ms), the low half the tokens left.
+// 0 stands for a full bucket nobody has drawn from yet.
+//
+// A row belongs to an address once its addr is CASed in. Rows are never
+// emptied again; a row whose buckets have both refilled to full holds no
+// information, so an insert that finds no free row takes one of those
+// over. Two threads racing on a reused row can blur one request's
+// accounting, which a rate limiter can live with.
+typedef struct {
+  uint32_t addr; // 0 = free; 0.0.0.0 never connects
+  uint64_t buckets[2];
+} RateLimitRow;
+
+typedef struct {
+  uint32_t rate;     // millionths of a token per ms
+  uint32_t capacity; // millionths of a token
+} BucketConfig;
+
+static const BucketConfig bucket_configs[2] = {
+    [RATE_LIMIT_READ] = {RATE_LIMIT_READS_PER_SECOND * (TOKEN / 1000),
+                         RATE_LIMIT_READ_BURST * TOKEN},
+    [RATE_LIMIT_WRITE] = {RATE_LIMIT_WRITES_PER_MINUTE * (TOKEN / 1000) / 60,
+                          RATE_LIMIT_WRITE_BURST * TOKEN},
+};
+
+static RateLimitRow rate_limit_table[RATE_LIMIT_SHARDS][RATE_LIMIT_SHARD_ROWS];
+static struct timespec rate_limit_epoch;
+static int rate_limit_enabled;
+
+void rate_limit_init(void) {
+  memset(rate_limit_table, 0, sizeof(rate_limit_table));
+  clock_gettime(CLOCK_MONOTONIC, &rate_limit_epoch);
+  rate_limit_enabled = 1;
+}
+
+// ms since rate_limit_init, wrapping; never 0, which marks a fresh bucket
+static uint32_t now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint32_t ms = (now.tv_sec - rate_limit_epoch.tv_sec) * 1000 +
+                (now.tv_nsec - rate_limit_epoch.tv_nsec) / 1000000;
+  return ms ? ms : 1;
+}
+
+static uint32_t refilled_tokens(uint64_t bucket, uint32_t now,
+                                const BucketConfig *config) {
+  if (bucket == 0)
+    return config->capacity;
+
+  // a racing thread may have stored a slightly later time than ours; a
+  // time far "ahead" means the bucket sat idle past the 32-bit wrap
+  int32_t elapsed = now - (uint32_t)(bucket >> 32);
+  if (elapsed < -RACE_SLACK_MS)
+    return config->capacity;
+
+  uint64_t tokens = (uint32_t)bucket;
+  if (elapsed > 0)
+    tokens += (uint64_t)elapsed * config->rate;
+  return tokens < config->capacity ? tokens : config->capacity;
+}
+
+static int row_is_expired(RateLimitRow *row, uint32_t now) {
+  for (int budget = 0; budget < 2; budget++) {
+    uint64_t bucket = __atomic_load_n(&row->buckets[budget], __ATOMIC_ACQUIRE);
+    if (refilled_tokens(bucket, now, &bucket_configs[budget]) <
+        bucket_configs[budget].capacity)
+      return 0;
+  }
+  return 1;
+}
+
+static RateLimitRow *find_row(uint32_t addr, uint32_t now) {
+  // Fibonacci hashing; the high bits pick the shard, the low bits the row
+  uint32_t hash = addr * 2654435769u;
+  RateLimitRow *shard = rate_limit_table[(hash >> 16) % RATE_LIMIT_SHARDS];
+  int home = hash % RATE_LIMIT_SHARD_ROWS;
+
+  RateLimitRow *expired = NULL;
+  for (int probe = 0; probe < RATE_LIMIT_PROBE; probe++) {
+    RateLimitRow *row = &shard[(home + probe) % RATE_LIMIT_SHARD_ROWS];
+    uint32_t owner = __atomic_load_n(&row->addr, __ATOMIC_ACQUIRE);
+    if (owner == addr)
+      return row;
+
+    if (owner == 0) {
+      if (__atomic_compare_exchange_n(&row->addr, &owner, addr, 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+          owner == addr)
+        return row;
+      continue; // another address got it first
+    }
+
+    if (!expired && row_is_expired(row, now))
+      expired = row;
+  }
+
+  if (expired) {
+    uint32_t owner = __atomic_load_n(&expired->addr, __ATOMIC_ACQUIRE);
+    if (__atomic_compare_exchange_n(&expired->addr, &owner, addr, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      __atomic_store_n(&expired->buckets[RATE_LIMIT_READ], 0, __ATOMIC_RELEASE);
+      __atomic_store_n(&expired->buckets[RATE_LIMIT_WRITE], 0, __ATOMIC_RELEASE);
+      return expired;
+    }
+  }
+  return NULL;
+}
+
+int rate_limit_allow(struct in_addr addr, RateLimitBudget budget,
+                     int *retry_after) {
+  if (!rate_limit_enabled)
+    return 1;
+
+  uint32_t now = now_ms();
+  RateLimitRow *row = find_row(addr.s_addr, now);
+  if (!row)
+    return 1; // every nearby row is busy; fail open rather than block
+
+  const BucketConfig *config = &bucket_configs[budget];
+  uint64_t *bucket = &row->buckets[budget];
+  uint64_t old = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+  while (1) {
+    uint32_t tokens = refilled_tokens(old, now, config);
+    if (tokens < TOKEN) {
+      uint32_t wait_ms = (TOKEN - tokens + config->rate - 1) / config->rate;
+      *retry_after = (wait_ms + 999) / 1000;
+      return 0;
+    }
+
+    uint32_t last = old >> 32;
+    uint32_t stamp = old && (int32_t)(now - last) < 0 ? last : now;
+    uint64_t new_bucket = ((uint64_t)stamp << 32) | (tokens - TOKEN);
+    if (__atomic_compare_exchange_n(bucket, &old, new_bucket, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return 1;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <netinet/in.h>
+
+// Per-address token buckets, with separate budgets for reads (GET) and
+// writes (POST /publish). A request that finds its bucket empty is
+// answered 429 before it reaches a handler, let alone the database.
+//
+// Bursts are whole requests; a bucket holds at most 4294 of them.
+
+#define RATE_LIMIT_READS_PER_SECOND 50
+#define RATE_LIMIT_READ_BURST 200
+#define RATE_LIMIT_WRITES_PER_MINUTE 10
+#define RATE_LIMIT_WRITE_BURST 5
+
+// The table is split into shards of a fixed number of rows; an address
+// hashes to one shard and probes a few rows from its home row there.
+#define RATE_LIMIT_SHARDS 64
+#define RATE_LIMIT_SHARD_ROWS 1024
+#define RATE_LIMIT_PROBE 8
+
+typedef enum {
+  RATE_LIMIT_READ,
+  RATE_LIMIT_WRITE,
+} RateLimitBudget;
+
+// Until this is called every request is allowed (the benches rely on it).
+void rate_limit_init(void);
+
+// Takes one request from addr's budget. Returns 1 if allowed; otherwise 0,
+// with the seconds until the next token in *retry_after.
+int rate_limit_allow(struct in_addr addr, RateLimitBudget budget,
+                     int *retry_after);
+
+#endif
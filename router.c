@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+
+// Literal children sit in an open-addressed table keyed by segment, so
+// picking the next node costs one hash of the segment, not a scan of the
+// siblings.
+struct RouteNode {
+  char *segment; // NULL for the root
+  int segment_len;
+  unsigned hash;
+  char *param_name; // set on a ":name" node instead of segment
+  RouteNode **children; // child_cap slots, NULL when empty
+  int child_count;
+  int child_cap;
+  RouteNode *param_child;
+  RouteHandler handlers[HTTP_METHOD_COUNT];
+  unsigned methods; // bit (1 << method) per handler, and HEAD with GET
+};
+
+static const char *method_names[HTTP_METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS",
+};
+
+HttpMethod http_method_parse(const char *method, int method_len) {
+  for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+    if ((int)strlen(method_names[m]) == method_len &&
+        !memcmp(method_names[m], method, method_len))
+      return m;
+  }
+  return HTTP_METHOD_UNKNOWN;
+}
+
+const char *http_method_name(HttpMethod method) {
+  return method < HTTP_METHOD_COUNT ? method_names[method] : "";
+}
+
+static RouteNode *route_node_new(void) { return calloc(1, sizeof(RouteNode)); }
+
+void router_init(Router *router) { router->root = route_node_new(); }
+
+// FNV-1a
+static unsigned hash_segment(const char *segment, int segment_len) {
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < segment_len; i++) {
+    hash ^= (unsigned char)segment[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static RouteNode *literal_child(RouteNode *node, const char *segment,
+                                int segment_len) {
+  if (!node->child_count)
+    return NULL;
+
+  unsigned hash = hash_segment(segment, segment_len);
+  int mask = node->child_cap - 1;
+  for (int i = hash & mask;; i = (i + 1) & mask) {
+    RouteNode *child = node->children[i];
+    if (!child)
+      return NULL;
+    if (child->hash == hash && child->segment_len == segment_len &&
+        !memcmp(child->segment, segment, segment_len))
+      return child;
+  }
+}
+
+static void insert_child(RouteNode *node, RouteNode *child) {
+  // at most half full, so probes stay short and always hit an empty slot
+  if ((node->child_count + 1) * 2 > node->child_cap) {
+    RouteNode **old = node->children;
+    int old_cap = node->child_cap;
+    node->child_cap = old_cap ? old_cap * 2 : 4;
+    node->children = calloc(node->child_cap, sizeof(RouteNode *));
+    node->child_count = 0;
+    for (int i = 0; i < old_cap; i++) {
+      if (old[i])
+        insert_child(node, old[i]);
+    }
+    free(old);
+  }
+
+  int i = child->hash & (node->child_cap - 1);
+  while (node->children[i])
+    i = (i + 1) & (node->child_cap - 1);
+  node->children[i] = child;
+  node->child_count++;
+}
+
+int router_add(Router *router, HttpMethod method, const char *pattern,
+               RouteHandler handler) {
+  if (pattern[0] != '/' || method >= HTTP_METHOD_COUNT)
+    return FAIL;
+
+  RouteNode *node = router->root;
+  int param_count = 0;
+  const char *segment = pattern + 1;
+
+  // "/" is the root itself; every other pattern is one node per segment
+  while (*segment) {
+    int segment_len = strcspn(segment, "/");
+    if (segment_len == 0)
+      return FAIL; // "//"
+
+    if (segment[0] == ':') {
+      if (++param_count > ROUTER_MAX_PARAMS || segment_len == 1)
+        return FAIL;
+      if (!node->param_child) {
+        node->param_child = route_node_new();
+        node->param_child->param_name = strndup(segment + 1, segment_len - 1);
+      } else if ((int)strlen(node->param_child->param_name) !=
+                     segment_len - 1 ||
+                 memcmp(node->param_child->param_name, segment + 1,
+                        segment_len - 1)) {
+        return FAIL; // one parameter name per position
+      }
+      node = node->param_child;
+    } else {
+      RouteNode *child = literal_child(node, segment, segment_len);
+      if (!child) {
+        child = route_node_new();
+        child->segment = strndup(segment, segment_len);
+        child->segment_len = segment_len;
+        child->hash = hash_segment(segment, segment_len);
+        insert_child(node, child);
+      }
+      node = child;
+    }
+
+    segment += segment_len;
+    if (*segment == '/')
+      segment++;
+  }
+
+  node->handlers[method] = handler;
+  node->methods |= 1u << method;
+  if (method == HTTP_GET)
+    node->methods |= 1u << HTTP_HEAD;
+  return SUCCESS;
+}
+
+// HEAD is GET without the body, so a GET handler answers it too
+static RouteHandler node_handler(const RouteNode *node, HttpMethod method) {
+  if (method >= HTTP_METHOD_COUNT)
+    return NULL;
+  if (node->handlers[method])
+    return node->handlers[method];
+  return method == HTTP_HEAD ? node->handlers[HTTP_GET] : NULL;
+}
+
+// Finds the node for path that has a handler for method, preferring
+// literal segments and backing off to a parameter where the literal branch
+// leads nowhere. So "/publish" can be POST-only while GET /publish still
+// falls through to "/:page". Every node the path reaches adds its methods
+// to *methods on the way, so when nothing matches the one walk has also
+// found what the path does take.
+static RouteNode *match_node(RouteNode *node, HttpMethod method,
+                             const char *path, int path_len,
+                             RouteParams *params, unsigned *methods) {
+  // a node that is only a prefix of longer routes has no handlers
+  if (path_len == 0) {
+    *methods |= node->methods;
+    return node_handler(node, method) ? node : NULL;
+  }
+
+  // path points just past a '/'
+  int segment_len = 0;
+  while (segment_len < path_len && path[segment_len] != '/')
+    segment_len++;
+  if (segment_len == 0)
+    return NULL;
+
+  int rest = segment_len < path_len ? segment_len + 1 : segment_len;
+
+  RouteNode *child = literal_child(node, path, segment_len);
+  if (child) {
+    RouteNode *found =
+        match_node(child, method, path + rest, path_len - rest, params,
+                   methods);
+    if (found)
+      return found;
+  }
+
+  if (node->param_child && params->count < ROUTER_MAX_PARAMS) {
+    RouteParam *param = &params->params[params->count++];
+    param->name = node->param_child->param_name;
+    param->value = path;
+    param->value_len = segment_len;
+    RouteNode *found = match_node(node->param_child, method, path + rest,
+                                  path_len - rest, params, methods);
+    if (found)
+      return found;
+    params->count--;
+  }
+  return NULL;
+}
+
+int router_match(Router *router, HttpMethod method, const char *path,
+                 int path_len, RouteHandler *handler, RouteParams *params,
+                 unsigned *allowed) {
+  params->count = 0;
+  if (path_len == 0 || path[0] != '/')
+    return ROUTE_NOT_FOUND;
+
+  unsigned methods = 0;
+  RouteNode *node = match_node(router->root, method, path + 1, path_len - 1,
+                               params, &methods);
+  if (node) {
+    *handler = node_handler(node, method);
+    return ROUTE_FOUND;
+  }
+
+  params->count = 0;
+  *allowed = methods;
+  return methods ? ROUTE_METHOD_NOT_ALLOWED : ROUTE_NOT_FOUND;
+}
+
+const char *route_param(const RouteParams *params, const char *name,
+                        int *value_len) {
+  for (int i = 0; i < params->count; i++) {
+    if (!strcmp(params->params[i].name, name)) {
+      *value_len = params->params[i].value_len;
+      return params->params[i].value;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "Client.h"
+
+// Maps a method and path to a handler through a trie of path segments, so
+// a lookup costs one walk down the path however many routes there are.
+// Patterns are literal segments and ":name" parameters, e.g. "/post/:id";
+// a literal segment wins over a parameter at the same position.
+
+#define ROUTER_MAX_PARAMS 4
+
+typedef enum {
+  HTTP_GET,
+  HTTP_HEAD,
+  HTTP_POST,
+  HTTP_PUT,
+  HTTP_DELETE,
+  HTTP_PATCH,
+  HTTP_OPTIONS,
+  HTTP_METHOD_COUNT,
+  HTTP_METHOD_UNKNOWN = HTTP_METHOD_COUNT,
+} HttpMethod;
+
+typedef struct {
+  const char *name;
+  const char *value; // points into the path; not NUL terminated
+  int value_len;
+} RouteParam;
+
+typedef struct {
+  RouteParam params[ROUTER_MAX_PARAMS];
+  int count;
+} RouteParams;
+
+typedef int (*RouteHandler)(Client *cl, char *request,
+                            const RouteParams *params);
+
+typedef struct RouteNode RouteNode;
+
+typedef struct {
+  RouteNode *root;
+} Router;
+
+// router_match() results
+#define ROUTE_FOUND 0
+#define ROUTE_NOT_FOUND 1
+#define ROUTE_METHOD_NOT_ALLOWED 2
+
+HttpMethod http_method_parse(const char *method, int method_len);
+const char *http_method_name(HttpMethod method);
+
+void router_init(Router *router);
+// Returns FAIL for a malformed pattern or too many parameters.
+int router_add(Router *router, HttpMethod method, const char *pattern,
+               RouteHandler handler);
+
+// path is everything up to (not including) the query string. On
+// ROUTE_FOUND, *handler and *params are set; HEAD finds the GET handler
+// where there is no HEAD one, and it is up to the caller to leave out the
+// body. On ROUTE_METHOD_NOT_ALLOWED, *allowed has bit (1 << method) set
+// for each method the path does take.
+int router_match(Router *router, HttpMethod method, const char *path,
+                 int path_len, RouteHandler *handler, RouteParams *params,
+                 unsigned *allowed);
+
+// The value of the parameter called name, or NULL; *value_len is set.
+const char *route_param(const RouteParams *params, const char *name,
+                        int *value_len);
+
+#endif
@@ -0,0 +1,2241 @@
+#define _GNU_SOURCE // strptime, timegm
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "body_cache.h"
+#include "cache_policy.h"
+#include "feed.h"
+#include "http2.h"
+#include "json_writer.h"
+#include "placement.h"
+#include "post_export.h"
+#include "post_import.h"
+#include "post_snapshot.h"
+#include "rate_limit.h"
+#include "router.h"
+#include "server.h"
+
+int debug = 1;
+DBConnection db;
+unsigned long index_generation = 0;
+long max_upload_length = MAX_UPLOAD_LENGTH;
+// BLOG_ADMIN_TOKEN; empty keeps /admin/ closed
+static char admin_token[ADMIN_TOKEN_MAX_LENGTH + 1];
+
+BodyCache static_cache;
+// one per NUMA node (see placement.h), each read by that node's threads
+static BodyCache post_caches[PLACEMENT_MAX_NODES];
+BodyCache index_cache;
+BodyCache user_cache;
+
+// Bumped when an author publishes; their /user/ pages' ETags derive from
+// it. Authors share a counter when their names hash alike, which only
+// costs a needless re-render.
+static unsigned long author_generations[AUTHOR_GENERATION_SLOTS];
+
+// posts archived by main --snapshot, mapped for the life of the process
+static PostSnapshot post_snapshot;
+
+int load_server_settings(void) {
+  if (feed_load_settings() == FAIL)
+    return FAIL;
+
+  const char *token = getenv("BLOG_ADMIN_TOKEN");
+  if (token && strlen(token) > ADMIN_TOKEN_MAX_LENGTH) {
+    fprintf(stderr, "BLOG_ADMIN_TOKEN is longer than %d bytes\n",
+            ADMIN_TOKEN_MAX_LENGTH);
+    return FAIL;
+  }
+  if (token)
+    strcpy(admin_token, token);
+
+  const char *value = getenv("BLOG_MAX_UPLOAD_LENGTH");
+  if (value) {
+    // one post's content has to fit in a row
+    long limit = sqlite3_limit(db.db, SQLITE_LIMIT_LENGTH, -1);
+    char *end;
+    errno = 0;
+    max_upload_length = strtol(value, &end, 10);
+    if (errno || end == value || *end || max_upload_length <= 0 ||
+        max_upload_length > limit) {
+      fprintf(stderr, "BLOG_MAX_UPLOAD_LENGTH must be 1 to %ld bytes, not "
+              "\"%s\"\n", limit, value);
+      return FAIL;
+    }
+  }
+  return SUCCESS;
+}
+
+void init_response_caches(void) {
+  body_cache_init(&static_cache, STATIC_CACHE_SLOTS);
+  for (int node = 0; node < placement_node_count(); node++)
+    body_cache_init(&post_caches[node], POST_CACHE_SLOTS);
+  body_cache_init(&index_cache, 1); // only "posts" lives here
+  body_cache_init(&user_cache, USER_CACHE_SLOTS);
+  feed_init();
+  // as for index_generation: a restart does not reuse an older version
+  for (int i = 0; i < AUTHOR_GENERATION_SLOTS; i++)
+    author_generations[i] = index_generation;
+
+  if (post_snapshot_open(&post_snapshot, SNAPSHOT_PATH) == SUCCESS && debug)
+    fprintf(stderr, "serving posts %d to %d from %s\n",
+            post_snapshot.header->first_id, post_snapshot.header->last_id,
+            SNAPSHOT_PATH);
+}
+
+static unsigned long *author_generation(const char *user, int user_len) {
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < user_len; i++)
+    hash = (hash ^ (unsigned char)user[i]) * 16777619u;
+  return &author_generations[hash % AUTHOR_GENERATION_SLOTS];
+}
+
+// after an import, which may have touched anyone
+static void invalidate_all_authors(void) {
+  for (int i = 0; i < AUTHOR_GENERATION_SLOTS; i++)
+    __atomic_add_fetch(&author_generations[i], 1, __ATOMIC_RELEASE);
+}
+
+TimerWheel connection_timers;
+
+static void *connection_timers_threadfunc(void *unused) {
+  struct timespec last;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+
+  while (1) {
+    struct timespec tick = {0, TIMER_TICK_MS * 1000000L};
+    nanosleep(&tick, NULL);
+
+    // count whole ticks from the clock, so oversleeping never loses time
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last.tv_sec) * 1000 +
+                      (now.tv_nsec - last.tv_nsec) / 1000000;
+    long ticks = elapsed_ms / TIMER_TICK_MS;
+    if (ticks <= 0)
+      continue;
+
+    long advanced_ns = ticks * TIMER_TICK_MS * 1000000L;
+    last.tv_sec += advanced_ns / 1000000000L;
+    last.tv_nsec += advanced_ns % 1000000000L;
+    if (last.tv_nsec >= 1000000000L) {
+      last.tv_sec++;
+      last.tv_nsec -= 1000000000L;
+    }
+
+    timer_wheel_advance(&connection_timers, ticks);
+  }
+  return NULL;
+}
+
+int start_connection_timers(void) {
+  timer_wheel_init(&connection_timers);
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, connection_timers_threadfunc, NULL) != 0) {
+    perror("pthread_create");
+    return FAIL;
+  }
+  pthread_detach(thread);
+  return SUCCESS;
+}
+
+// Runs on the timer thread with the wheel locked. Shutting the socket
+// down wakes the client's thread from read() with EOF, and it cleans up
+// as for any closed connection.
+static void client_timed_out(void *arg) {
+  Client *client = arg;
+  if (debug)
+    fprintf(stderr, "client %d timed out (phase %d) - shutting down\n",
+            client_id(client),
+            __atomic_load_n(&client->timeout_phase, __ATOMIC_RELAXED));
+  shutdown(client->socket_fd, SHUT_RDWR);
+}
+
+// whether the input holds a whole request head, or a streamed body is
+// being read
+static int client_request_framed(Client *client) {
+  return client->upload || client->import ||
+         (!client->h2 && client->input_len > 0 &&
+          http_request_head_length(client->input, client->input_len) > 0);
+}
+
+// Picks the deadline for what the client owes us next.
+static void arm_client_timeout(Client *client) {
+  int phase = TIMEOUT_PHASE_IDLE;
+  if (client_request_framed(client))
+    phase = TIMEOUT_PHASE_BODY;
+  else if (!client->h2 && client->input_len > 0)
+    phase = TIMEOUT_PHASE_HEADER;
+
+  // a head sent a byte at a time must not keep pushing its deadline out
+  if (phase == TIMEOUT_PHASE_HEADER &&
+      client->timeout_phase == TIMEOUT_PHASE_HEADER &&
+      timer_is_armed(&connection_timers, &client->timeout))
+    return;
+
+  int timeout_ms = phase == TIMEOUT_PHASE_BODY     ? BODY_READ_TIMEOUT_MS
+                   : phase == TIMEOUT_PHASE_HEADER ? HEADER_TIMEOUT_MS
+                                                   : IDLE_TIMEOUT_MS;
+  __atomic_store_n(&client->timeout_phase, phase, __ATOMIC_RELAXED);
+  timer_arm(&connection_timers, &client->timeout, timeout_ms / TIMER_TICK_MS,
+            client_timed_out, client);
+}
+
+//// draining
+
+// Set by request_drain() (possibly from a signal handler): the accept loop
+// stops and every connection closes once its current request is answered.
+volatile sig_atomic_t draining = 0;
+static int drain_pipe[2] = {-1, -1};
+
+// Every connection with a thread, so draining can wake the idle ones.
+static pthread_mutex_t live_clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t live_clients_changed = PTHREAD_COND_INITIALIZER;
+static Client *live_clients[MAX_CONNECTIONS];
+static int live_client_count = 0;
+
+static void add_live_client(Client *client) {
+  pthread_mutex_lock(&live_clients_lock);
+  client->live_index = live_client_count;
+  live_clients[live_client_count++] = client;
+  pthread_mutex_unlock(&live_clients_lock);
+}
+
+static void remove_live_client(Client *client) {
+  pthread_mutex_lock(&live_clients_lock);
+  Client *last = live_clients[--live_client_count];
+  live_clients[client->live_index] = last;
+  last->live_index = client->live_index;
+  pthread_cond_broadcast(&live_clients_changed);
+  pthread_mutex_unlock(&live_clients_lock);
+}
+
+void request_drain(void) {
+  // only async-signal-safe calls here
+  draining = 1;
+  if (drain_pipe[1] >= 0) {
+    char byte = 'D';
+    ssize_t ignored = write(drain_pipe[1], &byte, 1);
+    (void)ignored;
+  }
+}
+
+static void drain_signal_handler(int signal_number) { request_drain(); }
+
+int install_drain_handler(void) {
+  if (pipe(drain_pipe) < 0) {
+    perror("pipe");
+    return FAIL;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = drain_signal_handler;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGTERM, &action, NULL) < 0) {
+    perror("sigaction");
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+int drain_connections(int timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&live_clients_lock);
+  if (debug)
+    fprintf(stderr, "draining %d connections\n", live_client_count);
+
+  // connections waiting for their next request have nothing in flight;
+  // EOF on their read() closes them now. Busy ones close themselves after
+  // their response.
+  for (int i = 0; i < live_client_count; i++) {
+    Client *client = live_clients[i];
+    // its own thread moves it between phases as we look
+    if (__atomic_load_n(&client->timeout_phase, __ATOMIC_RELAXED) ==
+        TIMEOUT_PHASE_IDLE)
+      shutdown(client->socket_fd, SHUT_RD);
+  }
+
+  int result = SUCCESS;
+  while (live_client_count > 0) {
+    if (pthread_cond_timedwait(&live_clients_changed, &live_clients_lock,
+                               &deadline) != 0) {
+      fprintf(stderr, "drain timed out with %d connections open\n",
+              live_client_count);
+      result = FAIL;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&live_clients_lock);
+  return result;
+}
+
+// Has this connection answered everything it was sent?
+static int client_is_between_requests(Client *client) {
+  if (client->h2)
+    return client->h2->stream_count == 0 && client->input_len == 0;
+  return client->input_len == 0 && !client->upload && !client->import;
+}
+
+static void drop_client(Client *client) {
+  // after this the timer callback cannot touch the client any more
+  timer_cancel(&connection_timers, &client->timeout);
+  remove_live_client(client);
+  admission_release(client->address.sin_addr);
+  client_free(client);
+}
+
+// Takes the Client*.
+void *single_client_handler_threadfunc(void *);
+
+// returns FAIL for failure, otherwise the fd to accept on
+int establish_listening_socket(int port_to_listen) {
+  int new_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (new_socket_fd == -1) {
+    perror("Could not create socket");
+    return FAIL;
+  }
+  if (debug)
+    fprintf(stderr, "accept socket fd is %d\n", new_socket_fd);
+
+  // a restart must not wait out the previous process's TIME_WAIT sockets
+  int reuse = 1;
+  setsockopt(new_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // We are going to listen on any address, the specified port
+  struct sockaddr_in our_address;
+  our_address.sin_family = AF_INET;
+  our_address.sin_addr.s_addr = INADDR_ANY;
+  our_address.sin_port = htons(port_to_listen);
+
+  // Bind our socket to the given address
+  if (bind(new_socket_fd, (struct sockaddr *)&our_address,
+           sizeof(our_address)) < 0) {
+    perror("bind failed");
+    close(new_socket_fd);
+    return FAIL;
+  }
+  if (debug)
+    fprintf(stderr, "bind done on port %d\n", port_to_listen);
+
+  // establish that we are expecting incoming connections
+  int result = listen(new_socket_fd, PENDING_CONNECTIONS_QUEUE_LENGTH);
+  if (result == -1) {
+    perror("listen failed");
+    return FAIL;
+  }
+
+  return new_socket_fd;
+}
+
+int accept_a_client(int listen_socket, Client **new_client_ptr) {
+  struct sockaddr_in client_addr;
+  // we must use a variable because accept() writes to it
+  socklen_t sock_len = sizeof(client_addr);
+
+  if (debug)
+    fprintf(stderr, "accepting a connection on fd %d\n", listen_socket);
+
+  *new_client_ptr = NULL;
+
+  // block until a connection arrives or a drain is requested
+  struct pollfd waiting[2] = {{listen_socket, POLLIN, 0},
+                              {drain_pipe[0], POLLIN, 0}};
+  int ready = poll(waiting, drain_pipe[0] >= 0 ? 2 : 1, -1);
+  if (draining) {
+    if (debug)
+      fprintf(stderr, "draining - no longer accepting on fd %d\n",
+              listen_socket);
+    return FAIL;
+  }
+  if (ready < 0 || !(waiting[0].revents & POLLIN))
+    return SUCCESS; // interrupted; go round again
+
+  int new_socket_fd =
+      accept(listen_socket, (struct sockaddr *)&client_addr, &sock_len);
+  if (new_socket_fd < 0) {
+    perror("accept failed");
+    if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+        errno == ENOMEM) {
+      // out of descriptors or memory: back off and let connections finish
+      // rather than stop serving altogether
+      usleep(ACCEPT_BACKOFF_MS * 1000);
+      return SUCCESS;
+    }
+    if (errno == EINTR || errno == ECONNABORTED)
+      return SUCCESS;
+    return FAIL;
+  }
+  if (debug)
+    fprintf(stderr, "Connection accepted. client fd is %d\n", new_socket_fd);
+
+  if (!admission_acquire(client_addr.sin_addr)) {
+    if (debug)
+      fprintf(stderr, "shedding connection from %s (fd %d)\n",
+              inet_ntoa(client_addr.sin_addr), new_socket_fd);
+    admission_shed(new_socket_fd);
+    return SUCCESS;
+  }
+
+  // a client that stops reading makes writev() fail instead of block
+  struct timeval write_timeout = {WRITE_TIMEOUT_MS / 1000,
+                                  (WRITE_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(new_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &write_timeout,
+             sizeof(write_timeout));
+
+  Client *cl = client_new_on_cpu(new_socket_fd, &client_addr,
+                                placement_next_network_cpu());
+  *new_client_ptr = cl;
+  return SUCCESS;
+}
+
+int close_down_listening(int listening_socket) {
+  if (debug)
+    fprintf(stderr, "closing socket fd %d\n", listening_socket);
+
+  close(listening_socket);
+
+  return SUCCESS;
+}
+
+// returns FAIL for error, 1 for success
+int handle_new_client_wrapper(Client *cl) {
+  pthread_t client_handler_thread;
+
+  // nobody joins client threads, so let them release their stacks on exit
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  placement_thread_attr(&attributes, cl->cpu);
+
+  add_live_client(cl);
+  int result =
+      pthread_create(&client_handler_thread, &attributes,
+                     single_client_handler_threadfunc, (void *)cl);
+  pthread_attr_destroy(&attributes);
+  if (result != 0) {
+    // out of threads: turn this one away and keep serving the rest
+    fprintf(stderr, "pthread_create: %s\n", strerror(result));
+    remove_live_client(cl);
+    admission_release(cl->address.sin_addr);
+    admission_shed(cl->socket_fd);
+    cl->socket_fd = 0; // already closed
+    client_free(cl);
+    return SUCCESS;
+  }
+
+  if (debug)
+    fprintf(stderr, "Client handling thread is %lu\n", client_handler_thread);
+
+  return SUCCESS;
+}
+
+// The client is freed (recycled) by this handler
+void *single_client_handler_threadfunc(void *payload_ptr) {
+  Client *client = payload_ptr;
+  placement_thread_start(client->cpu);
+
+  int client_index = client_id(client);
+  int result = handle_new_client_guts(client);
+
+  if (debug)
+    fprintf(stderr, "handle_new_client_guts (id %d) returned %d\n",
+            client_index, result);
+
+  return NULL;
+}
+
+int handle_new_client_guts(Client *client) {
+  // the first request is due as soon as the connection opens
+  __atomic_store_n(&client->timeout_phase, TIMEOUT_PHASE_HEADER,
+                   __ATOMIC_RELAXED);
+  timer_arm(&connection_timers, &client->timeout,
+            HEADER_TIMEOUT_MS / TIMER_TICK_MS, client_timed_out, client);
+
+  while (1) {
+    int amount_read = client_read_input(client, MAX_MESSAGE_LENGTH);
+
+    if (amount_read < 0) {
+      fprintf(stderr, "client %d read failed - closing, returning",
+              client_id(client));
+      drop_client(client);
+      return FAIL;
+    }
+
+    if (amount_read == 0) {
+      fprintf(stderr, "client %d closed socket - closing, returning\n",
+              client_id(client));
+      drop_client(client);
+      return SUCCESS;
+    }
+
+    if (debug)
+      fprintf(stderr, "Read %d bytes...\n", amount_read);
+
+    // A response may take longer than any read deadline (a long /posts,
+    // an export, a backup); WRITE_TIMEOUT_MS bounds each write instead.
+    // Any h2 frame may open a stream.
+    if (client->h2 || client_request_framed(client)) {
+      __atomic_store_n(&client->timeout_phase, TIMEOUT_PHASE_RESPONSE,
+                       __ATOMIC_RELAXED);
+      timer_cancel(&connection_timers, &client->timeout);
+    }
+
+    int result = SUCCESS;
+    if (!client->h2)
+      result = handle_http1_input(client);
+    if (result != FAIL && client->h2)
+      result = h2_handle_input(client);
+
+    if (client_flush(client) == FAIL)
+      result = FAIL;
+    client_end_request(client);
+
+    arm_client_timeout(client);
+
+    if (result == FAIL) {
+      fprintf(stderr, "client %d response failed - closing, returning",
+              client_id(client));
+      drop_client(client);
+      return FAIL;
+    }
+
+    if (draining && client_is_between_requests(client)) {
+      if (debug)
+        fprintf(stderr, "client %d answered - closing for drain\n",
+                client_id(client));
+      drop_client(client);
+      return SUCCESS;
+    }
+  }
+}
+
+// Does the request line start with this method and path (and no more of a
+// path)?
+static int request_line_is(const char *request, const char *method_path) {
+  int len = strlen(method_path);
+  return !strncmp(request, method_path, len) &&
+         (request[len] == ' ' || request[len] == '?');
+}
+
+// whether a read would return without waiting
+static int socket_has_input(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) > 0;
+}
+
+// A pipelining client may have sent several requests in one segment.
+// Answer every complete one; the caller sends all the responses in one
+// writev. Stops early once the connection switches to HTTP/2.
+int handle_http1_input(Client *client) {
+  int result = SUCCESS;
+  int consumed = 0;
+  int request_len = 0;
+
+  while (result != FAIL && !client->h2) {
+    char *request = client->input + consumed;
+    int available = client->input_len - consumed;
+
+    if (client->upload) {
+      // body of a streamed POST /publish: hand over what has arrived
+      long remaining = client->upload->body_remaining;
+      int fed = available < remaining ? available : remaining;
+      if (fed > 0)
+        blog_post_upload_feed(client->upload, request, fed); // finish reports failure
+      consumed += fed;
+      if (client->upload->body_remaining > 0)
+        break;
+      result = finish_publish_upload(client);
+      continue;
+    }
+
+    if (client->import) {
+      // body of a streamed POST /api/import, likewise
+      long remaining = client->import->body_remaining;
+      int fed = available < remaining ? available : remaining;
+      // rows are inserted as they are parsed; see placement.h
+      placement_enter_writer();
+      int fed_ok = fed == 0 || post_import_feed(client->import, request, fed);
+      client->import->body_remaining -= fed;
+      consumed += fed;
+      // the batch must not keep other writers waiting on a slow client
+      if (fed_ok != FAIL && client->import->body_remaining > 0 &&
+          !socket_has_input(client->socket_fd))
+        fed_ok = post_import_commit(client->import);
+      placement_leave_writer();
+      if (fed_ok == FAIL) {
+        // the database gave up; answer now rather than read the rest
+        finish_post_import(client);
+        result = FAIL;
+        break;
+      }
+      if (client->import->body_remaining > 0)
+        break;
+      result = finish_post_import(client);
+      continue;
+    }
+
+    // h2c with prior knowledge; wait for the whole preface first
+    int preface = h2_preface_match(request, available);
+    if (preface == 1)
+      h2_start(client);
+    if (preface != 0)
+      break;
+
+    int head_len = http_request_head_length(request, available);
+    if (head_len <= 0) {
+      request_len = head_len;
+      break;
+    }
+
+    long content_length = http_request_content_length(request, head_len);
+    int import = request_line_is(request, "POST /api/import");
+    int streamed = import || request_line_is(request, "POST /publish");
+    if (content_length < 0) {
+      request_len = -1;
+      break;
+    }
+    if (content_length > (streamed ? max_upload_length : MAX_MESSAGE_LENGTH)) {
+      // refuse before the client sends (or we buffer) any of the body
+      send_payload_too_large(client);
+      result = FAIL;
+      break;
+    }
+
+    int retry_after;
+    if (streamed && !rate_limit_allow(client->address.sin_addr,
+                                      RATE_LIMIT_WRITE, &retry_after)) {
+      // the body is still on its way; answer and hang up instead of
+      // reading it
+      send_too_many_requests(client, retry_after);
+      result = FAIL;
+      break;
+    }
+
+    if (streamed) {
+      result = import ? start_post_import(client, request, head_len,
+                                          content_length)
+                      : start_publish_upload(client, request, head_len,
+                                             content_length);
+      consumed += head_len;
+      continue;
+    }
+
+    request_len = head_len + content_length;
+    if (request_len > available) {
+      request_len = 0;
+      break;
+    }
+
+    char next_request_start = request[request_len];
+    request[request_len] = '\0';
+
+    if (debug)
+      fprintf(stderr,
+              "client sent request (%d bytes): \n"
+              "---\n"
+              "%s\n"
+              "---\n",
+              request_len, request);
+
+    char *requestBody = request;
+    while (requestBody[0] && strncmp(requestBody, "\r\n\r\n", 4)) {
+      requestBody++;
+    }
+    if (requestBody[0])
+      requestBody += strlen("\r\n\r\n");
+
+    if (debug)
+      fprintf(stderr, "Request body is: '%s'\n", requestBody);
+
+    if (h2_is_upgrade_request(request))
+      result = h2_upgrade(client, request, requestBody);
+    else
+      result = respond_to_http_request(client, request, requestBody);
+    request[request_len] = next_request_start;
+    consumed += request_len;
+  }
+  client_consume_input(client, consumed);
+
+  if (!client->h2 && result != FAIL &&
+      (request_len < 0 || client->input_len == MAX_MESSAGE_LENGTH)) {
+    // malformed framing, or a head larger than we will buffer
+    send_error_response(client);
+    result = FAIL;
+  }
+
+  return result;
+}
+
+static int continue_if_expected(Client *cl, char *request,
+                                long content_length) {
+  char expect[32];
+  if (content_length > 0 &&
+      http_request_header(request, "Expect", expect, sizeof(expect)) &&
+      !strcasecmp(expect, "100-continue"))
+    return client_queue_string(cl, "HTTP/1.1 100 Continue\r\n\r\n");
+  return SUCCESS;
+}
+
+// A publish body is parsed and spooled as it arrives (see BlogPostUpload),
+// so it is never buffered whole and may be larger than MAX_MESSAGE_LENGTH.
+int start_publish_upload(Client *cl, char *request, int head_len,
+                         long content_length) {
+  if (debug)
+    fprintf(stderr, "client sent publish head (%d bytes), streaming %ld "
+            "body bytes\n", head_len, content_length);
+
+  cl->upload = malloc(sizeof(BlogPostUpload));
+  blog_post_upload_begin(cl->upload, &db, content_length); // finish reports failure
+
+  return continue_if_expected(cl, request, content_length);
+}
+
+int finish_publish_upload(Client *cl) {
+  BlogPostUpload *upload = cl->upload;
+  cl->upload = NULL;
+
+  // the rows go in here, in one transaction; see placement.h
+  placement_enter_writer();
+  int failed = blog_post_upload_finish(upload);
+  placement_leave_writer();
+  if (failed) {
+    if (debug)
+      fprintf(stderr, "Error inserting post: %s\n",
+              upload->conn.errmsg ? upload->conn.errmsg : "unknown");
+    free(upload->conn.errmsg);
+    free(upload);
+    return send_http_response(cl, "Could not publish post\n");
+  }
+  // invalidates every cached copy of /posts, and of this author's pages
+  __atomic_add_fetch(&index_generation, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(author_generation(upload->user, upload->user_len), 1,
+                     __ATOMIC_RELEASE);
+  feed_add_post(upload->post_id, upload->user, upload->user_len,
+                upload->title, upload->title_len);
+  free(upload);
+
+  return send_http_response(cl, "<html><h1>Blog Posted!</h1>\n\n<a href=\"index\">Click to go back</a></html>\n");
+}
+
+// Import bodies are parsed and inserted as they arrive too (see
+// post_import.h), in batches on a connection of their own.
+int start_post_import(Client *cl, char *request, int head_len,
+                      long content_length) {
+  if (debug)
+    fprintf(stderr, "client sent import head (%d bytes), streaming %ld "
+            "body bytes\n", head_len, content_length);
+
+  PostImport *import = malloc(sizeof(PostImport));
+  if (post_import_begin(import, &db) == FAIL) {
+    if (debug)
+      fprintf(stderr, "Error starting import: %s\n",
+              import->rows.conn.errmsg ? import->rows.conn.errmsg : "unknown");
+    free(import->rows.conn.errmsg);
+    free(import);
+    // the body is not read; hang up after answering
+    send_json_error(cl, 503, "import unavailable");
+    return FAIL;
+  }
+  import->body_remaining = content_length;
+  cl->import = import;
+
+  return continue_if_expected(cl, request, content_length);
+}
+
+int finish_post_import(Client *cl) {
+  PostImport *import = cl->import;
+  cl->import = NULL;
+
+  placement_enter_writer();
+  int result = post_import_finish(import);
+  placement_leave_writer();
+  double seconds = post_import_seconds(import);
+  long committed = import->rows.committed_rows;
+  if (result == FAIL && debug)
+    fprintf(stderr, "Error importing posts: %s\n",
+            import->rows.conn.errmsg ? import->rows.conn.errmsg : "unknown");
+
+  // one invalidation for the whole import rather than one per post
+  if (committed > 0) {
+    __atomic_add_fetch(&index_generation, 1, __ATOMIC_RELEASE);
+    invalidate_all_authors();
+    feed_reload(&db);
+  }
+
+  char body[MAX_GENERATED_LENGTH];
+  int body_len;
+  if (result == FAIL) {
+    // batches committed before the failure stay
+    body_len = snprintf(body, sizeof(body),
+                        "{\"error\":\"import failed\",\"imported\":%ld}\n",
+                        committed);
+  } else {
+    body_len = snprintf(body, sizeof(body),
+                        "{\"imported\":%ld,\"skipped\":%ld,"
+                        "\"milliseconds\":%ld,\"rows_per_second\":%ld}\n",
+                        import->imported, import->skipped,
+                        (long)(seconds * 1000),
+                        seconds > 0 ? (long)(import->imported / seconds) : 0);
+  }
+  free(import->rows.conn.errmsg);
+  free(import);
+
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_typed(cl, result == FAIL ? 500 : 200,
+                                  "application/json", cache_control, body,
+                                  body_len);
+}
+
+int send_too_many_requests(Client *cl, int retry_after) {
+  char *body = "Too many requests\n";
+  char headers[MAX_GENERATED_LENGTH];
+  int len = snprintf(headers, sizeof(headers), "Retry-After: %d\n",
+                     retry_after);
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, headers + len,
+                       sizeof(headers) - len);
+  return send_http_response_full(cl, 429, headers, body, strlen(body));
+}
+
+int send_payload_too_large(Client *cl) {
+  char *body = "Request body too large\n";
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_full(cl, 413, cache_control, body, strlen(body));
+}
+
+// Copies the value of the first header called name (case-insensitive) into
+// value. Returns 1 if the request has that header. value may be NULL to
+// just test for it.
+int http_request_header(const char *request, const char *name, char *value,
+                        int value_len) {
+  int name_len = strlen(name);
+
+  for (const char *line = strchr(request, '\n'); line;
+       line = strchr(line + 1, '\n')) {
+    if (line[1] == '\r' || line[1] == '\n' || line[1] == '\0')
+      return 0; // end of the head
+
+    if (strncasecmp(line + 1, name, name_len) || line[1 + name_len] != ':')
+      continue;
+
+    if (value) {
+      const char *start = line + 1 + name_len + 1;
+      while (*start == ' ' || *start == '\t')
+        start++;
+      int len = strcspn(start, "\r\n");
+      while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t'))
+        len--;
+      if (len >= value_len)
+        len = value_len - 1;
+      memcpy(value, start, len);
+      value[len] = '\0';
+    }
+    return 1;
+  }
+  return 0;
+}
+
+// The head ends at the first blank line. Bare "\n" line endings are
+// accepted too.
+int http_request_head_length(const char *buffer, int buffer_len) {
+  for (const char *line_end = strchr(buffer, '\n'); line_end;
+       line_end = strchr(line_end + 1, '\n')) {
+    if (line_end[1] == '\n')
+      return line_end + 2 - buffer;
+    if (line_end[1] == '\r' && line_end[2] == '\n')
+      return line_end + 3 - buffer;
+  }
+  return 0;
+}
+
+long http_request_content_length(const char *buffer, int head_len) {
+  const char *head_end = buffer + head_len;
+  for (const char *line = strchr(buffer, '\n'); line && line < head_end;
+       line = strchr(line + 1, '\n')) {
+    if (!strncasecmp(line + 1, "Content-Length:", strlen("Content-Length:"))) {
+      long content_length =
+          strtol(line + 1 + strlen("Content-Length:"), NULL, 10);
+      return content_length < 0 ? -1 : content_length;
+    }
+  }
+  return 0;
+}
+
+// The status line and headers of a response, in cl's request arena.
+// framing_header is the "Content-Length: n\n" or "Transfer-Encoding:
+// chunked\n" line, or "" for a 304, which has neither; extra_headers is
+// zero or more complete "Name: value\n" lines.
+static char *response_head(Client *cl, int status, const char *content_type,
+                           const char *framing_header,
+                           const char *extra_headers) {
+  const char *canned_msg___fmt = "HTTP/1.1 %d\n"
+                                 "Content-type: %s\n"
+                                 "%s"
+                                 "Connection: %s\n"
+                                 "%s"
+                                 "\n";
+  // a draining server closes each connection after its response
+  const char *connection = draining ? "close" : "Keep-Alive";
+
+  // 10 = space for formatted %d
+  int response_buffer_size = strlen(canned_msg___fmt) + 10 +
+                             strlen(content_type) + strlen(framing_header) +
+                             strlen(connection) + strlen(extra_headers);
+  char *response = arena_alloc(&cl->arena, response_buffer_size);
+
+  snprintf(response, response_buffer_size, canned_msg___fmt, status,
+           content_type, framing_header, connection, extra_headers);
+  return response;
+}
+
+int send_http_response_full(Client *cl, int status, const char *extra_headers,
+                            char *body, int body_len) {
+  return send_http_response_typed(cl, status, "text/html", extra_headers, body,
+                                  body_len);
+}
+
+int send_http_response_typed(Client *cl, int status, const char *content_type,
+                             const char *extra_headers, char *body,
+                             int body_len) {
+  char content_length[32] = "";
+  if (status != 304)
+    snprintf(content_length, sizeof(content_length), "Content-Length: %d\n",
+             body_len);
+
+  char *response =
+      response_head(cl, status, content_type, content_length, extra_headers);
+
+  if (cl->h2 && cl->h2->current_stream) {
+    return h2_send_response(cl, response, body, cl->head_only ? 0 : body_len);
+  }
+
+  int result = client_queue_string(cl, response);
+  if (result == FAIL) {
+    return FAIL;
+  }
+
+  if (cl->head_only)
+    return SUCCESS;
+  result = client_queue_buffer(cl, body, body_len);
+
+  return result;
+}
+
+// A 200 whose body is queued where it is (see client_queue_unowned), not
+// copied; h2 still copies it, since its frames go out as flow control
+// allows.
+static int send_http_response_unowned(Client *cl, const char *content_type,
+                                      const char *extra_headers,
+                                      const char *body, int body_len) {
+  char content_length[32];
+  snprintf(content_length, sizeof(content_length), "Content-Length: %d\n",
+           body_len);
+
+  char *response =
+      response_head(cl, 200, content_type, content_length, extra_headers);
+
+  if (cl->h2 && cl->h2->current_stream) {
+    return h2_send_response(cl, response, (char *)body,
+                            cl->head_only ? 0 : body_len);
+  }
+
+  if (client_queue_string(cl, response) == FAIL)
+    return FAIL;
+  if (cl->head_only)
+    return SUCCESS;
+  return client_queue_unowned(cl, body, body_len);
+}
+
+int send_chunked_response_head(Client *cl, int status,
+                               const char *content_type,
+                               const char *extra_headers) {
+  char *response = response_head(cl, status, content_type,
+                                 "Transfer-Encoding: chunked\n", extra_headers);
+  return client_queue_string(cl, response);
+}
+
+int send_chunk(Client *cl, char *data, int data_len) {
+  if (cl->head_only)
+    return SUCCESS;
+  char size_line[16];
+  snprintf(size_line, sizeof(size_line), "%x\r\n", data_len);
+
+  if (client_queue_string(cl, size_line) == FAIL ||
+      client_queue_buffer(cl, data, data_len) == FAIL ||
+      client_queue_string(cl, "\r\n") == FAIL)
+    return FAIL;
+  return SUCCESS;
+}
+
+int send_last_chunk(Client *cl) {
+  if (cl->head_only)
+    return SUCCESS;
+  return client_queue_string(cl, "0\r\n\r\n");
+}
+
+// for one-off messages (errors, publish results), which must not be cached
+int send_http_response_binary(Client *cl, char *body, int body_len) {
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_full(cl, 200, cache_control, body, body_len);
+}
+
+int send_not_modified(Client *cl, const char *headers) {
+  return send_http_response_full(cl, 304, headers, NULL, 0);
+}
+
+// The gzip variant of a representation needs its own strong ETag:
+// "post-1" becomes "post-1-gz".
+static void gzip_etag(const char *etag, char *out, int out_len) {
+  snprintf(out, out_len, "%.*s-gz\"", (int)strlen(etag) - 1, etag);
+}
+
+// If-None-Match holds "*" or a list of entity tags, possibly weak (W/).
+// The weak comparison applies, as RFC 7232 requires for this header.
+static int etag_list_matches(char *if_none_match, const char *etag) {
+  char *saveptr;
+  for (char *tag = strtok_r(if_none_match, ", ", &saveptr); tag;
+       tag = strtok_r(NULL, ", ", &saveptr)) {
+    if (!strncmp(tag, "W/", 2))
+      tag += 2;
+    if (!strcmp(tag, "*") || !strcmp(tag, etag))
+      return 1;
+  }
+  return 0;
+}
+
+int request_is_fresh(const char *request, const char *etag,
+                     time_t last_modified) {
+  char header[MAX_GENERATED_LENGTH];
+
+  // If-None-Match wins over If-Modified-Since when both are sent
+  if (http_request_header(request, "If-None-Match", header, sizeof(header))) {
+    char gzip_tag[MAX_GENERATED_LENGTH];
+    gzip_etag(etag, gzip_tag, sizeof(gzip_tag));
+
+    char if_none_match[MAX_GENERATED_LENGTH];
+    strcpy(if_none_match, header);
+    if (etag_list_matches(if_none_match, etag))
+      return FRESH;
+    if (etag_list_matches(header, gzip_tag))
+      return FRESH_GZIP;
+    return NOT_FRESH;
+  }
+
+  if (last_modified &&
+      http_request_header(request, "If-Modified-Since", header,
+                          sizeof(header))) {
+    struct tm since;
+    memset(&since, 0, sizeof(since));
+    if (strptime(header, "%a, %d %b %Y %H:%M:%S GMT", &since) &&
+        last_modified <= timegm(&since))
+      return FRESH;
+  }
+
+  return NOT_FRESH;
+}
+
+// Accept-Encoding lists codings with optional weights; "gzip;q=0" and
+// "*;q=0" refuse it.
+int request_accepts_gzip(const char *request) {
+  char header[MAX_GENERATED_LENGTH];
+  if (!http_request_header(request, "Accept-Encoding", header, sizeof(header)))
+    return 0;
+
+  int accepts = 0;
+  char *saveptr;
+  for (char *coding = strtok_r(header, ",", &saveptr); coding;
+       coding = strtok_r(NULL, ",", &saveptr)) {
+    while (*coding == ' ')
+      coding++;
+
+    char *params = strchr(coding, ';');
+    int name_len = params ? params - coding : (int)strcspn(coding, " ");
+    while (name_len > 0 && coding[name_len - 1] == ' ')
+      name_len--;
+
+    double quality = 1.0;
+    if (params) {
+      char *q = strstr(params, "q=");
+      if (q)
+        quality = strtod(q + 2, NULL);
+    }
+
+    if (name_len == 4 && !strncasecmp(coding, "gzip", 4))
+      return quality > 0;
+    if (name_len == 1 && coding[0] == '*')
+      accepts = quality > 0;
+  }
+  return accepts;
+}
+
+// ETag (per encoding), Last-Modified, Cache-Control and Vary lines for one
+// cacheable representation.
+static void representation_headers(char *out, int out_len, const char *etag,
+                                   int gzip, time_t last_modified,
+                                   CachePolicy policy, const char *file_path) {
+  char tag[MAX_GENERATED_LENGTH];
+  if (gzip)
+    gzip_etag(etag, tag, sizeof(tag));
+  else
+    snprintf(tag, sizeof(tag), "%s", etag);
+
+  char last_modified_line[128] = "";
+  if (last_modified) {
+    struct tm mtime;
+    gmtime_r(&last_modified, &mtime);
+    strftime(last_modified_line, sizeof(last_modified_line),
+             "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\n", &mtime);
+  }
+
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(policy, file_path, cache_control, sizeof(cache_control));
+
+  snprintf(out, out_len,
+           "ETag: %s\n"
+           "%s"
+           "%s"
+           "Vary: Accept-Encoding\n",
+           tag, last_modified_line, cache_control);
+}
+
+// 304 for a client that holds this version (in either encoding).
+static int send_fresh_response(Client *cl, int fresh, const char *etag,
+                               time_t last_modified, CachePolicy policy,
+                               const char *file_path) {
+  char headers[MAX_GENERATED_LENGTH * 4];
+  representation_headers(headers, sizeof(headers), etag, fresh == FRESH_GZIP,
+                         last_modified, policy, file_path);
+  return send_not_modified(cl, headers);
+}
+
+// 200 with the precompressed body if the client takes gzip. Releases entry.
+static int send_cached_body_typed(Client *cl, const char *request,
+                                  CachedBody *entry, const char *content_type,
+                                  time_t last_modified, CachePolicy policy,
+                                  const char *file_path) {
+  int gzip = entry->gzip_body && request_accepts_gzip(request);
+
+  char headers[MAX_GENERATED_LENGTH * 4];
+  representation_headers(headers, sizeof(headers), entry->etag, gzip,
+                         last_modified, policy, file_path);
+
+  int result;
+  if (gzip) {
+    strcat(headers, "Content-Encoding: gzip\n");
+    result = send_http_response_typed(cl, 200, content_type, headers,
+                                      entry->gzip_body, entry->gzip_len);
+  } else {
+    result = send_http_response_typed(cl, 200, content_type, headers,
+                                      entry->body, entry->body_len);
+  }
+
+  cached_body_release(entry);
+  return result;
+}
+
+// text/html
+static int send_cached_body(Client *cl, const char *request, CachedBody *entry,
+                            time_t last_modified, CachePolicy policy,
+                            const char *file_path) {
+  return send_cached_body_typed(cl, request, entry, "text/html",
+                                last_modified, policy, file_path);
+}
+
+int send_http_response(Client *cl, char *body) {
+  return send_http_response_binary(cl, body, strlen(body));
+}
+
+int send_error_response(Client *cl) {
+  return send_http_response(cl, "Invalid request.\n"
+                                "\n"
+                                "Not found.\n");
+}
+
+int send_json_error(Client *cl, int status, const char *message) {
+  char body[MAX_GENERATED_LENGTH];
+  // messages are ours and need no escaping
+  int body_len = snprintf(body, sizeof(body), "{\"error\":\"%s\"}\n", message);
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_typed(cl, status, "application/json",
+                                  cache_control, body, body_len);
+}
+
+int send_not_found(Client *cl) {
+  char *body = "Not found\n";
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_full(cl, 404, cache_control, body, strlen(body));
+}
+
+// status is 405 (allowed lists the path's methods) or 501 (a method we do
+// not know at all)
+static int send_method_not_allowed(Client *cl, int status, unsigned allowed) {
+  char *body = status == 501 ? "Method not implemented\n"
+                             : "Method not allowed\n";
+  char headers[MAX_GENERATED_LENGTH];
+  int len = 0;
+  if (status == 405) {
+    len += snprintf(headers, sizeof(headers), "Allow:");
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+      if (allowed & (1u << m))
+        len += snprintf(headers + len, sizeof(headers) - len, "%s %s",
+                        len > (int)strlen("Allow:") ? "," : "",
+                        http_method_name(m));
+    }
+    len += snprintf(headers + len, sizeof(headers) - len, "\n");
+  }
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, headers + len,
+                       sizeof(headers) - len);
+  return send_http_response_full(cl, status, headers, body, strlen(body));
+}
+
+static int route_static(Client *cl, char *request, const RouteParams *params) {
+  return handle_static_request(cl, request);
+}
+
+// the :id parameter as a post id; FAIL unless it is all digits
+static int route_post_id(const RouteParams *params, int *post_id) {
+  int id_len;
+  const char *id = route_param(params, "id", &id_len);
+  *post_id = 0;
+  for (int i = 0; i < id_len; i++) {
+    if (id[i] < '0' || id[i] > '9' || *post_id > (INT_MAX - 9) / 10)
+      return FAIL;
+    *post_id = *post_id * 10 + (id[i] - '0');
+  }
+  return SUCCESS;
+}
+
+static int route_post(Client *cl, char *request, const RouteParams *params) {
+  int post_id;
+  if (route_post_id(params, &post_id) == FAIL)
+    return send_not_found(cl);
+  return respond_with_post(cl, request, post_id);
+}
+
+static int route_api_post(Client *cl, char *request,
+                          const RouteParams *params) {
+  int post_id;
+  if (route_post_id(params, &post_id) == FAIL)
+    return send_json_error(cl, 404, "not found");
+  return handle_api_post_request(cl, request, post_id);
+}
+
+static int route_api_posts(Client *cl, char *request,
+                           const RouteParams *params) {
+  return handle_api_posts_request(cl, request);
+}
+
+static int route_post_index(Client *cl, char *request,
+                            const RouteParams *params) {
+  return handle_post_index_request(cl, request);
+}
+
+static int route_publish(Client *cl, char *request, const RouteParams *params) {
+  return handle_publish_request(cl, request);
+}
+
+static int route_import(Client *cl, char *request, const RouteParams *params) {
+  return handle_import_request(cl, request);
+}
+
+static int route_export(Client *cl, char *request, const RouteParams *params) {
+  return handle_export_request(cl, request);
+}
+
+static int route_backup(Client *cl, char *request, const RouteParams *params) {
+  return handle_backup_request(cl, request);
+}
+
+static int route_feed(Client *cl, char *request, const RouteParams *params) {
+  return handle_feed_request(cl, request);
+}
+
+static int route_user(Client *cl, char *request, const RouteParams *params) {
+  int name_len;
+  const char *name = route_param(params, "name", &name_len);
+  return handle_user_request(cl, request, name, name_len);
+}
+
+static Router routes;
+static pthread_once_t routes_once = PTHREAD_ONCE_INIT;
+
+static void build_routes(void) {
+  router_init(&routes);
+  router_add(&routes, HTTP_GET, "/", route_static);
+  router_add(&routes, HTTP_GET, "/:page", route_static); // <page>.html
+  router_add(&routes, HTTP_GET, "/posts", route_post_index);
+  router_add(&routes, HTTP_GET, "/feed.xml", route_feed);
+  router_add(&routes, HTTP_GET, "/post/:id", route_post);
+  router_add(&routes, HTTP_GET, "/user/:name", route_user);
+  router_add(&routes, HTTP_POST, "/publish", route_publish);
+  router_add(&routes, HTTP_GET, "/api/posts", route_api_posts);
+  router_add(&routes, HTTP_GET, "/api/posts/:id", route_api_post);
+  router_add(&routes, HTTP_POST, "/api/import", route_import);
+  router_add(&routes, HTTP_GET, "/admin/export", route_export);
+  router_add(&routes, HTTP_POST, "/admin/backup", route_backup);
+}
+
+int respond_to_http_request(Client *cl, char *request, char *requestBody) {
+  pthread_once(&routes_once, build_routes);
+
+  // request line: METHOD SP target SP version; the query is not routed on
+  int method_len = strcspn(request, " \r\n");
+  HttpMethod method = http_method_parse(request, method_len);
+  const char *path = request + method_len;
+  if (*path == ' ')
+    path++;
+  int path_len = strcspn(path, " ?\r\n");
+
+  int retry_after;
+  RateLimitBudget budget =
+      method == HTTP_POST ? RATE_LIMIT_WRITE : RATE_LIMIT_READ;
+  if (!rate_limit_allow(cl->address.sin_addr, budget, &retry_after)) {
+    return send_too_many_requests(cl, retry_after);
+  }
+
+  // a method we do not know is one no path takes
+  if (method == HTTP_METHOD_UNKNOWN)
+    return send_method_not_allowed(cl, 501, 0);
+
+  RouteHandler handler;
+  RouteParams params;
+  unsigned allowed;
+  switch (router_match(&routes, method, path, path_len, &handler, &params,
+                       &allowed)) {
+  case ROUTE_FOUND: {
+    // HEAD runs the GET handler; the writers then send only the headers
+    cl->head_only = method == HTTP_HEAD;
+    int result = handler(cl, request, &params);
+    cl->head_only = 0;
+    return result;
+  }
+  case ROUTE_METHOD_NOT_ALLOWED:
+    return send_method_not_allowed(cl, 405, allowed);
+  default:
+    return send_not_found(cl);
+  }
+}
+
+int handle_static_request(Client *cl, char *request) {
+  char file_path[MAX_GENERATED_LENGTH];
+  int result = sscanf(request, "%*s /%s ", file_path); // GET or HEAD
+
+  if (result < 1 || result == EOF) {
+    send_error_response(cl);
+    return SUCCESS;
+  }
+
+  if (strcmp(file_path, "HTTP/1.1") == 0) {
+    strcpy(file_path, "index");
+  }
+
+  char *file_contents = NULL;
+  int file_sz;
+  strcat(file_path, ".html");
+
+  struct stat file_stat;
+  if (stat(file_path, &file_stat) != 0) {
+    return send_not_found(cl);
+  }
+
+  // strong validator: changes whenever the file is rewritten
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"%lx.%lx-%lx\"",
+           (long)file_stat.st_mtim.tv_sec, (long)file_stat.st_mtim.tv_nsec,
+           (long)file_stat.st_size);
+
+  int fresh = request_is_fresh(request, etag, file_stat.st_mtime);
+  if (fresh) {
+    return send_fresh_response(cl, fresh, etag, file_stat.st_mtime,
+                               CACHE_POLICY_STATIC, file_path);
+  }
+
+  // the ETag doubles as the cache version, so an edited file is reloaded
+  CachedBody *entry = body_cache_get(&static_cache, file_path, etag);
+  if (!entry) {
+    result = read_file_contents(file_path, &file_contents, &file_sz);
+
+    if (result == FAIL)
+      return FAIL;
+    if (result == NONEXISTENT_FILE) {
+      return send_not_found(cl);
+    }
+    entry = body_cache_put(&static_cache, file_path, etag, file_contents,
+                           file_sz);
+  }
+
+  return send_cached_body(cl, request, entry, file_stat.st_mtime,
+                          CACHE_POLICY_STATIC, file_path);
+}
+
+// HTTP/1.1 publishes stream through start_publish_upload; this is the
+// buffered path h2 streams take, with the whole body already here.
+int handle_publish_request(Client *cl, char *request) {
+  char *requestBody = request;
+  while (requestBody[0] && strncmp(requestBody, "\r\n\r\n", 4)) {
+    requestBody++;
+  }
+  if (requestBody[0])
+    requestBody += strlen("\r\n\r\n");
+
+  int body_len = strlen(requestBody);
+  cl->upload = malloc(sizeof(BlogPostUpload));
+  if (blog_post_upload_begin(cl->upload, &db, body_len) == 0)
+    blog_post_upload_feed(cl->upload, requestBody, body_len);
+
+  return finish_publish_upload(cl);
+}
+
+// Likewise for imports over h2.
+int handle_import_request(Client *cl, char *request) {
+  char *requestBody = request;
+  while (requestBody[0] && strncmp(requestBody, "\r\n\r\n", 4)) {
+    requestBody++;
+  }
+  if (requestBody[0])
+    requestBody += strlen("\r\n\r\n");
+
+  PostImport *import = malloc(sizeof(PostImport));
+  if (post_import_begin(import, &db) == FAIL) {
+    free(import->rows.conn.errmsg);
+    free(import);
+    return send_json_error(cl, 503, "import unavailable");
+  }
+  cl->import = import;
+  placement_enter_writer();
+  post_import_feed(import, requestBody, strlen(requestBody)); // finish reports failure
+  placement_leave_writer();
+  return finish_post_import(cl);
+}
+
+int handle_post_request(Client *cl, char *request) {
+  char post_id_str[MAX_GENERATED_LENGTH];
+  int result = sscanf(request, "%*s /post/%s ", post_id_str);
+
+  if (result < 1 || result == EOF) {
+        send_error_response(cl);
+        return SUCCESS;
+    }
+
+    return respond_with_post(cl, request, atoi(post_id_str));
+}
+
+// Whether post_id is known to exist without asking the database: it is in
+// the snapshot or in this node's post cache.
+static int post_is_cached(int post_id) {
+    const char *body, *gzip_body;
+    int body_len, gzip_len;
+    if (post_snapshot_find(&post_snapshot, post_id, &body, &body_len,
+                           &gzip_body, &gzip_len))
+        return 1;
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"post-%d\"", post_id);
+    char cache_key[64];
+    snprintf(cache_key, sizeof(cache_key), "post/%d", post_id);
+    CachedBody *entry = body_cache_get(&post_caches[placement_current_node()],
+                                       cache_key, etag);
+    if (!entry)
+        return 0;
+    cached_body_release(entry);
+    return 1;
+}
+
+int respond_with_post(Client *cl, char *request, int post_id) {
+    // posts are never edited, so the id alone identifies the content
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"post-%d\"", post_id);
+
+    // a 304 only once the post is known to exist: an id that was never
+    // used must not look cached forever
+    int fresh = request_is_fresh(request, etag, 0);
+
+    // archived posts are sent straight from the mapping
+    const char *body, *gzip_body;
+    int body_len, gzip_len;
+    if (post_snapshot_find(&post_snapshot, post_id, &body, &body_len,
+                           &gzip_body, &gzip_len)) {
+        if (fresh)
+            return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_POST,
+                                       NULL);
+        int gzip = gzip_body && request_accepts_gzip(request);
+        char headers[MAX_GENERATED_LENGTH * 4];
+        representation_headers(headers, sizeof(headers), etag, gzip, 0,
+                               CACHE_POLICY_POST, NULL);
+        if (gzip) {
+            strcat(headers, "Content-Encoding: gzip\n");
+            return send_http_response_unowned(cl, "text/html", headers,
+                                              gzip_body, gzip_len);
+        }
+        return send_http_response_unowned(cl, "text/html", headers, body,
+                                          body_len);
+    }
+
+    // as /api/posts/<id> does, and never a 200 that caches could keep
+    CachedBody *entry = load_post_body(post_id, &cl->arena);
+    if (!entry)
+        return send_not_found(cl);
+
+    if (fresh) {
+        cached_body_release(entry);
+        return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_POST, NULL);
+    }
+    return send_cached_body(cl, request, entry, 0, CACHE_POLICY_POST, NULL);
+}
+
+CachedBody *load_post_body(int post_id, Arena *scratch) {
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"post-%d\"", post_id);
+    char cache_key[64];
+    snprintf(cache_key, sizeof(cache_key), "post/%d", post_id);
+
+    BodyCache *post_cache = &post_caches[placement_current_node()];
+    CachedBody *entry = body_cache_get(post_cache, cache_key, etag);
+    if (entry)
+        return entry;
+
+    BlogPost post;
+    if (select_blog_post(&db, post_id, &post, scratch) == 1)
+        return NULL;
+
+    int html_len;
+    char *html = render_post_page(&post, &html_len);
+    return body_cache_put(post_cache, cache_key, etag, html, html_len);
+}
+
+char *render_post_page(const BlogPost *post, int *len) {
+    const char *html_fmt = "<html><head><title>%s</title></head><body><h1>%s</h1><h3>%s</h3><p>%s</p><a href=\"/index\">back</a></body></html>";
+    int html_len = snprintf(NULL, 0, html_fmt, post->title, post->title, post->user, post->content);
+    char *html = malloc(html_len + 1);
+    sprintf(html, html_fmt, post->title, post->title, post->user, post->content);
+    *len = html_len;
+    return html;
+}
+
+typedef struct {
+  void (*fn)(void *ctx, int post_id);
+  void *ctx;
+} CachedPostVisit;
+
+static void visit_post_key(void *ctx, const char *key) {
+  CachedPostVisit *visit = ctx;
+  int post_id;
+  if (sscanf(key, "post/%d", &post_id) == 1)
+    visit->fn(visit->ctx, post_id);
+}
+
+void for_each_cached_post(void (*fn)(void *ctx, int post_id), void *ctx) {
+  CachedPostVisit visit = {fn, ctx};
+  for (int node = 0; node < placement_node_count(); node++)
+    body_cache_for_each_key(&post_caches[node], visit_post_key, &visit);
+}
+
+static int request_is_http10(const char *request) {
+  int line_len = strcspn(request, "\r\n");
+  return line_len >= 8 && !strncmp(request + line_len - 8, "HTTP/1.0", 8);
+}
+
+// Rendering state for a 200 response generated while a query is still
+// stepping (/posts, the JSON API). Output is appended to a fixed-size
+// chunk that goes out as soon as it fills. When a copy is kept, it holds
+// the whole body: for the body cache, until it outgrows
+// INDEX_CACHE_MAX_LENGTH, and always when the response is not chunked.
+// Without a client the body is only rendered into the cache (warm-up).
+typedef struct {
+  Client *cl;
+  const char *content_type;
+  const char *headers;
+  int chunked; // HTTP/1.1; h2 and HTTP/1.0 need the whole body first
+  int head_sent;
+  int failed;
+
+  char chunk[INDEX_CHUNK_SIZE];
+  int chunk_len;
+
+  char *copy; // NULL once abandoned
+  int copy_len;
+  int copy_cap;
+} StreamedBody;
+
+static int stream_flush_chunk(StreamedBody *render) {
+  if (!render->chunked || !render->chunk_len)
+    return SUCCESS;
+
+  if (!render->head_sent) {
+    if (send_chunked_response_head(render->cl, 200, render->content_type,
+                                   render->headers) == FAIL)
+      return FAIL;
+    render->head_sent = 1;
+  }
+  if (send_chunk(render->cl, render->chunk, render->chunk_len) == FAIL ||
+      client_flush(render->cl) == FAIL)
+    return FAIL;
+
+  render->chunk_len = 0;
+  return SUCCESS;
+}
+
+static int stream_append(StreamedBody *render, const char *data, int data_len) {
+  if (render->copy) {
+    if ((render->chunked || !render->cl) &&
+        render->copy_len + data_len > INDEX_CACHE_MAX_LENGTH) {
+      // too big to cache; keep memory bounded and just stream it
+      free(render->copy);
+      render->copy = NULL;
+      if (!render->cl)
+        return FAIL; // nobody to stream it to
+    } else {
+      if (render->copy_len + data_len > render->copy_cap) {
+        while (render->copy_len + data_len > render->copy_cap)
+          render->copy_cap *= 2;
+        render->copy = realloc(render->copy, render->copy_cap);
+      }
+      memcpy(render->copy + render->copy_len, data, data_len);
+      render->copy_len += data_len;
+    }
+  }
+
+  if (!render->chunked)
+    return SUCCESS;
+
+  while (data_len > 0) {
+    int space = INDEX_CHUNK_SIZE - render->chunk_len;
+    int n = data_len < space ? data_len : space;
+    memcpy(render->chunk + render->chunk_len, data, n);
+    render->chunk_len += n;
+    data += n;
+    data_len -= n;
+
+    if (render->chunk_len == INDEX_CHUNK_SIZE &&
+        stream_flush_chunk(render) == FAIL)
+      return FAIL;
+  }
+  return SUCCESS;
+}
+
+static int stream_append_string(StreamedBody *render, const char *s) {
+  return stream_append(render, s, strlen(s));
+}
+
+static int render_index_row(void *ctx, int post_id, const char *title) {
+  StreamedBody *render = ctx;
+  char link[64];
+  snprintf(link, sizeof(link), "<p><a href=\"/post/%d\">", post_id);
+
+  if (stream_append_string(render, link) == FAIL ||
+      stream_append_string(render, title) == FAIL ||
+      stream_append_string(render, "</a></p>\n") == FAIL) {
+    render->failed = 1;
+    return 1; // stop the query; the client is gone
+  }
+  return 0;
+}
+
+// keep_copy is implied when the response is not chunked
+static void stream_init(StreamedBody *render, Client *cl,
+                        const char *content_type, const char *headers,
+                        int chunked, int keep_copy) {
+  render->cl = cl;
+  render->content_type = content_type;
+  render->headers = headers;
+  render->chunked = chunked;
+  render->head_sent = 0;
+  render->failed = 0;
+  render->chunk_len = 0;
+  render->copy_cap = INDEX_CHUNK_SIZE;
+  render->copy = keep_copy || !chunked ? malloc(render->copy_cap) : NULL;
+  render->copy_len = 0;
+}
+
+static int client_wants_chunked(Client *cl, const char *request) {
+  return !(cl->h2 && cl->h2->current_stream) && !request_is_http10(request);
+}
+
+static const char *index_page_head = "<html>\n<head>\n"
+                                     "<title>Blog Index</title>\n"
+                                     "</head>\n<body>\n"
+                                     "<h1>Blog Index</h1>\n";
+
+static void index_etag(char *etag, int etag_len) {
+  snprintf(etag, etag_len, "\"posts-%lu\"",
+           __atomic_load_n(&index_generation, __ATOMIC_ACQUIRE));
+}
+
+int warm_post_index(void) {
+  char etag[64];
+  index_etag(etag, sizeof(etag));
+
+  CachedBody *entry = body_cache_get(&index_cache, "posts", etag);
+  if (entry) {
+    cached_body_release(entry);
+    return SUCCESS;
+  }
+
+  StreamedBody *render = malloc(sizeof(StreamedBody));
+  stream_init(render, NULL, "text/html", NULL, 0, 1);
+  stream_append_string(render, index_page_head);
+  int result = for_each_blog_post_title(&db, render_index_row, render);
+  if (result != 0 || render->failed ||
+      stream_append_string(render, "</body>\n</html>\n") == FAIL) {
+    if (result != 0 && !render->failed && debug)
+      fprintf(stderr, "Error listing posts: %s\n", db.errmsg);
+    free(render->copy);
+    free(render);
+    return FAIL;
+  }
+
+  entry = body_cache_put(&index_cache, "posts", etag, render->copy,
+                         render->copy_len);
+  cached_body_release(entry);
+  free(render);
+  return SUCCESS;
+}
+
+int handle_post_index_request(Client *cl, char *request) {
+  char etag[64];
+  index_etag(etag, sizeof(etag));
+
+  // answered without touching the database
+  int fresh = request_is_fresh(request, etag, 0);
+  if (fresh) {
+    return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  CachedBody *entry = body_cache_get(&index_cache, "posts", etag);
+  if (entry) {
+    return send_cached_body(cl, request, entry, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  // a streamed body is only ever sent as identity
+  char headers[MAX_GENERATED_LENGTH * 4];
+  representation_headers(headers, sizeof(headers), etag, 0, 0,
+                         CACHE_POLICY_INDEX, NULL);
+
+  StreamedBody *render = arena_alloc(&cl->arena, sizeof(StreamedBody));
+  stream_init(render, cl, "text/html", headers,
+              client_wants_chunked(cl, request), 1);
+  stream_append_string(render, index_page_head);
+
+  int result = for_each_blog_post_title(&db, render_index_row, render);
+  if (result == 1 && !render->failed && !render->head_sent) {
+    if (debug) fprintf(stderr, "Error listing posts: %s\n", db.errmsg);
+    free(render->copy);
+    return send_http_response(cl, "Could not list posts\n");
+  }
+  if (result != 0 || render->failed ||
+      stream_append_string(render, "</body>\n</html>\n") == FAIL) {
+    // the head is out, so the only way to report this is to cut the
+    // response short
+    free(render->copy);
+    return FAIL;
+  }
+
+  if (!render->chunked && render->copy_len > INDEX_CACHE_MAX_LENGTH) {
+    result = send_http_response_full(cl, 200, headers, render->copy,
+                                     render->copy_len);
+    free(render->copy);
+    return result;
+  }
+
+  if (render->copy) {
+    entry = body_cache_put(&index_cache, "posts", etag, render->copy,
+                           render->copy_len);
+    render->copy = NULL;
+  }
+
+  if (!render->chunked) {
+    return send_cached_body(cl, request, entry, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  if (entry)
+    cached_body_release(entry);
+  result = stream_flush_chunk(render);
+  if (result != FAIL)
+    result = send_last_chunk(cl);
+  return result;
+}
+
+
+// Ends a streamed response that is not cached: the last chunk, or the
+// whole body for h2 and HTTP/1.0.
+static int stream_finish(StreamedBody *render) {
+  if (render->chunked) {
+    int result = stream_flush_chunk(render);
+    if (result != FAIL)
+      result = send_last_chunk(render->cl);
+    return result;
+  }
+  int result = send_http_response_typed(render->cl, 200, render->content_type,
+                                        render->headers, render->copy,
+                                        render->copy_len);
+  free(render->copy);
+  render->copy = NULL;
+  return result;
+}
+
+static int stream_sink(void *ctx, const char *data, int len) {
+  StreamedBody *render = ctx;
+  if (stream_append(render, data, len) == FAIL) {
+    render->failed = 1;
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+int handle_api_post_request(Client *cl, char *request, int post_id) {
+  // a different representation of the same immutable post
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"post-%d-json\"", post_id);
+
+  // a 304 only for a post that exists; see respond_with_post
+  int fresh = request_is_fresh(request, etag, 0);
+  if (fresh && post_is_cached(post_id)) {
+    return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_POST, NULL);
+  }
+
+  BlogPost post;
+  if (select_blog_post(&db, post_id, &post, &cl->arena) == 1)
+    return send_json_error(cl, 404, "not found");
+  if (fresh) {
+    return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_POST, NULL);
+  }
+
+  char headers[MAX_GENERATED_LENGTH * 4];
+  representation_headers(headers, sizeof(headers), etag, 0, 0,
+                         CACHE_POLICY_POST, NULL);
+
+  StreamedBody *render = arena_alloc(&cl->arena, sizeof(StreamedBody));
+  stream_init(render, cl, "application/json", headers,
+              client_wants_chunked(cl, request), 0);
+
+  JsonWriter w;
+  json_writer_init(&w, stream_sink, render);
+  json_begin_object(&w);
+  json_key(&w, "id");
+  json_int(&w, post_id);
+  json_key(&w, "user");
+  json_string(&w, post.user);
+  json_key(&w, "title");
+  json_string(&w, post.title);
+  json_key(&w, "content");
+  json_string(&w, post.content);
+  json_end_object(&w);
+
+  if (json_writer_result(&w) == FAIL) {
+    free(render->copy);
+    return FAIL;
+  }
+  return stream_finish(render);
+}
+
+// Value of ?name= in the request target, or fallback when it is absent
+// or not a number.
+static long query_param_long(const char *request, const char *name,
+                             long fallback) {
+  int target_len = strcspn(request, "\r\n");
+  const char *query = memchr(request, '?', target_len);
+  if (!query)
+    return fallback;
+
+  int name_len = strlen(name);
+  for (const char *p = query + 1; *p && *p != ' ' && *p != '\r' && *p != '\n';
+       p += strcspn(p, "& \r\n"), p += *p == '&') {
+    if (!strncmp(p, name, name_len) && p[name_len] == '=') {
+      char *end;
+      long value = strtol(p + name_len + 1, &end, 10);
+      return end == p + name_len + 1 ? fallback : value;
+    }
+  }
+  return fallback;
+}
+
+// %XX escapes in a path segment; returns the decoded length, or -1 if it
+// does not fit
+static int percent_decode(const char *in, int in_len, char *out, int out_cap) {
+  int len = 0;
+  for (int i = 0; i < in_len; i++) {
+    if (len == out_cap - 1)
+      return -1;
+    char c = in[i];
+    unsigned hex;
+    if (c == '%' && i + 2 < in_len && isxdigit((unsigned char)in[i + 1]) &&
+        isxdigit((unsigned char)in[i + 2]) &&
+        sscanf(in + i + 1, "%2x", &hex) == 1) {
+      c = hex;
+      i += 2;
+    }
+    out[len++] = c;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+// in as a path segment: everything but RFC 3986's unreserved characters
+// becomes %XX. out needs three bytes per byte of in, and one more.
+static void percent_encode(const char *in, char *out) {
+  for (; *in; in++) {
+    unsigned char c = *in;
+    if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+      *out++ = c;
+    else
+      out += sprintf(out, "%%%02X", c);
+  }
+  *out = '\0';
+}
+
+static int stream_append_html(StreamedBody *render, const char *s) {
+  int result = SUCCESS;
+  const char *run = s;
+  for (; *s; s++) {
+    const char *escape = *s == '&'   ? "&amp;"
+                         : *s == '<' ? "&lt;"
+                         : *s == '>' ? "&gt;"
+                         : *s == '"' ? "&quot;"
+                                     : NULL;
+    if (!escape)
+      continue;
+    if (stream_append(render, run, s - run) == FAIL ||
+        stream_append_string(render, escape) == FAIL)
+      result = FAIL;
+    run = s + 1;
+  }
+  if (stream_append_string(render, run) == FAIL)
+    result = FAIL;
+  return result;
+}
+
+typedef struct {
+  StreamedBody *render;
+  int rows;
+  int last_id;
+} UserPageRows;
+
+static int render_user_row(void *ctx, int post_id, const char *title) {
+  UserPageRows *rows = ctx;
+  rows->rows++;
+  rows->last_id = post_id;
+  return render_index_row(rows->render, post_id, title);
+}
+
+// GET /user/<name>?before=<id>: an author's posts, newest first, a page at
+// a time. Pages are cached until that author publishes again.
+int handle_user_request(Client *cl, char *request, const char *path_name,
+                        int path_name_len) {
+  char name[BLOG_FIELD_LENGTH];
+  if (percent_decode(path_name, path_name_len, name, sizeof(name)) < 0)
+    return send_not_found(cl);
+  long before = query_param_long(request, "before", INT_MAX);
+  if (before < 1 || before > INT_MAX)
+    before = INT_MAX;
+
+  char etag[96];
+  snprintf(etag, sizeof(etag), "\"user-%lu-%ld\"",
+           __atomic_load_n(author_generation(name, strlen(name)),
+                           __ATOMIC_ACQUIRE),
+           before);
+
+  int fresh = request_is_fresh(request, etag, 0);
+  if (fresh) {
+    return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  // decoded, so that every spelling of a name shares one entry
+  char *cache_key = arena_alloc(&cl->arena, strlen(name) + 32);
+  sprintf(cache_key, "user/%s/%ld", name, before);
+  CachedBody *entry = body_cache_get(&user_cache, cache_key, etag);
+  if (entry) {
+    return send_cached_body(cl, request, entry, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  // a page is small; render it whole, then cache and send it
+  StreamedBody *render = arena_alloc(&cl->arena, sizeof(StreamedBody));
+  stream_init(render, NULL, "text/html", NULL, 0, 1);
+  stream_append_string(render, "<html>\n<head>\n<title>Posts by ");
+  stream_append_html(render, name);
+  stream_append_string(render, "</title>\n</head>\n<body>\n<h1>Posts by ");
+  stream_append_html(render, name);
+  stream_append_string(render, "</h1>\n");
+
+  UserPageRows rows = {render, 0, 0};
+  if (for_each_user_post_title(&db, name, before, USER_PAGE_POSTS,
+                               render_user_row, &rows) != 0 ||
+      render->failed) {
+    if (debug) fprintf(stderr, "Error listing posts by %s: %s\n", name,
+                       db.errmsg);
+    free(render->copy);
+    return send_http_response(cl, "Could not list posts\n");
+  }
+  if (rows.rows == 0 && before == INT_MAX) {
+    free(render->copy);
+    return send_not_found(cl); // nobody by that name has posted
+  }
+
+  if (rows.rows == USER_PAGE_POSTS) {
+    // from the decoded name: the request's own spelling is the client's
+    char encoded[BLOG_FIELD_LENGTH * 3];
+    percent_encode(name, encoded);
+    char before_query[32];
+    snprintf(before_query, sizeof(before_query), "?before=%d", rows.last_id);
+    stream_append_string(render, "<p><a href=\"/user/");
+    stream_append_html(render, encoded);
+    stream_append_string(render, before_query);
+    stream_append_string(render, "\">Older posts</a></p>\n");
+  }
+  stream_append_string(render, "</body>\n</html>\n");
+
+  if (!render->copy)
+    return send_http_response(cl, "Could not list posts\n");
+  entry = body_cache_put(&user_cache, cache_key, etag, render->copy,
+                         render->copy_len);
+  return send_cached_body(cl, request, entry, 0, CACHE_POLICY_INDEX, NULL);
+}
+
+typedef struct {
+  JsonWriter w;
+  int rows;
+  int last_id;
+} ApiPostList;
+
+static int render_api_post_row(void *ctx, int post_id, const char *title) {
+  ApiPostList *list = ctx;
+  json_begin_object(&list->w);
+  json_key(&list->w, "id");
+  json_int(&list->w, post_id);
+  json_key(&list->w, "title");
+  json_string(&list->w, title);
+  json_end_object(&list->w);
+
+  list->rows++;
+  list->last_id = post_id;
+  return list->w.failed; // stop the query; the client is gone
+}
+
+int handle_api_posts_request(Client *cl, char *request) {
+  long after = query_param_long(request, "after", 0);
+  long limit = query_param_long(request, "limit", API_DEFAULT_LIMIT);
+  if (after < 0 || after > INT_MAX)
+    after = after < 0 ? 0 : INT_MAX;
+  if (limit < 1 || limit > API_MAX_LIMIT)
+    limit = limit < 1 ? 1 : API_MAX_LIMIT;
+
+  // a page changes only when a publish changes the index
+  char etag[96];
+  snprintf(etag, sizeof(etag), "\"posts-%lu-%ld-%ld-json\"",
+           __atomic_load_n(&index_generation, __ATOMIC_ACQUIRE), after, limit);
+
+  int fresh = request_is_fresh(request, etag, 0);
+  if (fresh) {
+    return send_fresh_response(cl, fresh, etag, 0, CACHE_POLICY_INDEX, NULL);
+  }
+
+  char headers[MAX_GENERATED_LENGTH * 4];
+  representation_headers(headers, sizeof(headers), etag, 0, 0,
+                         CACHE_POLICY_INDEX, NULL);
+
+  StreamedBody *render = arena_alloc(&cl->arena, sizeof(StreamedBody));
+  stream_init(render, cl, "application/json", headers,
+              client_wants_chunked(cl, request), 0);
+
+  ApiPostList *list = arena_alloc(&cl->arena, sizeof(ApiPostList));
+  list->rows = 0;
+  list->last_id = 0;
+  json_writer_init(&list->w, stream_sink, render);
+  json_begin_object(&list->w);
+  json_key(&list->w, "posts");
+  json_begin_array(&list->w);
+
+  int result = for_each_blog_post_title_after(&db, after, limit,
+                                              render_api_post_row, list);
+  if (result == 1 && !list->w.failed && !render->head_sent) {
+    if (debug) fprintf(stderr, "Error listing posts: %s\n", db.errmsg);
+    free(render->copy);
+    return send_json_error(cl, 500, "could not list posts");
+  }
+
+  json_end_array(&list->w);
+  // where the next page starts; null on the last one
+  json_key(&list->w, "next_after");
+  if (list->rows == limit)
+    json_int(&list->w, list->last_id);
+  else
+    json_null(&list->w);
+  json_end_object(&list->w);
+
+  if (result != 0 || json_writer_result(&list->w) == FAIL) {
+    free(render->copy);
+    return FAIL;
+  }
+  return stream_finish(render);
+}
+
+int file_size(FILE *fp) {
+  // https://stackoverflow.com/questions/238603/how-can-i-get-a-files-size-in-c
+
+  int current_position = ftell(fp);
+
+  fseek(fp, 0L, SEEK_END);
+
+  int file_sz = ftell(fp);
+
+  fseek(fp, current_position, SEEK_SET);
+
+  return file_sz;
+}
+
+int read_file_contents(const char *file_path, char **buf, int *file_sz) {
+  FILE *fp = fopen(file_path, "r");
+
+  if (!fp) {
+    return NONEXISTENT_FILE;
+  }
+
+  *file_sz = file_size(fp);
+  *buf = malloc(*file_sz);
+  fread(*buf, sizeof(char), *file_sz, fp);
+
+  fclose(fp);
+
+  return SUCCESS;
+}
+
+// Polls are answered from memory; see feed.h.
+int handle_feed_request(Client *cl, char *request) {
+  time_t last_modified;
+  CachedBody *entry = feed_get(&db, &last_modified);
+  if (!entry)
+    return send_http_response(cl, "Could not list posts\n");
+
+  int fresh = request_is_fresh(request, entry->etag, last_modified);
+  if (fresh) {
+    int result = send_fresh_response(cl, fresh, entry->etag, last_modified,
+                                     CACHE_POLICY_INDEX, NULL);
+    cached_body_release(entry);
+    return result;
+  }
+  return send_cached_body_typed(cl, request, entry, "application/atom+xml",
+                                last_modified, CACHE_POLICY_INDEX, NULL);
+}
+
+// /admin/ is for whoever runs the server. Where the client connects from
+// says nothing (a reverse proxy on the same host connects from loopback),
+// so it takes the token; compared in constant time.
+static int request_is_admin(const char *request) {
+  char value[ADMIN_TOKEN_MAX_LENGTH + 16];
+  int token_len = strlen(admin_token);
+  if (!token_len ||
+      !http_request_header(request, "Authorization", value, sizeof(value)) ||
+      strncmp(value, "Bearer ", 7) || (int)strlen(value + 7) != token_len)
+    return 0;
+  unsigned char differ = 0;
+  for (int i = 0; i < token_len; i++)
+    differ |= value[7 + i] ^ admin_token[i];
+  return !differ;
+}
+
+int handle_export_request(Client *cl, char *request) {
+  if (!request_is_admin(request))
+    return send_json_error(cl, 403, "forbidden");
+  // A body the size of the whole table is only ever streamed, and only
+  // HTTP/1.1 responses stream (h2 and HTTP/1.0 ones are sent whole).
+  if (!client_wants_chunked(cl, request))
+    return send_json_error(cl, 400, "export is streamed in chunks, "
+                                    "so request it over HTTP/1.1");
+
+  char headers[MAX_GENERATED_LENGTH];
+  int len = snprintf(headers, sizeof(headers),
+                     "Content-Disposition: attachment; "
+                     "filename=\"posts.ndjson\"\n");
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, headers + len,
+                       sizeof(headers) - len);
+
+  StreamedBody *render = arena_alloc(&cl->arena, sizeof(StreamedBody));
+  stream_init(render, cl, "application/x-ndjson", headers, 1, 0);
+
+  char *errmsg;
+  long posts = export_posts(&db, stream_sink, render, &errmsg);
+  if (posts < 0 && !render->failed) {
+    if (debug) fprintf(stderr, "Error exporting posts: %s\n",
+                       errmsg ? errmsg : "unknown");
+    free(errmsg);
+    if (!render->head_sent)
+      return send_json_error(cl, 500, "could not export posts");
+  }
+  if (posts < 0)
+    return FAIL; // cut short; the missing last chunk tells the client
+  if (debug)
+    fprintf(stderr, "client %d: exported %ld posts\n", client_id(cl), posts);
+  return stream_finish(render);
+}
+
+static pthread_mutex_t backup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Runs on the requesting client's thread; everyone else keeps being served.
+int handle_backup_request(Client *cl, char *request) {
+  if (!request_is_admin(request))
+    return send_json_error(cl, 403, "forbidden");
+  if (pthread_mutex_trylock(&backup_lock) != 0)
+    return send_json_error(cl, 409, "a backup is already running");
+
+  struct timespec started, now;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  // errors go to this copy's errmsg rather than the shared one
+  DBConnection live = {db.db, NULL};
+  int pages;
+  int failed = backup_blog_db(&live, BACKUP_PATH, &pages);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  pthread_mutex_unlock(&backup_lock);
+
+  if (failed) {
+    if (debug) fprintf(stderr, "Error backing up database: %s\n",
+                       live.errmsg ? live.errmsg : "unknown");
+    free(live.errmsg);
+    return send_json_error(cl, 500, "backup failed");
+  }
+
+  long ms = (now.tv_sec - started.tv_sec) * 1000 +
+            (now.tv_nsec - started.tv_nsec) / 1000000;
+  char body[MAX_GENERATED_LENGTH];
+  int body_len = snprintf(body, sizeof(body),
+                          "{\"path\":\"%s\",\"pages\":%d,"
+                          "\"milliseconds\":%ld}\n",
+                          BACKUP_PATH, pages, ms);
+  char cache_control[MAX_GENERATED_LENGTH];
+  cache_control_header(CACHE_POLICY_NO_STORE, NULL, cache_control,
+                       sizeof(cache_control));
+  return send_http_response_typed(cl, 200, "application/json", cache_control,
+                                  body, body_len);
+}
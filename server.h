@@ -0,0 +1,191 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <time.h>
+
+#include "Client.h"
+#include "blog.h"
+#include "body_cache.h"
+
+#define LISTEN_PORT 8888
+// connections the kernel holds for us while the accept loop catches up;
+// beyond admission.h's limits they are answered 503 rather than queued
+#define PENDING_CONNECTIONS_QUEUE_LENGTH 128
+// pause before accepting again when out of file descriptors
+#define ACCEPT_BACKOFF_MS 50
+#define MAX_MESSAGE_LENGTH (10 * 1024 * 1024)
+// POST /publish and /api/import bodies are streamed (see
+// start_publish_upload) and may be this large, or BLOG_MAX_UPLOAD_LENGTH
+// bytes when that is set; anything bigger gets 413 as soon as the head
+// arrives
+#define MAX_UPLOAD_LENGTH (512 * 1024 * 1024)
+#define MAX_GENERATED_LENGTH 1024
+#define MAX_FILESIZE 30 * 1024 * 1024
+#define DB_NAME "starter.db"
+// longest BLOG_ADMIN_TOKEN, the secret /admin/ requests must present;
+// without one /admin/ is closed
+#define ADMIN_TOKEN_MAX_LENGTH 256
+// where POST /admin/backup writes its copy
+#define BACKUP_PATH "starter.db.backup"
+// posts archived by main --snapshot (see post_snapshot.h), mapped at start
+#define SNAPSHOT_PATH "starter.db.snapshot"
+// where a running server waits to hand its listening socket to a
+// successor (see handoff.h)
+#define HANDOFF_SOCKET_PATH "blog_server.handoff"
+// how long SIGTERM waits for in-flight requests before exiting anyway
+#define DRAIN_TIMEOUT_MS 30000
+
+// Read deadlines, enforced by the connection timer wheel. The header
+// deadline runs from the first byte of a request head and is not extended
+// by trickling more bytes; the body deadline is per read; idle is the
+// keep-alive wait between requests. None runs while a request is being
+// answered.
+#define TIMER_TICK_MS 100
+#define IDLE_TIMEOUT_MS 30000
+#define HEADER_TIMEOUT_MS 10000
+#define BODY_READ_TIMEOUT_MS 20000
+// a client that stops reading its response; set as SO_SNDTIMEO
+#define WRITE_TIMEOUT_MS 30000
+
+#define TIMEOUT_PHASE_IDLE 0
+#define TIMEOUT_PHASE_HEADER 1
+#define TIMEOUT_PHASE_BODY 2
+#define TIMEOUT_PHASE_RESPONSE 3
+
+// rendered bodies kept (with their gzip copies) by body_cache.c
+#define STATIC_CACHE_SLOTS 64
+#define POST_CACHE_SLOTS 4096
+// /user/<name> pages, keyed by author and page
+#define USER_CACHE_SLOTS 1024
+#define USER_PAGE_POSTS 50
+// per-author versions for those pages (see author_generation())
+#define AUTHOR_GENERATION_SLOTS 4096
+
+// /posts is streamed in chunks of this size; pages up to the limit below
+// are also kept in the body cache, larger ones are rendered every time
+#define INDEX_CHUNK_SIZE (16 * 1024)
+#define INDEX_CACHE_MAX_LENGTH (1024 * 1024)
+
+// page sizes for GET /api/posts?limit=
+#define API_DEFAULT_LIMIT 50
+#define API_MAX_LIMIT 1000
+
+// request_is_fresh() results
+#define NOT_FRESH 0
+#define FRESH 1
+#define FRESH_GZIP 2 // the client holds the gzip variant
+
+extern int debug;
+extern DBConnection db;
+// Bumped on every publish; the /posts ETag is derived from it. main()
+// seeds it from the next post id so ETags stay valid across restarts.
+extern unsigned long index_generation;
+// MAX_UPLOAD_LENGTH unless the environment says otherwise
+extern long max_upload_length;
+
+// call once before serving
+// Reads the BLOG_ environment variables that override the defaults
+// above. Returns FAIL, having said which, if one is unusable.
+int load_server_settings(void);
+void init_response_caches(void);
+// starts the thread that advances the connection timer wheel
+int start_connection_timers(void);
+
+// SIGTERM (or a handoff) stops the accept loop; drain_connections() then
+// waits for open connections to finish their current request and close.
+// It returns FAIL if some were still open after timeout_ms; their threads
+// may still be using the database.
+int install_drain_handler(void);
+void request_drain(void);
+int drain_connections(int timeout_ms);
+
+// forward decls
+//! All return FAIL (0). Anything else is successey
+int establish_listening_socket(int port_to_listen);
+int handle_new_client_wrapper(Client *cl);
+int handle_new_client_guts(Client *cl);
+int accept_a_client(int listen_socket, Client **new_client_ptr);
+int close_down_listening(int listening_socket);
+// bytes in the head of the first request in buffer; 0 = incomplete
+int http_request_head_length(const char *buffer, int buffer_len);
+// 0 without the header, -1 when malformed
+long http_request_content_length(const char *buffer, int head_len);
+int handle_http1_input(Client *client);
+int start_publish_upload(Client *cl, char *request, int head_len,
+                         long content_length);
+// stores the post and answers the publish; frees cl->upload
+int finish_publish_upload(Client *cl);
+// POST /api/import, streamed the same way; answers with the counts and
+// rate and frees cl->import
+int start_post_import(Client *cl, char *request, int head_len,
+                      long content_length);
+int finish_post_import(Client *cl);
+int send_payload_too_large(Client *cl);
+// 429, before any handler or database work
+int send_too_many_requests(Client *cl, int retry_after);
+int http_request_header(const char *request, const char *name, char *value,
+                        int value_len);
+int respond_to_http_request(Client *cl, char *request, char *requestBody);
+int send_http_response_binary(Client *cl, char *body, int body_len);
+int send_http_response(Client *cl, char *body);
+// text/html
+int send_http_response_full(Client *cl, int status, const char *extra_headers,
+                            char *body, int body_len);
+int send_http_response_typed(Client *cl, int status, const char *content_type,
+                             const char *extra_headers, char *body,
+                             int body_len);
+// HTTP/1.1 only: the head of a Transfer-Encoding: chunked response, then
+// one chunk per send_chunk() and the terminator from send_last_chunk()
+int send_chunked_response_head(Client *cl, int status,
+                               const char *content_type,
+                               const char *extra_headers);
+int send_chunk(Client *cl, char *data, int data_len);
+int send_last_chunk(Client *cl);
+// 304 with the same ETag and Cache-Control lines a 200 would carry
+int send_not_modified(Client *cl, const char *headers);
+// Does the request's If-None-Match / If-Modified-Since show the client
+// already has this version (in either encoding)? Returns NOT_FRESH, FRESH
+// or FRESH_GZIP. last_modified may be 0 when unknown.
+int request_is_fresh(const char *request, const char *etag,
+                     time_t last_modified);
+int request_accepts_gzip(const char *request);
+int send_error_response(Client *cl);
+int send_not_found(Client *cl);
+// {"error": message} with the given status
+int send_json_error(Client *cl, int status, const char *message);
+int handle_static_request(Client *cl, char *request);
+int handle_publish_request(Client *cl, char *request);
+int handle_import_request(Client *cl, char *request);
+int handle_post_request(Client *cl, char *request);
+// what handle_post_request sends once the id is parsed
+int respond_with_post(Client *cl, char *request, int post_id);
+int handle_post_index_request(Client *cl, char *request);
+// GET /user/<name>; path_name is the segment as sent, percent-encoded
+int handle_user_request(Client *cl, char *request, const char *path_name,
+                        int path_name_len);
+// GET /feed.xml (see feed.h)
+int handle_feed_request(Client *cl, char *request);
+// GET /api/posts/<id> and GET /api/posts?after=&limit=
+int handle_api_post_request(Client *cl, char *request, int post_id);
+int handle_api_posts_request(Client *cl, char *request);
+// GET /admin/export (NDJSON, see post_export.h) and POST /admin/backup;
+// only for requests with "Authorization: Bearer <BLOG_ADMIN_TOKEN>"
+int handle_export_request(Client *cl, char *request);
+int handle_backup_request(Client *cl, char *request);
+// The rendered page for a post, from the cache or freshly rendered into
+// it; a referenced entry, or NULL if there is no such post. A render
+// reads the row into scratch.
+CachedBody *load_post_body(int post_id, Arena *scratch);
+// A post's page, malloc'd; what load_post_body caches and main --snapshot
+// archives.
+char *render_post_page(const BlogPost *post, int *len);
+// Renders /posts into the cache unless it is there or too big. Returns
+// FAIL or SUCCESS.
+int warm_post_index(void);
+// Calls fn with the id of every post page currently cached.
+void for_each_cached_post(void (*fn)(void *ctx, int post_id), void *ctx);
+// this returns FAIL (system error - close connection), SUCCESS,
+// or NONEXISTENT_FILE
+int read_file_contents(const char *file_path, char **buf, int *file_sz);
+
+#endif
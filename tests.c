@@ -0,0 +1,1476 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "munit/munit.h"
+
+#include "Client.h"
+#include "blog.h"
+#include "feed.h"
+#include "hpack.h"
+#include "http2.h"
+#include "json_writer.h"
+#include "post_import.h"
+#include "post_snapshot.h"
+#include "router.h"
+#include "server.h"
+
+// Microbenchmarks for the hot paths: form parsing, request routing, post
+// rendering and every blog.c DB function. Each bench logs ns/op and
+// allocations/op at INFO level. Behaviour tests for the parsers that take
+// untrusted input follow the benches.
+//
+// The DB benches run against synthetic databases of 1k, 100k and 1M posts.
+// Those are built once under BENCH_DB_DIR and reused by later runs.
+// Pick one size with e.g. "./tests --param posts 1000".
+
+#define BENCH_DB_DIR "/tmp"
+#define BENCH_CONTENT_LENGTH 200
+
+//// allocation counting
+
+// Replace the allocator entry points so every malloc made by our code,
+// libc (strdup, fopen) and sqlite is counted. glibc supports this kind of
+// interposition; we forward to its real implementation.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long allocation_count = 0;
+
+void *malloc(size_t size) {
+  allocation_count++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  allocation_count++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  allocation_count++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+//// timing
+
+typedef struct {
+  struct timespec start;
+  unsigned long allocations;
+} BenchTimer;
+
+static void bench_start(BenchTimer *timer) {
+  timer->allocations = allocation_count;
+  clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+static void bench_stop(BenchTimer *timer, const char *label, long posts,
+                       long ops) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  unsigned long allocations = allocation_count - timer->allocations;
+
+  double elapsed_ns = (end.tv_sec - timer->start.tv_sec) * 1e9 +
+                      (end.tv_nsec - timer->start.tv_nsec);
+
+  munit_logf(MUNIT_LOG_INFO, "%-32s posts=%-8ld %12.1f ns/op %8.2f allocs/op",
+             label, posts, elapsed_ns / ops, (double)allocations / ops);
+}
+
+//// fixture
+
+typedef struct {
+  long posts;
+  Client *client;
+} BenchFixture;
+
+// Fills a fresh database with `posts` rows in one transaction.
+static int populate_bench_db(const char *db_path, long posts) {
+  DBConnection conn;
+  if (open_db_connection(&conn, db_path) != 0 ||
+      create_blog_table(&conn) != 0) {
+    return FAIL;
+  }
+
+  char content[BENCH_CONTENT_LENGTH + 1];
+  memset(content, 'x', BENCH_CONTENT_LENGTH);
+  content[BENCH_CONTENT_LENGTH] = '\0';
+
+  sqlite3_stmt *stmt, *content_stmt;
+  const char *sql = "INSERT INTO blog_posts (post_id, user, title) "
+                    "VALUES (?, ?, ?);";
+  const char *content_sql = "INSERT INTO blog_post_contents (post_id, content) "
+                            "VALUES (?, ?);";
+  sqlite3_exec(conn.db, "BEGIN;", NULL, NULL, NULL);
+  if (sqlite3_prepare_v2(conn.db, sql, -1, &stmt, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(conn.db, content_sql, -1, &content_stmt, NULL) !=
+          SQLITE_OK) {
+    close_db_connection(&conn);
+    return FAIL;
+  }
+  for (long i = 1; i <= posts; i++) {
+    char user[32], title[64];
+    snprintf(user, sizeof(user), "user%ld", i % 1000);
+    snprintf(title, sizeof(title), "Synthetic post number %ld", i);
+    sqlite3_bind_int64(stmt, 1, i);
+    sqlite3_bind_text(stmt, 2, user, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, title, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(content_stmt, 1, i);
+    sqlite3_bind_text(content_stmt, 2, content, -1, SQLITE_STATIC);
+    sqlite3_step(content_stmt);
+    sqlite3_reset(content_stmt);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(content_stmt);
+  sqlite3_exec(conn.db, "COMMIT;", NULL, NULL, NULL);
+
+  close_db_connection(&conn);
+  return SUCCESS;
+}
+
+static void bench_db_path(long posts, char *db_path, size_t len) {
+  snprintf(db_path, len, "%s/blog_bench_%ld.db", BENCH_DB_DIR, posts);
+}
+
+// Opens the shared `db` on a synthetic database with the requested number
+// of posts (creating it if needed) and a Client that writes to /dev/null.
+static void *bench_setup(const MunitParameter params[], void *user_data) {
+  BenchFixture *fixture = malloc(sizeof(BenchFixture));
+  const char *posts_param = munit_parameters_get(params, "posts");
+  fixture->posts = posts_param ? atol(posts_param) : 1000;
+
+  debug = 0;
+
+  char db_path[MAX_GENERATED_LENGTH];
+  bench_db_path(fixture->posts, db_path, sizeof(db_path));
+
+  munit_assert_int(open_db_connection(&db, db_path), ==, 0);
+  munit_assert_int(create_blog_table(&db), ==, 0);
+  if (get_next_post_id(&db) != fixture->posts + 1) {
+    close_db_connection(&db);
+    unlink(db_path);
+    munit_logf(MUNIT_LOG_INFO, "building %s", db_path);
+    munit_assert_int(populate_bench_db(db_path, fixture->posts), ==, SUCCESS);
+    munit_assert_int(open_db_connection(&db, db_path), ==, 0);
+  }
+  munit_assert_int(migrate_blog_table(&db), ==, 0);
+
+  struct sockaddr_in addr = {0};
+  int sink_fd = open("/dev/null", O_WRONLY);
+  munit_assert_int(sink_fd, >=, 0);
+  fixture->client = client_new(sink_fd, &addr);
+
+  return fixture;
+}
+
+static void bench_tear_down(void *fixture_ptr) {
+  BenchFixture *fixture = fixture_ptr;
+  client_free(fixture->client);
+  close_db_connection(&db);
+  free(fixture);
+}
+
+// spread lookups over the table instead of hitting one hot row
+static int bench_post_id(const BenchFixture *fixture, long i) {
+  return (int)((i * 7919) % fixture->posts) + 1;
+}
+
+//// benches
+
+static MunitResult bench_parse_blog_post(const MunitParameter params[],
+                                         void *data) {
+  const char *query = "user=ahmad&title=Hello+world+from+the+bench"
+                      "&content=Lorem+ipsum+dolor+sit+amet+consectetur"
+                      "+adipiscing+elit+sed+do+eiusmod+tempor";
+  char user[MAX_GENERATED_LENGTH];
+  char title[MAX_GENERATED_LENGTH];
+  char content[MAX_GENERATED_LENGTH];
+  const long ops = 200000;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    parse_blog_post(query, user, title, content);
+  }
+  bench_stop(&timer, "parse_blog_post", 0, ops);
+
+  munit_assert_string_equal(user, "ahmad");
+  munit_assert_string_equal(title, "Hello world from the bench");
+  return MUNIT_OK;
+}
+
+static void bench_timer_fired(void *arg) { (*(long *)arg)++; }
+
+// arm, re-arm and cancel cost should not depend on how many timers exist
+static MunitResult bench_timer_wheel(const MunitParameter params[],
+                                     void *data) {
+  const long timers = 1000000;
+  Timer *pool = malloc(timers * sizeof(Timer));
+  TimerWheel *wheel = malloc(sizeof(TimerWheel));
+  timer_wheel_init(wheel);
+  long fired = 0;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < timers; i++) {
+    timer_init(&pool[i]);
+    // spread over every level, as idle/header/body deadlines would be
+    timer_arm(wheel, &pool[i], 1 + (i * 7919) % 400000, bench_timer_fired,
+              &fired);
+  }
+  bench_stop(&timer, "timer_arm", 0, timers);
+
+  bench_start(&timer);
+  for (long i = 0; i < timers; i++)
+    timer_arm(wheel, &pool[i], 1 + (i * 104729) % 400000, bench_timer_fired,
+              &fired);
+  bench_stop(&timer, "timer_arm (re-arm)", 0, timers);
+
+  bench_start(&timer);
+  for (long i = 0; i < timers; i += 2)
+    timer_cancel(wheel, &pool[i]);
+  bench_stop(&timer, "timer_cancel", 0, timers / 2);
+
+  bench_start(&timer);
+  timer_wheel_advance(wheel, 400001);
+  bench_stop(&timer, "timer_wheel_advance (per timer)", 0,
+             timers / 2);
+
+  munit_assert_long(fired, ==, timers / 2);
+  free(wheel);
+  free(pool);
+  return MUNIT_OK;
+}
+
+// connection setup should not touch malloc once the slab is warm
+static MunitResult bench_client_new(const MunitParameter params[],
+                                    void *data) {
+  const long ops = 1000000;
+  struct sockaddr_in addr = {0};
+
+  Client *warm = client_new(0, &addr);
+  int last_id = client_id(warm);
+  client_free(warm);
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    Client *cl = client_new(0, &addr); // fd 0 is never closed
+    munit_assert_int(client_id(cl), >, last_id);
+    last_id = client_id(cl);
+    client_free(cl);
+  }
+  bench_stop(&timer, "client_new + client_free", 0, ops);
+  return MUNIT_OK;
+}
+
+typedef struct {
+  char buf[4096];
+  int len;
+} BenchJsonSink;
+
+static int bench_json_sink(void *ctx, const char *data, int len) {
+  BenchJsonSink *sink = ctx;
+  if (sink->len + len > (int)sizeof(sink->buf))
+    sink->len = 0; // only the last document is checked
+  memcpy(sink->buf + sink->len, data, len);
+  sink->len += len;
+  return SUCCESS;
+}
+
+// a post as /api/posts/<id> writes it, including characters that need
+// escaping
+static MunitResult bench_json_writer(const MunitParameter params[],
+                                     void *data) {
+  const long ops = 200000;
+  const char *content = "Lorem ipsum \"dolor\" sit amet,\n\tconsectetur "
+                        "adipiscing elit \\ sed do eiusmod tempor \x01";
+  BenchJsonSink sink;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    sink.len = 0;
+    JsonWriter w;
+    json_writer_init(&w, bench_json_sink, &sink);
+    json_begin_object(&w);
+    json_key(&w, "id");
+    json_int(&w, i);
+    json_key(&w, "title");
+    json_string(&w, "Hello world from the bench");
+    json_key(&w, "tags");
+    json_begin_array(&w);
+    json_string(&w, "a");
+    json_null(&w);
+    json_end_array(&w);
+    json_key(&w, "content");
+    json_string(&w, content);
+    json_end_object(&w);
+    munit_assert_int(json_writer_result(&w), ==, SUCCESS);
+  }
+  bench_stop(&timer, "json_writer post", 0, ops);
+
+  sink.buf[sink.len] = '\0';
+  munit_assert_string_equal(
+      sink.buf, "{\"id\":199999,\"title\":\"Hello world from the bench\","
+                "\"tags\":[\"a\",null],\"content\":\"Lorem ipsum "
+                "\\\"dolor\\\" sit amet,\\n\\tconsectetur adipiscing elit "
+                "\\\\ sed do eiusmod tempor \\u0001\"}");
+  return MUNIT_OK;
+}
+
+static int bench_route_handler(Client *cl, char *request,
+                               const RouteParams *params) {
+  return SUCCESS;
+}
+
+// lookup cost should follow the path, not the number of routes
+static MunitResult bench_router_match(const MunitParameter params[],
+                                      void *data) {
+  const long ops = 1000000;
+  Router router;
+  router_init(&router);
+  char pattern[64];
+  for (int i = 0; i < 200; i++) {
+    snprintf(pattern, sizeof(pattern), "/api/v1/resource%d/:id", i);
+    munit_assert_int(router_add(&router, HTTP_GET, pattern,
+                                bench_route_handler), ==, SUCCESS);
+  }
+  router_add(&router, HTTP_GET, "/post/:id", bench_route_handler);
+  router_add(&router, HTTP_GET, "/:page", bench_route_handler);
+
+  const char *paths[][2] = {
+      {"router_match /post/:id", "/post/12345"},
+      {"router_match /:page", "/index"},
+      {"router_match 404", "/api/v1/nothing/here"},
+  };
+  for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+    const char *path = paths[p][1];
+    RouteHandler handler;
+    RouteParams route_params;
+    unsigned allowed;
+    int expected = p == 2 ? ROUTE_NOT_FOUND : ROUTE_FOUND;
+
+    BenchTimer timer;
+    bench_start(&timer);
+    for (long i = 0; i < ops; i++) {
+      munit_assert_int(router_match(&router, HTTP_GET, path, strlen(path),
+                                    &handler, &route_params, &allowed),
+                       ==, expected);
+    }
+    bench_stop(&timer, paths[p][0], 0, ops);
+  }
+  return MUNIT_OK;
+}
+
+static MunitResult bench_respond_to_http_request(const MunitParameter params[],
+                                                 void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 20000;
+  const char *routes[][2] = {
+      {"route GET /post/<id>", "GET /post/%d HTTP/1.1\r\n\r\n"},
+      {"route GET /index", "GET /index HTTP/1.1\r\n\r\n"},
+      {"route unknown method", "DELETE /post/%d HTTP/1.1\r\n\r\n"},
+  };
+
+  for (size_t r = 0; r < sizeof(routes) / sizeof(routes[0]); r++) {
+    char request[MAX_GENERATED_LENGTH];
+    BenchTimer timer;
+    bench_start(&timer);
+    for (long i = 0; i < ops; i++) {
+      snprintf(request, sizeof(request), routes[r][1],
+               bench_post_id(fixture, i));
+      int result = respond_to_http_request(fixture->client, request, "");
+      munit_assert_int(result, !=, FAIL);
+      client_end_request(fixture->client);
+    }
+    bench_stop(&timer, routes[r][0], fixture->posts, ops);
+  }
+  return MUNIT_OK;
+}
+
+static MunitResult bench_handle_post_request(const MunitParameter params[],
+                                             void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 50000;
+  char request[MAX_GENERATED_LENGTH];
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    snprintf(request, sizeof(request), "GET /post/%d HTTP/1.1\r\n\r\n",
+             bench_post_id(fixture, i));
+    munit_assert_int(handle_post_request(fixture->client, request), !=, FAIL);
+    client_end_request(fixture->client);
+  }
+  bench_stop(&timer, "handle_post_request", fixture->posts, ops);
+  return MUNIT_OK;
+}
+
+// bumps the generation every time, so each op streams the whole index
+// from the cursor instead of hitting the body cache
+static MunitResult bench_handle_post_index_request(const MunitParameter params[],
+                                                   void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 5;
+  char request[] = "GET /posts HTTP/1.1\r\n\r\n";
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    index_generation++;
+    munit_assert_int(handle_post_index_request(fixture->client, request), !=,
+                     FAIL);
+    munit_assert_int(client_flush(fixture->client), !=, FAIL);
+    client_end_request(fixture->client);
+  }
+  bench_stop(&timer, "handle_post_index_request", fixture->posts, ops);
+  return MUNIT_OK;
+}
+
+// what a publish costs the feed: one entry rendered, the feed reassembled
+// and compressed; no query
+static MunitResult bench_feed_add_post(const MunitParameter params[],
+                                       void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 5000;
+  munit_assert_int(feed_reload(&db), ==, SUCCESS);
+  int next_id = get_next_post_id(&db);
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    feed_add_post(next_id + i, "bench", 5, "Published by the bench", 22);
+  }
+  bench_stop(&timer, "feed_add_post", fixture->posts, ops);
+
+  time_t last_modified;
+  CachedBody *feed = feed_get(&db, &last_modified);
+  munit_assert_not_null(feed);
+  char *xml = strndup(feed->body, feed->body_len);
+  munit_assert_not_null(strstr(xml, "Published by the bench"));
+  free(xml);
+  cached_body_release(feed);
+  feed_reload(&db);
+  return MUNIT_OK;
+}
+
+// a post read from a snapshot (see post_snapshot.h) of the bench DB,
+// which is written first if it is not there yet
+static MunitResult bench_post_snapshot_find(const MunitParameter params[],
+                                            void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 1000000;
+  char path[MAX_GENERATED_LENGTH];
+  snprintf(path, sizeof(path), "%s/blog_bench_%ld.snapshot", BENCH_DB_DIR,
+           fixture->posts);
+
+  PostSnapshot snapshot;
+  if (post_snapshot_open(&snapshot, path) == FAIL) {
+    munit_logf(MUNIT_LOG_INFO, "writing %s", path);
+    munit_assert_long(post_snapshot_write(&db, path, render_post_page, NULL),
+                      ==, fixture->posts);
+    munit_assert_int(post_snapshot_open(&snapshot, path), ==, SUCCESS);
+  }
+
+  long bytes = 0;
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    const char *body, *gzip_body;
+    int body_len, gzip_len;
+    munit_assert_int(post_snapshot_find(&snapshot, bench_post_id(fixture, i),
+                                        &body, &body_len, &gzip_body,
+                                        &gzip_len),
+                     ==, 1);
+    bytes += body[body_len - 1]; // touch the page
+  }
+  bench_stop(&timer, "post_snapshot_find", fixture->posts, ops);
+  munit_assert_long(bytes, >, 0);
+  post_snapshot_close(&snapshot);
+  return MUNIT_OK;
+}
+
+static MunitResult bench_open_close_db(const MunitParameter params[],
+                                       void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 2000;
+  char db_path[MAX_GENERATED_LENGTH];
+  bench_db_path(fixture->posts, db_path, sizeof(db_path));
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    DBConnection conn;
+    munit_assert_int(open_db_connection(&conn, db_path), ==, 0);
+    munit_assert_int(close_db_connection(&conn), ==, 0);
+  }
+  bench_stop(&timer, "open+close_db_connection", fixture->posts, ops);
+  return MUNIT_OK;
+}
+
+static MunitResult bench_create_blog_table(const MunitParameter params[],
+                                           void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 20000;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    munit_assert_int(create_blog_table(&db), ==, 0);
+  }
+  bench_stop(&timer, "create_blog_table", fixture->posts, ops);
+  return MUNIT_OK;
+}
+
+static MunitResult bench_insert_blog_post(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 20000;
+  BlogPost post = {0, "bench", "Inserted by the bench",
+                   "Lorem ipsum dolor sit amet", 0, NULL};
+
+  // roll back afterwards so the cached database keeps its size
+  sqlite3_exec(db.db, "BEGIN;", NULL, NULL, NULL);
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    munit_assert_int(insert_blog_post(&db, &post), ==, 0);
+  }
+  bench_stop(&timer, "insert_blog_post", fixture->posts, ops);
+  sqlite3_exec(db.db, "ROLLBACK;", NULL, NULL, NULL);
+  return MUNIT_OK;
+}
+
+// a 1MB publish body fed in 16K pieces, as the socket would deliver it;
+// aborted at the end (a rollback) so the cached database keeps its size
+static MunitResult bench_blog_post_upload(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 50;
+  const int content_len = 1024 * 1024;
+  const int piece_len = 16 * 1024;
+
+  const char *fields = "user=bench&title=Streamed+by+the+bench&content=";
+  int body_len = strlen(fields) + content_len;
+  char *body = malloc(body_len);
+  memcpy(body, fields, strlen(fields));
+  memset(body + strlen(fields), 'x', content_len);
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    BlogPostUpload upload;
+    munit_assert_int(blog_post_upload_begin(&upload, &db, body_len), ==, 0);
+    for (int off = 0; off < body_len; off += piece_len) {
+      int n = body_len - off < piece_len ? body_len - off : piece_len;
+      munit_assert_int(blog_post_upload_feed(&upload, body + off, n), ==, 0);
+    }
+    munit_assert_int(upload.content_len, ==, content_len);
+    blog_post_upload_abort(&upload);
+  }
+  bench_stop(&timer, "blog_post_upload 1MB", fixture->posts, ops);
+
+  free(body);
+  return MUNIT_OK;
+}
+
+// NDJSON rows fed in 64K pieces, as main --import reads them; one batch
+// short of a commit, so the abort at the end leaves the cached database
+// as it was
+static MunitResult bench_post_import(const MunitParameter params[],
+                                     void *data) {
+  BenchFixture *fixture = data;
+  const long ops = IMPORT_BATCH_ROWS - 1;
+  const int piece_len = 64 * 1024;
+
+  int cap = ops * 128;
+  char *body = malloc(cap);
+  int body_len = 0;
+  for (long i = 0; i < ops; i++) {
+    body_len += snprintf(body + body_len, cap - body_len,
+                         "{\"user\":\"bench\",\"title\":\"Imported %ld\","
+                         "\"content\":\"Lorem ipsum\\ndolor sit amet\"}\n",
+                         i);
+  }
+
+  PostImport import;
+  munit_assert_int(post_import_begin(&import, &db), ==, SUCCESS);
+  BenchTimer timer;
+  bench_start(&timer);
+  for (int off = 0; off < body_len; off += piece_len) {
+    int n = body_len - off < piece_len ? body_len - off : piece_len;
+    munit_assert_int(post_import_feed(&import, body + off, n), ==, SUCCESS);
+  }
+  bench_stop(&timer, "post_import row", fixture->posts, ops);
+  munit_assert_long(import.imported, ==, ops);
+  munit_assert_long(import.rows.committed_rows, ==, 0);
+  post_import_abort(&import);
+
+  free(body);
+  return MUNIT_OK;
+}
+
+static MunitResult bench_select_blog_post(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 100000;
+  Arena arena;
+  arena_init(&arena);
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    BlogPost post;
+    munit_assert_int(
+        select_blog_post(&db, bench_post_id(fixture, i), &post, &arena), ==,
+        0);
+    arena_reset(&arena);
+  }
+  bench_stop(&timer, "select_blog_post", fixture->posts, ops);
+  arena_free(&arena);
+  return MUNIT_OK;
+}
+
+static int count_title(void *ctx, int post_id, const char *title) {
+  (*(long *)ctx)++;
+  return 0;
+}
+
+// the listing /posts renders, without the rendering
+static MunitResult bench_blog_post_titles(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 5;
+  long rows = 0;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    munit_assert_int(for_each_blog_post_title(&db, count_title, &rows), ==,
+                     0);
+  }
+  bench_stop(&timer, "for_each_blog_post_title", fixture->posts, ops);
+  munit_assert_long(rows, ==, fixture->posts * ops);
+  return MUNIT_OK;
+}
+
+// one page of an author's posts, as /user/<name> reads it
+static MunitResult bench_user_post_titles(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 10000;
+  long rows = 0;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    char user[32];
+    snprintf(user, sizeof(user), "user%ld", i % 1000);
+    munit_assert_int(for_each_user_post_title(&db, user, INT_MAX, 50,
+                                              count_title, &rows),
+                     ==, 0);
+  }
+  bench_stop(&timer, "for_each_user_post_title", fixture->posts, ops);
+  munit_assert_long(rows, >, 0);
+  return MUNIT_OK;
+}
+
+static MunitResult bench_get_next_post_id(const MunitParameter params[],
+                                          void *data) {
+  BenchFixture *fixture = data;
+  const long ops = 100000;
+
+  BenchTimer timer;
+  bench_start(&timer);
+  for (long i = 0; i < ops; i++) {
+    munit_assert_int(get_next_post_id(&db), ==, fixture->posts + 1);
+  }
+  bench_stop(&timer, "get_next_post_id", fixture->posts, ops);
+  return MUNIT_OK;
+}
+
+//// import parser
+
+// Each test imports into a fresh database of its own and reads back what
+// went in.
+#define IMPORT_TEST_DB BENCH_DB_DIR "/blog_import_test.db"
+
+static void *import_setup(const MunitParameter params[], void *user_data) {
+  debug = 0;
+  unlink(IMPORT_TEST_DB);
+  munit_assert_int(open_db_connection(&db, IMPORT_TEST_DB), ==, 0);
+  munit_assert_int(create_blog_table(&db), ==, 0);
+  return NULL;
+}
+
+static void import_tear_down(void *fixture) {
+  close_db_connection(&db);
+  unlink(IMPORT_TEST_DB);
+}
+
+// Feeds input piece_len bytes at a time (so records split at every point
+// when it is 1) and finishes the import.
+static PostImport import_in_pieces(const char *input, int piece_len) {
+  PostImport import;
+  munit_assert_int(post_import_begin(&import, &db), ==, SUCCESS);
+  int len = strlen(input);
+  for (int off = 0; off < len; off += piece_len) {
+    int n = len - off < piece_len ? len - off : piece_len;
+    munit_assert_int(post_import_feed(&import, input + off, n), ==, SUCCESS);
+  }
+  munit_assert_int(post_import_finish(&import), ==, SUCCESS);
+  return import;
+}
+
+// The nth imported post (from 1), fields joined by '|'.
+static void imported_post(int n, char *out, int out_len) {
+  sqlite3_stmt *stmt;
+  munit_assert_int(
+      sqlite3_prepare_v2(db.db,
+                         "SELECT user || '|' || title || '|' || content "
+                         "FROM blog_posts JOIN blog_post_contents "
+                         "USING (post_id) ORDER BY post_id LIMIT 1 OFFSET ?;",
+                         -1, &stmt, NULL),
+      ==, SQLITE_OK);
+  sqlite3_bind_int(stmt, 1, n - 1);
+  munit_assert_int(sqlite3_step(stmt), ==, SQLITE_ROW);
+  snprintf(out, out_len, "%s", (const char *)sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+}
+
+static MunitResult test_import_ndjson(const MunitParameter params[],
+                                      void *data) {
+  const char *input =
+      "{\"user\": \"ann\", \"title\": \"Esc \\\"q\\\" \\\\ \\/\","
+      " \"content\": \"a\\nb\\tc\", \"tags\": [1, {\"x\": \"}\"}]}\n"
+      "{\"title\":\"Pair \\ud83d\\ude00\",\"content\":\"\\u00e9\\u20ac\","
+      "\"user\":null}\r\n"
+      "\n"
+      "{\"title\":\"Lone \\ud83d.\",\"content\":\"\\udc00\"}\n"
+      "{\"title\": \"no content\"}\n"
+      "not json\n"
+      "{\"title\":\"bad\",\"content\":\"\\x\"}\n"
+      "{\"title\":\"last\",\"content\":\"no newline\"}";
+
+  // whole, then split at every byte
+  int pieces[] = {strlen(input), 1};
+  for (int i = 0; i < 2; i++) {
+    sqlite3_exec(db.db, "DELETE FROM blog_posts; DELETE FROM blog_post_contents;",
+                 NULL, NULL, NULL);
+    PostImport import = import_in_pieces(input, pieces[i]);
+    munit_assert_int(import.format, ==, IMPORT_FORMAT_NDJSON);
+    munit_assert_long(import.imported, ==, 4);
+    munit_assert_long(import.skipped, ==, 3);
+
+    char post[256];
+    imported_post(1, post, sizeof(post));
+    munit_assert_string_equal(post, "ann|Esc \"q\" \\ /|a\nb\tc");
+    imported_post(2, post, sizeof(post));
+    munit_assert_string_equal(post, "|Pair \xF0\x9F\x98\x80|\xC3\xA9\xE2\x82\xAC");
+    // unpaired surrogates become U+FFFD
+    imported_post(3, post, sizeof(post));
+    munit_assert_string_equal(post, "|Lone \xEF\xBF\xBD.|\xEF\xBF\xBD");
+    imported_post(4, post, sizeof(post));
+    munit_assert_string_equal(post, "|last|no newline");
+  }
+  return MUNIT_OK;
+}
+
+static MunitResult test_import_csv_header(const MunitParameter params[],
+                                          void *data) {
+  // columns in another order, matched without regard to case, plus one
+  // that is ignored
+  const char *input = "Content,extra,TITLE,user\r\n"
+                      "\"line one\nline two\",x,\"Say \"\"hi\"\"\",bob\r\n"
+                      "plain,,\"a, b\",\n"
+                      "\"\"\"\",y,\"\",carol\n";
+
+  int pieces[] = {strlen(input), 1};
+  for (int i = 0; i < 2; i++) {
+    sqlite3_exec(db.db, "DELETE FROM blog_posts; DELETE FROM blog_post_contents;",
+                 NULL, NULL, NULL);
+    PostImport import = import_in_pieces(input, pieces[i]);
+    munit_assert_int(import.format, ==, IMPORT_FORMAT_CSV);
+    munit_assert_long(import.imported, ==, 3);
+    munit_assert_long(import.skipped, ==, 0);
+
+    char post[256];
+    imported_post(1, post, sizeof(post));
+    munit_assert_string_equal(post, "bob|Say \"hi\"|line one\nline two");
+    imported_post(2, post, sizeof(post));
+    munit_assert_string_equal(post, "|a, b|plain");
+    imported_post(3, post, sizeof(post));
+    munit_assert_string_equal(post, "carol||\"");
+  }
+  return MUNIT_OK;
+}
+
+static MunitResult test_import_csv_no_header(const MunitParameter params[],
+                                             void *data) {
+  // a first row that does not name both title and content is a record,
+  // in user,title,content order; short rows are skipped
+  const char *input = "dave,title,body\n"
+                      "erin,Second\n"
+                      "frank,Third,\"multi\r\nline\"\n";
+
+  PostImport import = import_in_pieces(input, 1);
+  munit_assert_long(import.imported, ==, 2);
+  munit_assert_long(import.skipped, ==, 1);
+
+  char post[256];
+  imported_post(1, post, sizeof(post));
+  munit_assert_string_equal(post, "dave|title|body");
+  imported_post(2, post, sizeof(post));
+  munit_assert_string_equal(post, "frank|Third|multi\r\nline");
+  return MUNIT_OK;
+}
+
+// rows committed mid-body stay, and the import carries on after
+static MunitResult test_import_commit(const MunitParameter params[],
+                                      void *data) {
+  PostImport import;
+  munit_assert_int(post_import_begin(&import, &db), ==, SUCCESS);
+  const char *first = "{\"title\":\"one\",\"content\":\"1\"}\n{\"title\":\"tw";
+  const char *rest = "o\",\"content\":\"2\"}\n";
+  munit_assert_int(post_import_feed(&import, first, strlen(first)), ==,
+                   SUCCESS);
+  munit_assert_int(post_import_commit(&import), ==, SUCCESS);
+  munit_assert_long(import.rows.committed_rows, ==, 1);
+  munit_assert_int(import.rows.in_transaction, ==, 0);
+  munit_assert_int(post_import_feed(&import, rest, strlen(rest)), ==, SUCCESS);
+  munit_assert_int(post_import_finish(&import), ==, SUCCESS);
+  munit_assert_long(import.rows.committed_rows, ==, 2);
+
+  char post[256];
+  imported_post(2, post, sizeof(post));
+  munit_assert_string_equal(post, "|two|2");
+  return MUNIT_OK;
+}
+
+//// HTTP/2
+
+// What a decoded block held, as "name: value\n" lines.
+typedef struct {
+  char text[1024];
+  int len;
+} HeaderList;
+
+static void list_header(void *ctx, const char *name, size_t name_len,
+                        const char *value, size_t value_len) {
+  HeaderList *list = ctx;
+  list->len += snprintf(list->text + list->len, sizeof(list->text) - list->len,
+                        "%.*s: %.*s\n", (int)name_len, name, (int)value_len,
+                        value);
+}
+
+static int decode_block(HpackTable *table, const char *block, int block_len,
+                        HeaderList *list) {
+  list->len = 0;
+  list->text[0] = '\0';
+  return hpack_decode(table, (const unsigned char *)block, block_len,
+                      list_header, list);
+}
+
+// what we encode, the peer's decoder reads back
+static MunitResult test_hpack_round_trip(const MunitParameter params[],
+                                         void *data) {
+  const char *headers[][2] = {
+      {":status", "200"}, // all in the static table
+      {":status", "304"}, // static name, new value
+      {"content-type", "text/html"},
+      {"etag", "\"post-1\""},
+      {"x-long", "a value longer than one byte's worth of length prefix "
+                 "so that the integer takes a continuation byte"},
+      {"x-empty", ""},
+  };
+  unsigned char block[1024];
+  int block_len = 0;
+  char expected[1024];
+  int expected_len = 0;
+  for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+    int len = hpack_encode_header(block + block_len, sizeof(block) - block_len,
+                                  headers[i][0], strlen(headers[i][0]),
+                                  headers[i][1], strlen(headers[i][1]));
+    munit_assert_int(len, >, 0);
+    block_len += len;
+    expected_len += snprintf(expected + expected_len,
+                             sizeof(expected) - expected_len, "%s: %s\n",
+                             headers[i][0], headers[i][1]);
+  }
+  unsigned char small[2];
+  munit_assert_int(hpack_encode_header(small, sizeof(small), "x-long", 6,
+                                       "value", 5),
+                   ==, -1);
+
+  HpackTable table;
+  hpack_table_init(&table, HPACK_DEFAULT_TABLE_SIZE);
+  HeaderList list;
+  munit_assert_int(decode_block(&table, (char *)block, block_len, &list), ==,
+                   0);
+  munit_assert_string_equal(list.text, expected);
+
+  // RFC 7541 C.4.1 and C.4.2: Huffman strings, and a second request that
+  // leans on the dynamic table the first one filled
+  munit_assert_int(decode_block(&table,
+                                "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a"
+                                "\x6b\xa0\xab\x90\xf4\xff",
+                                17, &list),
+                   ==, 0);
+  munit_assert_string_equal(list.text, ":method: GET\n:scheme: http\n:path: /\n"
+                                       ":authority: www.example.com\n");
+  munit_assert_int(decode_block(&table,
+                                "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c"
+                                "\xbf",
+                                12, &list),
+                   ==, 0);
+  munit_assert_string_equal(list.text,
+                            ":method: GET\n:scheme: http\n:path: /\n"
+                            ":authority: www.example.com\n"
+                            "cache-control: no-cache\n");
+  hpack_table_free(&table);
+  return MUNIT_OK;
+}
+
+static MunitResult test_hpack_bad_input(const MunitParameter params[],
+                                        void *data) {
+  const struct {
+    const char *block;
+    int len;
+  } blocks[] = {
+      {"\xff", 1},             // index cut off mid-integer
+      {"\x80", 1},             // index 0
+      {"\xbe", 1},             // index 62 with an empty dynamic table
+      {"\x40\x0a" "ab", 4},    // name longer than the block
+      {"\x00\x01", 2},         // value missing
+      {"\x3f\xe2\x1f", 3},     // table size update past the setting
+      {"\x00\x81\x00", 3},     // Huffman padding that is not EOS
+      {"\x00\x8a\xff\xff\xff\xff", 6}, // Huffman EOS inside a string
+  };
+  for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+    HpackTable table;
+    hpack_table_init(&table, HPACK_DEFAULT_TABLE_SIZE);
+    HeaderList list;
+    munit_assert_int(decode_block(&table, blocks[i].block, blocks[i].len,
+                                  &list),
+                     ==, -1);
+    hpack_table_free(&table);
+  }
+  return MUNIT_OK;
+}
+
+// frame types and flags, as on the wire
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FLAG_END_STREAM 0x1
+#define FLAG_END_HEADERS 0x4
+
+// An h2 Client on one end of a socket pair; the test is the peer.
+typedef struct {
+  Client *client;
+  int peer_fd;
+  char out[64 * 1024]; // what the server sent, frame by frame
+  int out_len;
+} H2Fixture;
+
+static void *h2_setup(const MunitParameter params[], void *user_data) {
+  debug = 0;
+  H2Fixture *fixture = calloc(1, sizeof(H2Fixture));
+  int fds[2];
+  munit_assert_int(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+  struct sockaddr_in addr = {0};
+  fixture->client = client_new(fds[0], &addr);
+  fixture->peer_fd = fds[1];
+  h2_start(fixture->client);
+  return fixture;
+}
+
+static void h2_tear_down(void *fixture_ptr) {
+  H2Fixture *fixture = fixture_ptr;
+  h2_connection_free(fixture->client->h2);
+  fixture->client->h2 = NULL;
+  client_free(fixture->client);
+  close(fixture->peer_fd);
+  free(fixture);
+}
+
+static int append_frame(char *buffer, int len, int type, int flags,
+                        int stream_id, const void *payload, int payload_len) {
+  unsigned char *frame = (unsigned char *)buffer + len;
+  frame[0] = payload_len >> 16;
+  frame[1] = payload_len >> 8;
+  frame[2] = payload_len;
+  frame[3] = type;
+  frame[4] = flags;
+  frame[5] = stream_id >> 24;
+  frame[6] = stream_id >> 16;
+  frame[7] = stream_id >> 8;
+  frame[8] = stream_id;
+  memcpy(frame + 9, payload, payload_len);
+  return len + 9 + payload_len;
+}
+
+// Hands input to the connection as its socket would, and collects what
+// it sends back. Returns what h2_handle_input did.
+static int h2_feed(H2Fixture *fixture, const char *input, int input_len) {
+  Client *cl = fixture->client;
+  munit_assert_int(write(fixture->peer_fd, input, input_len), ==, input_len);
+  for (int read = 0; read < input_len;) {
+    int n = client_read_input(cl, MAX_MESSAGE_LENGTH);
+    munit_assert_int(n, >, 0);
+    read += n;
+  }
+  int result = h2_handle_input(cl);
+  munit_assert_int(client_flush(cl), ==, SUCCESS);
+  client_end_request(cl);
+
+  int n;
+  while ((n = recv(fixture->peer_fd, fixture->out + fixture->out_len,
+                   sizeof(fixture->out) - fixture->out_len, MSG_DONTWAIT)) >
+         0)
+    fixture->out_len += n;
+  return result;
+}
+
+// The payload of the last frame of type on stream_id the server sent, or
+// NULL; *flags and *payload_len are set.
+static const unsigned char *sent_frame(H2Fixture *fixture, int type,
+                                       int stream_id, int *flags,
+                                       int *payload_len) {
+  const unsigned char *found = NULL;
+  const unsigned char *frame = (unsigned char *)fixture->out;
+  const unsigned char *end = frame + fixture->out_len;
+  while (end - frame >= 9) {
+    int len = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+    int id = (frame[5] << 24) | (frame[6] << 16) | (frame[7] << 8) | frame[8];
+    if (frame[3] == type && id == stream_id) {
+      found = frame + 9;
+      *flags = frame[4];
+      *payload_len = len;
+    }
+    frame += 9 + len;
+  }
+  return found;
+}
+
+static int goaway_error(H2Fixture *fixture) {
+  int flags, len;
+  const unsigned char *goaway =
+      sent_frame(fixture, FRAME_GOAWAY, 0, &flags, &len);
+  if (!goaway || len < 8)
+    return -1;
+  return (goaway[4] << 24) | (goaway[5] << 16) | (goaway[6] << 8) | goaway[7];
+}
+
+// the preface, then SETTINGS with the stream window the test wants
+static int client_start(char *buffer, int initial_window) {
+  int len = H2_PREFACE_LENGTH;
+  memcpy(buffer, H2_PREFACE, len);
+  unsigned char settings[6] = {0, 0x4, initial_window >> 24,
+                               initial_window >> 16, initial_window >> 8,
+                               initial_window};
+  return append_frame(buffer, len, FRAME_SETTINGS, 0, 0, settings,
+                      sizeof(settings));
+}
+
+// HEADERS for method and path, plus one more field when name is not NULL
+static int append_headers(char *buffer, int len, int stream_id, int flags,
+                          const char *method, const char *path,
+                          const char *name, const char *value) {
+  const char *headers[][2] = {
+      {":method", method}, {":scheme", "http"}, {":path", path},
+      {":authority", "test"}, {name, value},
+  };
+  int count = name ? 5 : 4;
+  unsigned char block[256];
+  int block_len = 0;
+  for (int i = 0; i < count; i++)
+    block_len += hpack_encode_header(
+        block + block_len, sizeof(block) - block_len, headers[i][0],
+        strlen(headers[i][0]), headers[i][1], strlen(headers[i][1]));
+  return append_frame(buffer, len, FRAME_HEADERS, FLAG_END_HEADERS | flags,
+                      stream_id, block, block_len);
+}
+
+static int append_request(char *buffer, int len, int stream_id,
+                          const char *path) {
+  return append_headers(buffer, len, stream_id, FLAG_END_STREAM, "GET", path,
+                        NULL, NULL);
+}
+
+// WINDOW_UPDATE increments for stream_id the server sent from out + from
+static int window_credit(H2Fixture *fixture, int stream_id, int from) {
+  int credit = 0;
+  const unsigned char *frame = (unsigned char *)fixture->out + from;
+  const unsigned char *end = (unsigned char *)fixture->out + fixture->out_len;
+  while (end - frame >= 9) {
+    int len = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+    int id = (frame[5] << 24) | (frame[6] << 16) | (frame[7] << 8) | frame[8];
+    if (frame[3] == FRAME_WINDOW_UPDATE && id == stream_id)
+      credit += (frame[9] << 24) | (frame[10] << 16) | (frame[11] << 8) |
+                frame[12];
+    frame += 9 + len;
+  }
+  return credit;
+}
+
+// a request answered as HEADERS then DATA, decoded as a client would
+static MunitResult test_h2_request(const MunitParameter params[],
+                                   void *data) {
+  H2Fixture *fixture = data;
+  char input[1024];
+  int len = client_start(input, 65535);
+  len = append_request(input, len, 1, "/no-such-page");
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+
+  int flags, payload_len;
+  munit_assert_not_null(
+      sent_frame(fixture, FRAME_SETTINGS, 0, &flags, &payload_len));
+  const unsigned char *headers =
+      sent_frame(fixture, FRAME_HEADERS, 1, &flags, &payload_len);
+  munit_assert_not_null(headers);
+  munit_assert_int(flags & FLAG_END_STREAM, ==, 0);
+
+  HpackTable table;
+  hpack_table_init(&table, HPACK_DEFAULT_TABLE_SIZE);
+  HeaderList list;
+  munit_assert_int(decode_block(&table, (const char *)headers, payload_len,
+                                &list),
+                   ==, 0);
+  hpack_table_free(&table);
+  munit_assert_not_null(strstr(list.text, ":status: 404\n"));
+  munit_assert_null(strstr(list.text, "connection:"));
+
+  const unsigned char *body =
+      sent_frame(fixture, FRAME_DATA, 1, &flags, &payload_len);
+  munit_assert_not_null(body);
+  munit_assert_int(flags & FLAG_END_STREAM, ==, FLAG_END_STREAM);
+  munit_assert_memory_equal(payload_len, body, "Not found\n");
+  return MUNIT_OK;
+}
+
+// a GOAWAY from the peer waits for answers held back by flow control
+static MunitResult test_h2_goaway(const MunitParameter params[], void *data) {
+  H2Fixture *fixture = data;
+  char input[1024];
+  int len = client_start(input, 0);
+  len = append_request(input, len, 1, "/no-such-page");
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  int flags, payload_len;
+  munit_assert_null(sent_frame(fixture, FRAME_DATA, 1, &flags, &payload_len));
+
+  static const unsigned char no_error[8] = {0, 0, 0, 1, 0, 0, 0, 0};
+  len = append_frame(input, 0, FRAME_GOAWAY, 0, 0, no_error, 8);
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+
+  // no new streams once the peer has said goodbye
+  len = append_request(input, 0, 3, "/no-such-page");
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  munit_assert_null(
+      sent_frame(fixture, FRAME_HEADERS, 3, &flags, &payload_len));
+
+  static const unsigned char increment[4] = {0, 0, 0x10, 0};
+  len = append_frame(input, 0, FRAME_WINDOW_UPDATE, 0, 1, increment, 4);
+  munit_assert_int(h2_feed(fixture, input, len), ==, FAIL);
+  const unsigned char *body =
+      sent_frame(fixture, FRAME_DATA, 1, &flags, &payload_len);
+  munit_assert_not_null(body);
+  munit_assert_int(flags & FLAG_END_STREAM, ==, FLAG_END_STREAM);
+  munit_assert_memory_equal(payload_len, body, "Not found\n");
+  return MUNIT_OK;
+}
+
+// a body's bytes go back to the connection window once it has been used,
+// not as they arrive
+static MunitResult test_h2_window(const MunitParameter params[], void *data) {
+  H2Fixture *fixture = data;
+  char input[1024];
+  int len = client_start(input, 65535);
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  munit_assert_int(window_credit(fixture, 0, 0), ==,
+                   H2_MAX_BUFFERED_BODY - 65535);
+
+  int from = fixture->out_len;
+  len = append_headers(input, 0, 1, 0, "POST", "/no-such-page", NULL, NULL);
+  len = append_frame(input, len, FRAME_DATA, 0, 1, "title=a", 7);
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  munit_assert_int(window_credit(fixture, 1, from), ==, 7);
+  munit_assert_int(window_credit(fixture, 0, from), ==, 0);
+  munit_assert_int(fixture->client->h2->buffered_body, ==, 7);
+
+  from = fixture->out_len;
+  len = append_frame(input, 0, FRAME_DATA, FLAG_END_STREAM, 1, "&b", 2);
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  munit_assert_int(window_credit(fixture, 0, from), ==, 9);
+  munit_assert_int(fixture->client->h2->buffered_body, ==, 0);
+  int flags, payload_len;
+  munit_assert_not_null(
+      sent_frame(fixture, FRAME_HEADERS, 1, &flags, &payload_len));
+  return MUNIT_OK;
+}
+
+// header fields that would change the request text we rebuild end the
+// stream, not the connection
+static MunitResult test_h2_malformed_header(const MunitParameter params[],
+                                            void *data) {
+  H2Fixture *fixture = data;
+  const char *kind = munit_parameters_get(params, "field");
+  const char *path = "/no-such-page", *name = NULL, *value = NULL;
+  if (!strcmp(kind, "crlf")) {
+    name = "x-a";
+    value = "1\r\nx-injected: 1";
+  } else if (!strcmp(kind, "nul")) {
+    name = "x-a";
+    value = "1\0" "2";
+  } else if (!strcmp(kind, "uppercase")) {
+    name = "X-A";
+    value = "1";
+  } else {
+    path = "/no-such-page HTTP/1.0";
+  }
+
+  char input[1024];
+  int len = client_start(input, 65535);
+  if (!strcmp(kind, "nul")) {
+    // strlen would stop at the NUL
+    unsigned char block[256];
+    int block_len = hpack_encode_header(block, sizeof(block), ":method", 7,
+                                        "GET", 3);
+    block_len += hpack_encode_header(block + block_len,
+                                     sizeof(block) - block_len, ":path", 5,
+                                     path, strlen(path));
+    block_len += hpack_encode_header(block + block_len,
+                                     sizeof(block) - block_len, name, 3,
+                                     value, 3);
+    len = append_frame(input, len, FRAME_HEADERS,
+                       FLAG_END_HEADERS | FLAG_END_STREAM, 1, block,
+                       block_len);
+  } else {
+    len = append_headers(input, len, 1, FLAG_END_STREAM, "GET", path, name,
+                         value);
+  }
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+
+  int flags, payload_len;
+  munit_assert_null(
+      sent_frame(fixture, FRAME_HEADERS, 1, &flags, &payload_len));
+  const unsigned char *rst =
+      sent_frame(fixture, FRAME_RST_STREAM, 1, &flags, &payload_len);
+  munit_assert_not_null(rst);
+  munit_assert_int(rst[3], ==, 0x1); // PROTOCOL_ERROR
+  munit_assert_int(fixture->client->h2->stream_count, ==, 0);
+
+  // the connection carries on
+  len = append_request(input, 0, 3, "/no-such-page");
+  munit_assert_int(h2_feed(fixture, input, len), ==, SUCCESS);
+  munit_assert_not_null(
+      sent_frame(fixture, FRAME_HEADERS, 3, &flags, &payload_len));
+  return MUNIT_OK;
+}
+
+// input that ends the connection, and the GOAWAY error it gets
+static MunitResult test_h2_bad_input(const MunitParameter params[],
+                                     void *data) {
+  H2Fixture *fixture = data;
+  char input[32 * 1024];
+  int len;
+  const char *kind = munit_parameters_get(params, "input");
+
+  if (!strcmp(kind, "preface")) {
+    len = sprintf(input, "GET / HTTP/1.1\r\nHost: test\r\n\r\n");
+    munit_assert_int(h2_feed(fixture, input, len), ==, FAIL);
+    munit_assert_int(goaway_error(fixture), ==, 0x1); // PROTOCOL_ERROR
+  } else if (!strcmp(kind, "stream0")) {
+    len = append_request(input, client_start(input, 65535), 0, "/");
+    munit_assert_int(h2_feed(fixture, input, len), ==, FAIL);
+    munit_assert_int(goaway_error(fixture), ==, 0x1);
+  } else if (!strcmp(kind, "oversized")) {
+    static char payload[H2_MAX_FRAME_SIZE + 1];
+    len = append_frame(input, client_start(input, 65535), FRAME_DATA, 0, 1,
+                       payload, sizeof(payload));
+    munit_assert_int(h2_feed(fixture, input, len), ==, FAIL);
+    munit_assert_int(goaway_error(fixture), ==, 0x6); // FRAME_SIZE_ERROR
+  } else {
+    len = append_frame(input, client_start(input, 65535), FRAME_HEADERS,
+                       FLAG_END_HEADERS | FLAG_END_STREAM, 1, "\xbe", 1);
+    munit_assert_int(h2_feed(fixture, input, len), ==, FAIL);
+    munit_assert_int(goaway_error(fixture), ==, 0x9); // COMPRESSION_ERROR
+  }
+  return MUNIT_OK;
+}
+
+// the server's own shape of routes: a literal POST-only path beside a
+// GET parameter at the same position
+static MunitResult test_router_methods(const MunitParameter params[],
+                                       void *data) {
+  Router router;
+  router_init(&router);
+  router_add(&router, HTTP_GET, "/:page", bench_route_handler);
+  router_add(&router, HTTP_POST, "/publish", bench_route_handler);
+  router_add(&router, HTTP_GET, "/post/:id", bench_route_handler);
+
+  RouteHandler handler = NULL;
+  RouteParams route_params;
+  unsigned allowed = 0;
+  // HEAD takes the GET handler
+  munit_assert_int(router_match(&router, HTTP_HEAD, "/post/7", 7, &handler,
+                                &route_params, &allowed),
+                   ==, ROUTE_FOUND);
+  munit_assert_true(handler == bench_route_handler);
+  munit_assert_int(route_params.count, ==, 1);
+
+  // GET /publish backs off to /:page
+  munit_assert_int(router_match(&router, HTTP_GET, "/publish", 8, &handler,
+                                &route_params, &allowed),
+                   ==, ROUTE_FOUND);
+
+  // what every branch the path reaches takes
+  munit_assert_int(router_match(&router, HTTP_DELETE, "/publish", 8, &handler,
+                                &route_params, &allowed),
+                   ==, ROUTE_METHOD_NOT_ALLOWED);
+  munit_assert_int(allowed, ==,
+                   (1u << HTTP_GET) | (1u << HTTP_HEAD) | (1u << HTTP_POST));
+  munit_assert_int(route_params.count, ==, 0);
+
+  munit_assert_int(router_match(&router, HTTP_POST, "/post/7", 7, &handler,
+                                &route_params, &allowed),
+                   ==, ROUTE_METHOD_NOT_ALLOWED);
+  munit_assert_int(allowed, ==, (1u << HTTP_GET) | (1u << HTTP_HEAD));
+
+  munit_assert_int(router_match(&router, HTTP_GET, "/post/7/x", 9, &handler,
+                                &route_params, &allowed),
+                   ==, ROUTE_NOT_FOUND);
+  return MUNIT_OK;
+}
+
+static char *post_counts[] = {"1000", "100000", "1000000", NULL};
+
+static MunitParameterEnum db_params[] = {
+    {"posts", post_counts},
+    {NULL, NULL},
+};
+
+static MunitTest bench_tests[] = {
+    {"/parse_blog_post", bench_parse_blog_post, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/client_new", bench_client_new, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/json_writer", bench_json_writer, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/router_match", bench_router_match, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/timer_wheel", bench_timer_wheel, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/respond_to_http_request", bench_respond_to_http_request, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/handle_post_request", bench_handle_post_request, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/handle_post_index_request", bench_handle_post_index_request,
+     bench_setup, bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/feed_add_post", bench_feed_add_post, bench_setup, bench_tear_down,
+     MUNIT_TEST_OPTION_NONE, db_params},
+    {"/post_snapshot_find", bench_post_snapshot_find, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/open_close", bench_open_close_db, bench_setup, bench_tear_down,
+     MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/create_blog_table", bench_create_blog_table, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/insert_blog_post", bench_insert_blog_post, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/blog_post_upload", bench_blog_post_upload, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/post_import", bench_post_import, bench_setup, bench_tear_down,
+     MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/select_blog_post", bench_select_blog_post, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/blog_post_titles", bench_blog_post_titles, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/user_post_titles", bench_user_post_titles, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {"/db/get_next_post_id", bench_get_next_post_id, bench_setup,
+     bench_tear_down, MUNIT_TEST_OPTION_NONE, db_params},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+};
+
+static MunitTest import_tests[] = {
+    {"/ndjson", test_import_ndjson, import_setup, import_tear_down,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/csv_header", test_import_csv_header, import_setup, import_tear_down,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/csv_no_header", test_import_csv_no_header, import_setup,
+     import_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+    {"/commit", test_import_commit, import_setup, import_tear_down,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+};
+
+static char *h2_bad_inputs[] = {"preface", "stream0", "oversized", "hpack",
+                                NULL};
+
+static MunitParameterEnum h2_bad_input_params[] = {
+    {"input", h2_bad_inputs},
+    {NULL, NULL},
+};
+
+static char *h2_malformed_fields[] = {"crlf", "nul", "uppercase", "path",
+                                      NULL};
+
+static MunitParameterEnum h2_malformed_header_params[] = {
+    {"field", h2_malformed_fields},
+    {NULL, NULL},
+};
+
+static MunitTest http2_tests[] = {
+    {"/hpack_round_trip", test_hpack_round_trip, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/hpack_bad_input", test_hpack_bad_input, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/request", test_h2_request, h2_setup, h2_tear_down,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/goaway", test_h2_goaway, h2_setup, h2_tear_down, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/window", test_h2_window, h2_setup, h2_tear_down,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {"/malformed_header", test_h2_malformed_header, h2_setup, h2_tear_down,
+     MUNIT_TEST_OPTION_NONE, h2_malformed_header_params},
+    {"/bad_input", test_h2_bad_input, h2_setup, h2_tear_down,
+     MUNIT_TEST_OPTION_NONE, h2_bad_input_params},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+};
+
+static MunitTest router_tests[] = {
+    {"/methods", test_router_methods, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+};
+
+static MunitSuite suites[] = {
+    {"/bench", bench_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE},
+    {"/router", router_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE},
+    {"/http2", http2_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE},
+    {"/import", import_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE},
+    {NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE},
+};
+
+static const MunitSuite all_suites = {"", NULL, suites, 1,
+                                      MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  init_response_caches();
+  return munit_suite_main(&all_suites, NULL, argc, argv);
+}
@@ -0,0 +1,123 @@
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELAY ((1UL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+static void list_init(Timer *head) {
+  head->prev = head;
+  head->next = head;
+}
+
+static void list_unlink(Timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+void timer_wheel_init(TimerWheel *wheel) {
+  pthread_mutex_init(&wheel->lock, NULL);
+  wheel->now = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+      list_init(&wheel->slots[level][slot]);
+}
+
+void timer_init(Timer *timer) {
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+// The level is picked by how far away the expiry is; the slot within it
+// by the expiry's digit for that level.
+static void place(TimerWheel *wheel, Timer *timer) {
+  unsigned long delta = timer->expires - wheel->now;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >> ((level + 1) * TIMER_WHEEL_SLOT_BITS))
+    level++;
+
+  int slot = (timer->expires >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK;
+  Timer *head = &wheel->slots[level][slot];
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+void timer_arm(TimerWheel *wheel, Timer *timer, unsigned long ticks,
+               TimerFunc fn, void *arg) {
+  if (ticks < 1)
+    ticks = 1;
+  if (ticks > MAX_DELAY)
+    ticks = MAX_DELAY;
+
+  pthread_mutex_lock(&wheel->lock);
+  if (timer->prev)
+    list_unlink(timer);
+  timer->expires = wheel->now + ticks;
+  timer->fn = fn;
+  timer->arg = arg;
+  place(wheel, timer);
+  pthread_mutex_unlock(&wheel->lock);
+}
+
+void timer_cancel(TimerWheel *wheel, Timer *timer) {
+  pthread_mutex_lock(&wheel->lock);
+  if (timer->prev)
+    list_unlink(timer);
+  pthread_mutex_unlock(&wheel->lock);
+}
+
+int timer_is_armed(TimerWheel *wheel, Timer *timer) {
+  pthread_mutex_lock(&wheel->lock);
+  int armed = timer->prev != NULL;
+  pthread_mutex_unlock(&wheel->lock);
+  return armed;
+}
+
+// re-places every timer of one slot, now that they are closer
+static void cascade(TimerWheel *wheel, int level, int slot) {
+  Timer pending;
+  Timer *head = &wheel->slots[level][slot];
+  if (head->next == head)
+    return;
+
+  pending.next = head->next;
+  pending.prev = head->prev;
+  pending.next->prev = &pending;
+  pending.prev->next = &pending;
+  list_init(head);
+
+  while (pending.next != &pending) {
+    Timer *timer = pending.next;
+    list_unlink(timer);
+    place(wheel, timer);
+  }
+}
+
+static void tick(TimerWheel *wheel) {
+  wheel->now++;
+
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+    unsigned long below = wheel->now >> ((level - 1) * TIMER_WHEEL_SLOT_BITS);
+    if (below & SLOT_MASK)
+      break; // the level below has not wrapped
+    cascade(wheel, level,
+            (wheel->now >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK);
+  }
+
+  Timer *head = &wheel->slots[0][wheel->now & SLOT_MASK];
+  while (head->next != head) {
+    Timer *timer = head->next;
+    list_unlink(timer);
+    timer->fn(timer->arg);
+  }
+}
+
+void timer_wheel_advance(TimerWheel *wheel, unsigned long ticks) {
+  pthread_mutex_lock(&wheel->lock);
+  while (ticks-- > 0)
+    tick(wheel);
+  pthread_mutex_unlock(&wheel->lock);
+}
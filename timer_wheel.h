@@ -0,0 +1,50 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <pthread.h>
+
+// A hierarchical timing wheel (Varghese & Lauck). Level 0 has one slot per
+// tick; each level above covers a whole turn of the one below, and its
+// timers cascade down as that level wraps. Arming and cancelling are O(1)
+// list operations, whatever the number of timers.
+//
+// With 4 levels of 64 slots, delays up to 64^4 ticks are exact to the
+// tick; longer ones are clamped.
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef void (*TimerFunc)(void *arg);
+
+// Embedded in whatever it times; owned by the caller.
+typedef struct Timer {
+  struct Timer *prev; // NULL while not armed
+  struct Timer *next;
+  unsigned long expires; // tick
+  TimerFunc fn;
+  void *arg;
+} Timer;
+
+typedef struct {
+  pthread_mutex_t lock;
+  unsigned long now; // ticks advanced so far
+  Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list heads
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel);
+void timer_init(Timer *timer);
+
+// (Re)arms timer to call fn(arg) after ticks (at least 1) have passed.
+void timer_arm(TimerWheel *wheel, Timer *timer, unsigned long ticks,
+               TimerFunc fn, void *arg);
+// Once this returns the callback is not running and will not run.
+void timer_cancel(TimerWheel *wheel, Timer *timer);
+int timer_is_armed(TimerWheel *wheel, Timer *timer);
+
+// Moves the wheel forward, calling every timer that expires on the way.
+// Callbacks run with the wheel locked: they must be quick and must not
+// arm or cancel timers.
+void timer_wheel_advance(TimerWheel *wheel, unsigned long ticks);
+
+#endif
@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "placement.h"
+#include "server.h"
+#include "warmup.h"
+
+static pthread_t warmup_thread;
+static int warmup_running;
+static int warmup_stopping;
+
+static double elapsed_ms(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000.0 +
+         (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+// The posts to warm, recent ones first, then the hot ones, so that those
+// win any slot they share with a recent post.
+typedef struct {
+  int *ids;
+  int count;
+  int recent;
+} WarmupList;
+
+// one per NUMA node; each fills its node's post cache (see placement.h)
+typedef struct {
+  int cpu;
+  const WarmupList *list;
+  int warmed;
+} NodeWarmup;
+
+static int warm_post(int post_id, Arena *scratch) {
+  CachedBody *entry = load_post_body(post_id, scratch);
+  arena_reset(scratch);
+  if (!entry)
+    return FAIL;
+  cached_body_release(entry);
+  return SUCCESS;
+}
+
+static void list_recent_posts(WarmupList *list) {
+  list->ids = malloc(WARMUP_RECENT_POSTS * sizeof(int));
+  int count = select_recent_post_ids(&db, list->ids, WARMUP_RECENT_POSTS);
+  if (count < 0) {
+    if (debug) fprintf(stderr, "warm-up: listing posts: %s\n", db.errmsg);
+    count = 0;
+  }
+  list->count = list->recent = count;
+}
+
+static void list_hot_posts(WarmupList *list) {
+  FILE *fp = fopen(HOT_KEYS_PATH, "r");
+  if (!fp)
+    return; // first start, or the last server never saved any
+
+  int cap = list->count + 1024;
+  list->ids = realloc(list->ids, cap * sizeof(int));
+  int post_id;
+  while (fscanf(fp, "%d", &post_id) == 1) {
+    if (list->count == cap) {
+      cap *= 2;
+      list->ids = realloc(list->ids, cap * sizeof(int));
+    }
+    list->ids[list->count++] = post_id;
+  }
+  fclose(fp);
+}
+
+static void *node_warmup_threadfunc(void *arg) {
+  NodeWarmup *node = arg;
+  placement_thread_start(node->cpu);
+
+  Arena scratch;
+  arena_init(&scratch);
+  for (int i = 0; i < node->list->count; i++) {
+    if (__atomic_load_n(&warmup_stopping, __ATOMIC_RELAXED))
+      break;
+    if (warm_post(node->list->ids[i], &scratch) == SUCCESS)
+      node->warmed++;
+  }
+  arena_free(&scratch);
+  return NULL;
+}
+
+static void *warmup_threadfunc(void *unused) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int index_warmed = warm_post_index() == SUCCESS;
+  WarmupList list = {NULL, 0, 0};
+  list_recent_posts(&list);
+  list_hot_posts(&list);
+
+  // every node's cache, each from a thread on that node
+  int nodes = placement_node_count();
+  NodeWarmup warmups[PLACEMENT_MAX_NODES];
+  pthread_t threads[PLACEMENT_MAX_NODES];
+  int started = 0;
+  for (int i = 0; i < nodes; i++) {
+    warmups[i] = (NodeWarmup){placement_network_cpu_on_node(i), &list, 0};
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    placement_thread_attr(&attributes, warmups[i].cpu);
+    if (pthread_create(&threads[i], &attributes, node_warmup_threadfunc,
+                       &warmups[i]) != 0) {
+      perror("pthread_create");
+      pthread_attr_destroy(&attributes);
+      break;
+    }
+    pthread_attr_destroy(&attributes);
+    started++;
+  }
+  int warmed = 0;
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    warmed += warmups[i].warmed;
+  }
+  free(list.ids);
+
+  if (debug)
+    fprintf(stderr,
+            "warm-up: index %s, %d recent and %d hot posts, %d renders on "
+            "%d node(s) in %.1f ms\n",
+            index_warmed ? "cached" : "not cached", list.recent,
+            list.count - list.recent, warmed, started, elapsed_ms(&start));
+  return NULL;
+}
+
+int start_cache_warmup(void) {
+  warmup_stopping = 0;
+  if (pthread_create(&warmup_thread, NULL, warmup_threadfunc, NULL) != 0) {
+    perror("pthread_create");
+    return FAIL;
+  }
+  warmup_running = 1;
+  return SUCCESS;
+}
+
+void stop_cache_warmup(void) {
+  if (!warmup_running)
+    return;
+  __atomic_store_n(&warmup_stopping, 1, __ATOMIC_RELAXED);
+  pthread_join(warmup_thread, NULL);
+  warmup_running = 0;
+}
+
+static void write_post_id(void *ctx, int post_id) {
+  fprintf(ctx, "%d\n", post_id);
+}
+
+int save_hot_keys(void) {
+  // written aside and renamed, so a successor never reads half a file
+  const char *tmp_path = HOT_KEYS_PATH ".tmp";
+  FILE *fp = fopen(tmp_path, "w");
+  if (!fp) {
+    perror("hot keys");
+    return FAIL;
+  }
+  for_each_cached_post(write_post_id, fp);
+  if (fclose(fp) != 0 || rename(tmp_path, HOT_KEYS_PATH) != 0) {
+    perror("hot keys");
+    remove(tmp_path);
+    return FAIL;
+  }
+  return SUCCESS;
+}
@@ -0,0 +1,26 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+// A restarted server starts with empty render caches. While it already
+// serves, a background thread fills them: the index, the most recently
+// published posts, then the posts that were hot when the last server
+// stopped (its hot-key file). Those go last so that they win any slot
+// they share with a recent post. Posts are cached per NUMA node, so each
+// node's cache is filled by a thread of its own on that node.
+
+// one post id per line; written at shutdown and before a handoff
+#define HOT_KEYS_PATH "blog_server.hot"
+// recent posts rendered on top of the hot keys; the post cache is
+// direct-mapped, so more than its slot count would only evict each other
+#define WARMUP_RECENT_POSTS 1024
+
+// Returns FAIL or SUCCESS.
+int start_cache_warmup(void);
+// Stops the warm-up if it is still running and waits for it.
+void stop_cache_warmup(void);
+
+// Records which posts are cached now, for the next server's warm-up.
+// Returns FAIL or SUCCESS.
+int save_hot_keys(void);
+
+#endif